@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_BLOCK_ERROR
+#define INCLUDED_OASTC_BLOCK_ERROR
+
+#include "oastc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OASTC_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define OASTC_X86_SIMD 0
+#endif
+
+namespace oastc
+{
+
+/*
+ * Kernels that decode a candidate LDR block and return its squared error
+ * against the source texels, for encoders trying many candidates per block.
+ *
+ * Each texel i is interpolated between e0[parts[i]] and e1[parts[i]] (or
+ * e0[0] and e1[0] if parts is null) with weight weights[i] (0..64, after
+ * infill), exactly as Block::write_decoded() does in the LDR linear
+ * profile: the endpoints are expanded to 16 bits, interpolated, converted
+ * to fp16 and then to unorm8. Dual-plane blocks aren't supported.
+ *
+ * The conversion to unorm8 goes through fp16, which keeps the top 11
+ * significant bits of the 16-bit value. The SIMD kernels do that by
+ * converting to fp32 and clearing its low 13 mantissa bits.
+ */
+typedef int (*block_error_fn)(const uint8x4_t *texels, int num_texels, const uint8_t *parts,
+        const uint8x4_t *e0, const uint8x4_t *e1, const int *weights);
+
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+};
+
+static inline int decode_ldr_channel(int e0, int e1, int w)
+{
+    int v = (e0 * 257 * (64 - w) + e1 * 257 * w + 32) >> 6;
+    return v == 65535 ? 0xff : fp16::unorm8_from_uint16_div_64k(v);
+}
+
+static int block_error_scalar(const uint8x4_t *texels, int num_texels, const uint8_t *parts,
+        const uint8x4_t *e0, const uint8x4_t *e1, const int *weights)
+{
+    int error = 0;
+    for (int i = 0; i < num_texels; ++i) {
+        int p = parts ? parts[i] : 0;
+        for (int c = 0; c < 4; ++c) {
+            int d = decode_ldr_channel(e0[p].v[c], e1[p].v[c], weights[i]) - texels[i].v[c];
+            error += d * d;
+        }
+    }
+    return error;
+}
+
+#if OASTC_X86_SIMD
+
+static inline uint32_t load_u32(const uint8x4_t &t)
+{
+    uint32_t v;
+    memcpy(&v, t.v, 4);
+    return v;
+}
+
+/**
+ * Convert 32-bit interpolated values (0..65535) to unorm8 via fp16 rounding.
+ * The result of (m * 255 >> 15 + 1) >> 1, where m is v truncated to 11
+ * significant bits, matches fp16::unorm8_from_uint16_div_64k() for every v.
+ */
+__attribute__((target("sse2")))
+static inline __m128i unorm8_from_uint16_div_64k_sse2(__m128i v)
+{
+    __m128 f = _mm_and_ps(_mm_cvtepi32_ps(v), _mm_castsi128_ps(_mm_set1_epi32(0xffffe000)));
+    __m128i m = _mm_cvttps_epi32(f);
+    __m128i r = _mm_srli_epi32(_mm_sub_epi32(_mm_slli_epi32(m, 8), m), 15);
+    return _mm_srli_epi32(_mm_add_epi32(r, _mm_set1_epi32(1)), 1);
+}
+
+/**
+ * Expand 16-bit interpolation results t = e0*(64-w) + e1*w (for 8-bit
+ * endpoints) to the 32-bit value the decoder interpolates, ((t * 257) + 32) >> 6
+ */
+__attribute__((target("sse2")))
+static inline __m128i interpolate_sse2(__m128i t)
+{
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(t, 8), t), _mm_set1_epi32(32)), 6);
+}
+
+__attribute__((target("sse2")))
+static int block_error_sse2(const uint8x4_t *texels, int num_texels, const uint8_t *parts,
+        const uint8x4_t *e0, const uint8x4_t *e1, const int *weights)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w64 = _mm_set1_epi16(64);
+    __m128i sum = zero;
+
+    // Two texels (8 channels of 16 bits) at a time
+    int i = 0;
+    for (; i + 2 <= num_texels; i += 2) {
+        int p0 = parts ? parts[i] : 0;
+        int p1 = parts ? parts[i+1] : 0;
+        __m128i a = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, load_u32(e0[p1]), load_u32(e0[p0])), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, load_u32(e1[p1]), load_u32(e1[p0])), zero);
+        __m128i w = _mm_set_epi16(weights[i+1], weights[i+1], weights[i+1], weights[i+1],
+                weights[i], weights[i], weights[i], weights[i]);
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(w64, w)), _mm_mullo_epi16(b, w));
+
+        __m128i r0 = unorm8_from_uint16_div_64k_sse2(interpolate_sse2(_mm_unpacklo_epi16(t, zero)));
+        __m128i r1 = unorm8_from_uint16_div_64k_sse2(interpolate_sse2(_mm_unpackhi_epi16(t, zero)));
+        __m128i decoded = _mm_packs_epi32(r0, r1);
+
+        __m128i src = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&texels[i]), zero);
+        __m128i d = _mm_sub_epi16(decoded, src);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(d, d));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    int error = _mm_cvtsi128_si32(sum);
+
+    return error + block_error_scalar(texels + i, num_texels - i, parts ? parts + i : nullptr, e0, e1, weights + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i unorm8_from_uint16_div_64k_avx2(__m256i v)
+{
+    __m256 f = _mm256_and_ps(_mm256_cvtepi32_ps(v), _mm256_castsi256_ps(_mm256_set1_epi32(0xffffe000)));
+    __m256i m = _mm256_cvttps_epi32(f);
+    __m256i r = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_slli_epi32(m, 8), m), 15);
+    return _mm256_srli_epi32(_mm256_add_epi32(r, _mm256_set1_epi32(1)), 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i interpolate_avx2(__m256i t)
+{
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(t, 8), t), _mm256_set1_epi32(32)), 6);
+}
+
+__attribute__((target("avx2")))
+static int block_error_avx2(const uint8x4_t *texels, int num_texels, const uint8_t *parts,
+        const uint8x4_t *e0, const uint8x4_t *e1, const int *weights)
+{
+    const __m256i w64 = _mm256_set1_epi16(64);
+    __m256i sum = _mm256_setzero_si256();
+
+    // Four texels (16 channels of 16 bits) at a time
+    int i = 0;
+    for (; i + 4 <= num_texels; i += 4) {
+        __m128i a8, b8;
+        if (parts) {
+            a8 = _mm_set_epi32(load_u32(e0[parts[i+3]]), load_u32(e0[parts[i+2]]), load_u32(e0[parts[i+1]]), load_u32(e0[parts[i]]));
+            b8 = _mm_set_epi32(load_u32(e1[parts[i+3]]), load_u32(e1[parts[i+2]]), load_u32(e1[parts[i+1]]), load_u32(e1[parts[i]]));
+        } else {
+            a8 = _mm_set1_epi32(load_u32(e0[0]));
+            b8 = _mm_set1_epi32(load_u32(e1[0]));
+        }
+        __m256i a = _mm256_cvtepu8_epi16(a8);
+        __m256i b = _mm256_cvtepu8_epi16(b8);
+        __m256i w = _mm256_set_epi16(
+                weights[i+3], weights[i+3], weights[i+3], weights[i+3],
+                weights[i+2], weights[i+2], weights[i+2], weights[i+2],
+                weights[i+1], weights[i+1], weights[i+1], weights[i+1],
+                weights[i], weights[i], weights[i], weights[i]);
+        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, _mm256_sub_epi16(w64, w)), _mm256_mullo_epi16(b, w));
+
+        __m256i r0 = unorm8_from_uint16_div_64k_avx2(interpolate_avx2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(t))));
+        __m256i r1 = unorm8_from_uint16_div_64k_avx2(interpolate_avx2(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(t, 1))));
+
+        // packs works within 128-bit lanes, so pack the source texels the
+        // same way to keep the channels lined up
+        __m128i src8 = _mm_loadu_si128((const __m128i *)&texels[i]);
+        __m256i s0 = _mm256_cvtepu8_epi32(src8);
+        __m256i s1 = _mm256_cvtepu8_epi32(_mm_srli_si128(src8, 8));
+        __m256i d = _mm256_sub_epi16(_mm256_packs_epi32(r0, r1), _mm256_packs_epi32(s0, s1));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(d, d));
+    }
+
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+    int error = _mm_cvtsi128_si32(sum128);
+
+    return error + block_error_scalar(texels + i, num_texels - i, parts ? parts + i : nullptr, e0, e1, weights + i);
+}
+
+#endif // OASTC_X86_SIMD
+
+/**
+ * Returns true if this build and CPU can run kernels of the given level
+ */
+static bool simd_level_supported(simd_level level)
+{
+    switch (level) {
+    case simd_level::scalar:
+        return true;
+#if OASTC_X86_SIMD
+    case simd_level::sse2:
+        return __builtin_cpu_supports("sse2");
+    case simd_level::avx2:
+        return __builtin_cpu_supports("avx2");
+#else
+    case simd_level::sse2:
+    case simd_level::avx2:
+        return false;
+#endif
+    }
+    UNREACHABLE();
+}
+
+/**
+ * Returns the block error kernel for the given level, which must be
+ * supported
+ */
+static block_error_fn block_error_kernel(simd_level level)
+{
+    ASSERT(simd_level_supported(level));
+    switch (level) {
+    case simd_level::scalar:
+        return block_error_scalar;
+#if OASTC_X86_SIMD
+    case simd_level::sse2:
+        return block_error_sse2;
+    case simd_level::avx2:
+        return block_error_avx2;
+#else
+    case simd_level::sse2:
+    case simd_level::avx2:
+        break;
+#endif
+    }
+    UNREACHABLE();
+}
+
+/**
+ * Returns the fastest block error kernel this CPU supports
+ */
+static inline block_error_fn block_error_kernel()
+{
+    if (simd_level_supported(simd_level::avx2))
+        return block_error_kernel(simd_level::avx2);
+    if (simd_level_supported(simd_level::sse2))
+        return block_error_kernel(simd_level::sse2);
+    return block_error_kernel(simd_level::scalar);
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_BLOCK_ERROR
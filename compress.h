@@ -0,0 +1,1325 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_OASTC_COMPRESS
+#define INCLUDED_OASTC_COMPRESS
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+#include "oastc.h"
+#include "block_error.h"
+#include "configs.h"
+#include "parallel.h"
+#include "partitions.h"
+
+namespace oastc
+{
+
+/**
+ * 64-bit hash of a byte string, for detecting changed data (not for
+ * security). Stable across platforms and versions of this library, since
+ * hashes are stored in files.
+ */
+static uint64_t hash_bytes(const uint8_t *data, size_t size)
+{
+    const uint64_t k1 = 0x9e3779b97f4a7c15ull, k2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t h = size * k1;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w = 0;
+        for (int b = 0; b < 8; ++b)
+            w |= (uint64_t)data[i + b] << (8 * b);
+        h ^= w * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+    uint64_t w = 0;
+    for (int b = 0; i + b < size; ++b)
+        w |= (uint64_t)data[i + b] << (8 * b);
+    h ^= w * k2;
+
+    // Final avalanche, so every input bit affects every output bit
+    h ^= h >> 33;
+    h *= k2;
+    h ^= h >> 29;
+    h *= k1;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Find endpoints along the principal axis of the texels' colours, over the
+ * channels in channel_mask (bit 0 = R, ..., bit 3 = A). Other channels are
+ * set to 255.
+ */
+static void fit_principal_axis(const uint8x4_t *texels, int num_texels, int channel_mask, int e0[4], int e1[4])
+{
+    float mean[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < num_texels; ++i)
+        for (int c = 0; c < 4; ++c)
+            mean[c] += texels[i].v[c];
+    for (int c = 0; c < 4; ++c)
+        mean[c] /= num_texels;
+
+    float cov[4][4] = {};
+    for (int i = 0; i < num_texels; ++i) {
+        float d[4];
+        for (int c = 0; c < 4; ++c)
+            d[c] = (channel_mask & (1 << c)) ? texels[i].v[c] - mean[c] : 0.0f;
+        for (int c0 = 0; c0 < 4; ++c0)
+            for (int c1 = 0; c1 < 4; ++c1)
+                cov[c0][c1] += d[c0] * d[c1];
+    }
+
+    // Power iteration, starting from the diagonal so it converges quickly
+    // for the common near-greyscale case
+    float axis[4];
+    for (int c = 0; c < 4; ++c)
+        axis[c] = (channel_mask & (1 << c)) ? 1.0f : 0.0f;
+    for (int iter = 0; iter < 8; ++iter) {
+        float next[4] = { 0, 0, 0, 0 };
+        float len = 0;
+        for (int c0 = 0; c0 < 4; ++c0) {
+            for (int c1 = 0; c1 < 4; ++c1)
+                next[c0] += cov[c0][c1] * axis[c1];
+            len = std::max(len, std::fabs(next[c0]));
+        }
+        if (len == 0)
+            break;
+        for (int c = 0; c < 4; ++c)
+            axis[c] = next[c] / len;
+    }
+
+    float min_t = 0, max_t = 0;
+    float axis_len2 = 0;
+    for (int c = 0; c < 4; ++c)
+        axis_len2 += axis[c] * axis[c];
+    if (axis_len2 > 0) {
+        for (int i = 0; i < num_texels; ++i) {
+            float t = 0;
+            for (int c = 0; c < 4; ++c)
+                t += (texels[i].v[c] - mean[c]) * axis[c];
+            t /= axis_len2;
+            min_t = std::min(min_t, t);
+            max_t = std::max(max_t, t);
+        }
+    }
+
+    for (int c = 0; c < 4; ++c) {
+        if (channel_mask & (1 << c)) {
+            e0[c] = std::max(0, std::min(255, (int)std::lround(mean[c] + axis[c] * min_t)));
+            e1[c] = std::max(0, std::min(255, (int)std::lround(mean[c] + axis[c] * max_t)));
+        } else {
+            e0[c] = e1[c] = 255;
+        }
+    }
+}
+
+/**
+ * Least-squares fit of endpoints to the texels' colours, given each
+ * texel's interpolation weight (0..64). Returns false if the weights are
+ * degenerate (all equal), in which case e0/e1 are unchanged.
+ */
+static bool refit_endpoints(const uint8x4_t *texels, const int *weights, int num_texels, int e0[4], int e1[4])
+{
+    float a = 0, b = 0, c = 0;
+    float x0[4] = { 0, 0, 0, 0 }, x1[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < num_texels; ++i) {
+        float t = weights[i] / 64.0f;
+        float s = 1.0f - t;
+        a += s * s;
+        b += s * t;
+        c += t * t;
+        for (int ch = 0; ch < 4; ++ch) {
+            x0[ch] += s * texels[i].v[ch];
+            x1[ch] += t * texels[i].v[ch];
+        }
+    }
+
+    float det = a * c - b * b;
+    if (std::fabs(det) < 1e-6f)
+        return false;
+
+    for (int ch = 0; ch < 4; ++ch) {
+        e0[ch] = std::max(0, std::min(255, (int)std::lround((c * x0[ch] - b * x1[ch]) / det)));
+        e1[ch] = std::max(0, std::min(255, (int)std::lround((a * x1[ch] - b * x0[ch]) / det)));
+    }
+    return true;
+}
+
+/**
+ * Speed/quality tradeoff for Compressor.
+ *
+ * ultrafast is intended for textures generated at runtime: every block of a
+ * given footprint and endpoint class uses the same block mode, the endpoints
+ * are the bounding box of the block's colours, and each weight is just the
+ * nearest quantised projection. There is no search and no error
+ * measurement, so every block costs the same small, fixed amount of work.
+ *
+ * The other levels search an increasing number of block modes per block.
+ * medium also tries 2 partitions, and thorough tries 2 and 3 partitions.
+ */
+enum class compress_quality
+{
+    ultrafast,
+    fast,
+    medium,
+    thorough,
+};
+
+/**
+ * Counts of how blocks were compressed, for tuning the search
+ */
+struct compress_stats
+{
+    uint64_t blocks = 0;
+    uint64_t void_extent_blocks = 0;
+
+    // Blocks whose search was seeded with the block mode of a neighbour
+    uint64_t seeded_blocks = 0;
+    // Seeded blocks where a neighbour's mode was good enough to skip the
+    // full search
+    uint64_t seed_accepted = 0;
+    // Seeded blocks where the full search found nothing better than a
+    // neighbour's mode
+    uint64_t seed_best = 0;
+
+    compress_stats &operator+=(const compress_stats &o)
+    {
+        blocks += o.blocks;
+        void_extent_blocks += o.void_extent_blocks;
+        seeded_blocks += o.seeded_blocks;
+        seed_accepted += o.seed_accepted;
+        seed_best += o.seed_best;
+        return *this;
+    }
+};
+
+/**
+ * Compresses RGBA8 texels into 2D LDR ASTC blocks.
+ *
+ * Every block uses a single weight plane, with endpoints fitted along the
+ * principal axis of each partition's colours and refined by least squares.
+ * Partitionings are chosen from a PartitionLibrary, and only the few that
+ * best match a clustering of the block's colours are tried. The Compressor
+ * precomputes everything that depends only on the block size, so
+ * compress_block() does no allocation and can be called concurrently from
+ * multiple threads.
+ *
+ * When compressing a whole image at medium or thorough quality, each block
+ * first tries the block modes its left and top neighbours ended up with,
+ * since neighbouring blocks usually need similar modes, and skips the rest
+ * of the search if one of them is already close to lossless.
+ */
+class Compressor
+{
+public:
+    Compressor(int block_w, int block_h, compress_quality quality = compress_quality::medium);
+
+    /**
+     * Compress block_w*block_h RGBA8 texels (in x-major order) into a
+     * 16-byte block. A block of a single colour is encoded as a void-extent
+     * block with no extent coordinates, without any search.
+     */
+    void compress_block(const uint8_t *texels, uint8_t *output) const;
+
+    /**
+     * Like compress_block(), for the block whose top-left texel is at (x, y)
+     * in an image_w*image_h image. A void-extent block records the texels it
+     * covers inside the image as its extent, so decoders know that any
+     * sample in that region is the constant colour.
+     */
+    void compress_block(const uint8_t *texels, uint8_t *output, int x, int y, int image_w, int image_h) const;
+
+    /**
+     * Compress an RGBA8 image (with rows row_pitch bytes apart) into an
+     * array of 16-byte blocks, in the same order as a .astc file. Texels
+     * past the right and bottom edges are copies of the nearest edge texel.
+     * The output does not depend on num_threads. If stats is not null,
+     * the counts for this image are added to it.
+     */
+    void compress_image(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, uint8_t *blocks,
+            int num_threads = 1, compress_stats *stats = nullptr) const;
+
+    /**
+     * Like compress_image(), but only the rows of blocks in
+     * [block_y_begin, block_y_end). 'blocks' is still the array for the
+     * whole image. Different rows may be compressed concurrently, as long
+     * as block_y_begin is a multiple of seed_group_rows.
+     */
+    void compress_rows(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch,
+            int block_y_begin, int block_y_end, uint8_t *blocks, compress_stats *stats = nullptr) const;
+
+    /**
+     * Blocks are seeded from the block above them only within groups of
+     * this many rows (starting at row 0), so that groups can be compressed
+     * independently and still give the same output.
+     */
+    static const int seed_group_rows = 4;
+
+    /**
+     * Number of rows of blocks that compress_image() hands to a thread at
+     * once (a multiple of seed_group_rows). Cheaper quality levels use
+     * bigger chunks so the scheduling overhead stays negligible.
+     */
+    int rows_per_chunk(int image_w) const;
+
+    /**
+     * Compute hash_bytes() of the texels of every block of an image (with
+     * the same edge clamping as compress_image()), in .astc block order.
+     */
+    void hash_blocks(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, uint64_t *hashes,
+            int num_threads = 1) const;
+
+    /**
+     * Update the output of an earlier compress_image() of a same-sized image
+     * whose block hashes were old_hashes: recompress only the blocks whose
+     * hash in new_hashes (from hash_blocks() on the new image) differs.
+     * Blocks whose neighbours' block modes changed are recompressed too,
+     * since their search is seeded from them, so the result is identical to
+     * compressing the whole new image. Returns the number of blocks
+     * recompressed.
+     */
+    int compress_changed_blocks(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch,
+            const uint64_t *old_hashes, const uint64_t *new_hashes, uint8_t *blocks, int num_threads = 1) const;
+
+    int block_w, block_h;
+    compress_quality quality;
+
+private:
+    // The colour endpoint modes we encode with, indexed by endpoint_class()
+    static const int num_cem_classes = 4;
+
+    struct infill_texel
+    {
+        uint8_t idx[4]; // grid indices
+        uint8_t w[4]; // bilinear weights, summing to 16
+    };
+
+    struct block_config
+    {
+        int num_parts;
+        int cem;
+        int wt_w, wt_h;
+        int high_prec, wt_range;
+        int ce_range; // index into cem_ranges
+        float quant_error;
+        float score;
+        std::vector<infill_texel> infill;
+        bool identity_infill; // grid is the same size as the block
+
+        // Everything encode() needs apart from the endpoints and weights
+        Block block;
+    };
+
+    struct trial
+    {
+        int error;
+        int partition_index;
+        uint8_t endpoints_quant[32];
+        uint8_t weights_quant[64];
+    };
+
+    // The block mode of an already-compressed neighbouring block
+    struct seed_mode
+    {
+        int num_parts;
+        int wt_w, wt_h;
+        int high_prec, wt_range;
+
+        bool operator==(const seed_mode &o) const
+        {
+            return num_parts == o.num_parts && wt_w == o.wt_w && wt_h == o.wt_h
+                && high_prec == o.high_prec && wt_range == o.wt_range;
+        }
+    };
+
+    // The best trial found so far for one block, and which config and
+    // partitioning each seed tried, so the full search doesn't repeat them
+    struct search_state
+    {
+        trial best;
+        const block_config *best_config;
+        const block_config *seeded_configs[2];
+        int seeded_partitions[2];
+        int num_seeded;
+    };
+
+    static int endpoint_class(const uint8x4_t *texels, int num_texels);
+    void gather_block(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, int bx, int by,
+            uint8_t *texels) const;
+    bool is_constant(const uint8x4_t *texels) const;
+    void encode_void_extent(const uint8x4_t &colour, int x, int y, int image_w, int image_h, uint8_t *output) const;
+    void compress_block_search(const uint8x4_t *texels, uint8_t *output,
+            const seed_mode *seeds, int num_seeds, compress_stats &stats) const;
+    void compress_block_seeded(const uint8_t *input, uint8_t *output, int x, int y, int image_w, int image_h,
+            const seed_mode *seeds, int num_seeds, compress_stats &stats) const;
+    int neighbour_seeds(const uint8_t *row_blocks, const uint8_t *above_blocks, int bx, seed_mode *seeds) const;
+    const block_config *find_seed_config(const seed_mode &seed, int cls) const;
+    static int max_candidates(compress_quality quality);
+    void build_configs(const ConfigTable &table, int num_parts, int max_candidates);
+    void quantise_endpoints(const block_config &config, const int *e0, const int *e1,
+            uint8_t *quant, int d0[4], int d1[4]) const;
+    void project_weights(const uint8x4_t *texels, const uint8_t *parts, int num_parts,
+            const int (*d0)[4], const int (*d1)[4], int *ideal) const;
+    void fit_weights(const block_config &config, const int *ideal, int refine_iterations, trial &result) const;
+    void measure_error(const block_config &config, const uint8x4_t *texels, const uint8_t *parts,
+            const int (*d0)[4], const int (*d1)[4], trial &result, int *texel_weights) const;
+    void try_endpoints(const block_config &config, const uint8x4_t *texels, const uint8_t *parts,
+            const int (*e0)[4], const int (*e1)[4], trial &result, int *texel_weights) const;
+    void try_config(const block_config &config, const uint8x4_t *texels,
+            const uint8_t *parts, int partition_index, const int (*e0)[4], const int (*e1)[4],
+            search_state &search) const;
+    void search_configs(const std::vector<block_config> &list, const uint8x4_t *texels,
+            const uint8_t *parts, int partition_index, const int (*e0)[4], const int (*e1)[4],
+            search_state &search) const;
+    void fit_pattern(const uint8x4_t *texels, int cls, const PartitionLibrary::pattern &pat,
+            uint8_t *parts, int (*e0)[4], int (*e1)[4]) const;
+    void try_partitions(const uint8x4_t *texels, int cls, search_state &search) const;
+    void compress_block_ultrafast(const uint8x4_t *texels, uint8_t *output) const;
+    void encode(const block_config &config, const trial &t, uint8_t *output) const;
+
+    int num_texels;
+    Encoder encoder;
+    block_error_fn error_kernel;
+
+    // [num_parts-1][endpoint class]
+    std::vector<block_config> configs[4][num_cem_classes];
+
+    // Partitions are only tried for num_parts up to max_parts, using the
+    // max_patterns best-ranked patterns of each
+    int max_parts;
+    int max_patterns;
+    std::unique_ptr<PartitionLibrary> partitions;
+
+    // Whether compress_image() seeds each block's search with its
+    // neighbours' block modes, and the largest error (summed over the
+    // block) at which a seeded mode is accepted without the full search
+    bool use_seeds;
+    int seed_accept_error;
+
+    const QuantisationTables &quant;
+};
+
+static const int cem_for_class[4] = { 0, 4, 8, 12 };
+static const int channel_mask_for_class[4] = { 0x1, 0x9, 0x7, 0xf };
+
+Compressor::Compressor(int block_w, int block_h, compress_quality quality)
+  : block_w(block_w), block_h(block_h), quality(quality), num_texels(block_w * block_h), encoder(block_w, block_h, 1),
+    error_kernel(block_error_kernel()), quant(QuantisationTables::get())
+{
+    ConfigTable table(block_w, block_h, 1);
+    build_configs(table, 1, max_candidates(quality));
+
+    switch (quality) {
+    case compress_quality::ultrafast:
+    case compress_quality::fast:
+        max_parts = 1;
+        max_patterns = 0;
+        break;
+    case compress_quality::medium:
+        max_parts = 2;
+        max_patterns = 2;
+        break;
+    case compress_quality::thorough:
+        max_parts = 3;
+        max_patterns = 4;
+        break;
+    }
+
+    // With only one block mode per endpoint class there's nothing to seed.
+    // medium accepts a seeded mode at about two levels of RMS error per
+    // channel; thorough only when it's within about one level
+    use_seeds = max_candidates(quality) > 1;
+    seed_accept_error = num_texels * (quality == compress_quality::thorough ? 4 : 16);
+
+    if (max_parts > 1) {
+        partitions.reset(new PartitionLibrary(block_w, block_h, 1));
+        for (int num_parts = 2; num_parts <= max_parts; ++num_parts)
+            build_configs(table, num_parts, std::max(1, max_candidates(quality) / 2));
+    }
+}
+
+/**
+ * Number of block modes (weight grid and quantisation combinations) tried
+ * for each block, in order of how well they're expected to do
+ */
+int Compressor::max_candidates(compress_quality quality)
+{
+    switch (quality) {
+    case compress_quality::ultrafast: return 1;
+    case compress_quality::fast: return 1;
+    case compress_quality::medium: return 4;
+    case compress_quality::thorough: return 16;
+    }
+    UNREACHABLE();
+}
+
+void Compressor::build_configs(const ConfigTable &table, int num_parts, int max_candidates)
+{
+    for (int cls = 0; cls < num_cem_classes; ++cls) {
+        int cem = cem_for_class[cls];
+        std::vector<block_config> &list = configs[num_parts - 1][cls];
+
+        for (const encoding_config &legal : table.configs()) {
+            if (legal.dual_plane || legal.num_parts != num_parts || legal.cem_class != (cem >> 2))
+                continue;
+
+            block_config config;
+            legal.setup_block(config.block, cem);
+            config.identity_infill = false;
+            config.num_parts = num_parts;
+            config.cem = cem;
+            config.wt_w = legal.wt_w;
+            config.wt_h = legal.wt_h;
+            config.high_prec = legal.high_prec;
+            config.wt_range = legal.wt_range;
+            config.ce_range = legal.ce_range;
+
+            // Rough estimate of the squared error (as a fraction of the
+            // endpoint range) from quantising the weights and endpoints
+            float weight_step = 1.0f / config.block.wt_max;
+            float endpoint_step = 1.0f / config.block.ce_max;
+            config.quant_error = weight_step * weight_step / 12.0f
+                               + endpoint_step * endpoint_step / 12.0f;
+
+            // Most blocks of real textures have detail that needs a
+            // full-size weight grid, so penalise smaller grids
+            float grid_fraction = (float)(legal.wt_w * legal.wt_h) / (block_w * block_h);
+            config.score = config.quant_error + 0.05f * (1.0f - grid_fraction);
+
+            list.push_back(config);
+        }
+
+        // Keep the best configs by score, but reserve about a quarter of the
+        // candidates for the ones with the least quantisation error (which
+        // have small grids and are best for smooth blocks)
+        std::vector<block_config> by_quant_error = list;
+        std::stable_sort(list.begin(), list.end(),
+                [](const block_config &a, const block_config &b) { return a.score < b.score; });
+        // Among configs with the same quantisation, a bigger grid can only
+        // fit the weights better
+        std::stable_sort(by_quant_error.begin(), by_quant_error.end(),
+                [](const block_config &a, const block_config &b) {
+                    if (a.quant_error != b.quant_error)
+                        return a.quant_error < b.quant_error;
+                    return a.wt_w * a.wt_h > b.wt_w * b.wt_h;
+                });
+
+        int num_by_score = std::max(1, max_candidates - max_candidates / 4);
+        if ((int)list.size() > num_by_score)
+            list.resize(num_by_score);
+        for (const block_config &config : by_quant_error) {
+            if ((int)list.size() >= max_candidates)
+                break;
+            bool found = false;
+            for (const block_config &c : list)
+                if (c.wt_w == config.wt_w && c.wt_h == config.wt_h && c.high_prec == config.high_prec && c.wt_range == config.wt_range)
+                    found = true;
+            if (!found)
+                list.push_back(config);
+        }
+
+        // Precompute the bilinear infill, which matches compute_infill_weights()
+        for (block_config &config : list) {
+            config.infill.resize(num_texels);
+            int Ds = (1024 + block_w / 2) / (block_w - 1);
+            int Dt = (1024 + block_h / 2) / (block_h - 1);
+            for (int t = 0; t < block_h; ++t) {
+                for (int s = 0; s < block_w; ++s) {
+                    int gs = (Ds * s * (config.wt_w - 1) + 32) >> 6;
+                    int gt = (Dt * t * (config.wt_h - 1) + 32) >> 6;
+                    int js = gs >> 4, fs = gs & 0xf;
+                    int jt = gt >> 4, ft = gt & 0xf;
+                    int w11 = (fs * ft + 8) >> 4;
+                    int v0 = js + jt * config.wt_w;
+
+                    // Points on the far edge have zero weight on the next
+                    // grid row/column, which may be past the end of the grid
+                    int max_idx = config.wt_w * config.wt_h - 1;
+                    infill_texel &it = config.infill[s + t * block_w];
+                    it.idx[0] = v0;
+                    it.idx[1] = std::min(v0 + 1, max_idx);
+                    it.idx[2] = std::min(v0 + config.wt_w, max_idx);
+                    it.idx[3] = std::min(v0 + config.wt_w + 1, max_idx);
+                    it.w[0] = 16 - fs - ft + w11;
+                    it.w[1] = fs - w11;
+                    it.w[2] = ft - w11;
+                    it.w[3] = w11;
+                }
+            }
+
+            config.identity_infill = true;
+            for (int i = 0; i < num_texels; ++i)
+                if (config.infill[i].idx[0] != i || config.infill[i].w[0] != 16)
+                    config.identity_infill = false;
+        }
+    }
+}
+
+int Compressor::endpoint_class(const uint8x4_t *texels, int num_texels)
+{
+    bool grey = true, opaque = true;
+    for (int i = 0; i < num_texels; ++i) {
+        const uint8_t *v = texels[i].v;
+        if (v[0] != v[1] || v[0] != v[2])
+            grey = false;
+        if (v[3] != 0xff)
+            opaque = false;
+    }
+    return (grey ? 0 : 2) + (opaque ? 0 : 1);
+}
+
+/**
+ * Quantise one partition's endpoints e0/e1 with the given config into
+ * 'quant'. d0/d1 receive the RGBA endpoints the decoder will see.
+ */
+void Compressor::quantise_endpoints(const block_config &config, const int *e0, const int *e1,
+        uint8_t *quant_out, int d0[4], int d1[4]) const
+{
+    const QuantisationTables::entry *nearest = quant.endpoints[config.ce_range];
+
+    // Quantise the endpoint values, in the order the CEM stores them
+    int num_values = ((config.cem >> 2) + 1) * 2;
+    int values[8];
+    switch (config.cem) {
+    case 0:
+        values[0] = e0[0]; values[1] = e1[0];
+        break;
+    case 4:
+        values[0] = e0[0]; values[1] = e1[0];
+        values[2] = e0[3]; values[3] = e1[3];
+        break;
+    case 8:
+    case 12:
+        for (int c = 0; c < num_values / 2; ++c) {
+            values[c*2] = e0[c];
+            values[c*2+1] = e1[c];
+        }
+        break;
+    default:
+        UNREACHABLE();
+    }
+
+    uint8_t *q = quant_out;
+    int u[8];
+    for (int i = 0; i < num_values; ++i) {
+        q[i] = nearest[values[i]].quant;
+        u[i] = nearest[values[i]].unquant;
+    }
+
+    // RGB(A) direct modes swap the endpoints and apply blue-contraction when
+    // the second endpoint is darker; avoid that by swapping them ourselves
+    if ((config.cem == 8 || config.cem == 12) && u[1] + u[3] + u[5] < u[0] + u[2] + u[4]) {
+        for (int i = 0; i < num_values; i += 2) {
+            std::swap(q[i], q[i+1]);
+            std::swap(u[i], u[i+1]);
+        }
+    }
+
+    // The endpoints the decoder will see
+    switch (config.cem) {
+    case 0:
+        d0[0] = d0[1] = d0[2] = u[0]; d0[3] = 0xff;
+        d1[0] = d1[1] = d1[2] = u[1]; d1[3] = 0xff;
+        break;
+    case 4:
+        d0[0] = d0[1] = d0[2] = u[0]; d0[3] = u[2];
+        d1[0] = d1[1] = d1[2] = u[1]; d1[3] = u[3];
+        break;
+    case 8:
+        d0[0] = u[0]; d0[1] = u[2]; d0[2] = u[4]; d0[3] = 0xff;
+        d1[0] = u[1]; d1[1] = u[3]; d1[2] = u[5]; d1[3] = 0xff;
+        break;
+    case 12:
+        d0[0] = u[0]; d0[1] = u[2]; d0[2] = u[4]; d0[3] = u[6];
+        d1[0] = u[1]; d1[1] = u[3]; d1[2] = u[5]; d1[3] = u[7];
+        break;
+    default:
+        UNREACHABLE();
+    }
+}
+
+/**
+ * Project each texel onto the line between its partition's quantised
+ * endpoints d0/d1 to get its ideal weight (0..64). 'parts' is the partition
+ * of each texel, or null if there is only one partition.
+ */
+void Compressor::project_weights(const uint8x4_t *texels, const uint8_t *parts, int num_parts,
+        const int (*d0)[4], const int (*d1)[4], int *ideal) const
+{
+    int diff[4][4];
+    float scale[4];
+    for (int p = 0; p < num_parts; ++p) {
+        int len2 = 0;
+        for (int c = 0; c < 4; ++c) {
+            diff[p][c] = d1[p][c] - d0[p][c];
+            len2 += diff[p][c] * diff[p][c];
+        }
+        scale[p] = len2 ? 64.0f / len2 : 0.0f;
+    }
+
+    for (int i = 0; i < num_texels; ++i) {
+        int p = parts ? parts[i] : 0;
+        int dot = 0;
+        for (int c = 0; c < 4; ++c)
+            dot += (texels[i].v[c] - d0[p][c]) * diff[p][c];
+        ideal[i] = std::max(0, std::min(64, (int)(dot * scale[p] + 0.5f)));
+    }
+}
+
+/**
+ * Choose the quantised weights for the texels' ideal weights. If the grid
+ * is smaller than the block, the grid is fitted to the ideal weights with up
+ * to refine_iterations least-squares steps.
+ */
+void Compressor::fit_weights(const block_config &config, const int *ideal, int refine_iterations, trial &result) const
+{
+    const QuantisationTables::entry *wq = quant.weights[config.high_prec][config.wt_range];
+
+    if (config.identity_infill) {
+        for (int i = 0; i < num_texels; ++i)
+            result.weights_quant[i] = wq[ideal[i]].quant;
+        return;
+    }
+
+    // Fit the weight grid to the ideal weights. Start with each grid point
+    // as the average of the texels it contributes to (weighted by its
+    // contribution), then refine towards the least-squares solution, since
+    // plain averaging flattens gradients towards the edges of the block
+    int num_grid = config.wt_w * config.wt_h;
+    float grid_sum[64] = {}, grid_weight[64] = {}, grid_weight_sq[64] = {};
+    for (int i = 0; i < num_texels; ++i) {
+        const infill_texel &it = config.infill[i];
+        for (int j = 0; j < 4; ++j) {
+            grid_sum[it.idx[j]] += it.w[j] * ideal[i];
+            grid_weight[it.idx[j]] += it.w[j];
+            grid_weight_sq[it.idx[j]] += it.w[j] * it.w[j];
+        }
+    }
+
+    float grid_ideal[64];
+    for (int j = 0; j < num_grid; ++j)
+        grid_ideal[j] = grid_weight[j] ? grid_sum[j] / grid_weight[j] : 0.0f;
+
+    if (num_grid < num_texels) {
+        for (int iter = 0; iter < refine_iterations; ++iter) {
+            float step[64] = {};
+            for (int i = 0; i < num_texels; ++i) {
+                const infill_texel &it = config.infill[i];
+                float residual = ideal[i] - (it.w[0] * grid_ideal[it.idx[0]] + it.w[1] * grid_ideal[it.idx[1]]
+                        + it.w[2] * grid_ideal[it.idx[2]] + it.w[3] * grid_ideal[it.idx[3]]) * (1.0f / 16.0f);
+                for (int j = 0; j < 4; ++j)
+                    step[it.idx[j]] += it.w[j] * residual;
+            }
+            // Move each point by its least-squares step assuming the other
+            // points stay put
+            for (int j = 0; j < num_grid; ++j)
+                if (grid_weight_sq[j])
+                    grid_ideal[j] = std::max(0.0f, std::min(64.0f, grid_ideal[j] + 16.0f * step[j] / grid_weight_sq[j]));
+        }
+    }
+
+    for (int j = 0; j < num_grid; ++j)
+        result.weights_quant[j] = wq[(int)(grid_ideal[j] + 0.5f)].quant;
+}
+
+/**
+ * Compute the error of the trial exactly as the decoder would decode it.
+ * texel_weights receives the (infilled) weight of each texel.
+ */
+void Compressor::measure_error(const block_config &config, const uint8x4_t *texels, const uint8_t *parts,
+        const int (*d0)[4], const int (*d1)[4], trial &result, int *texel_weights) const
+{
+    const uint8_t *wu = quant.weights_unquant[config.high_prec][config.wt_range];
+    int grid[64];
+    for (int j = 0; j < config.wt_w * config.wt_h; ++j)
+        grid[j] = wu[result.weights_quant[j]];
+
+    for (int i = 0; i < num_texels; ++i) {
+        const infill_texel &it = config.infill[i];
+        texel_weights[i] = (grid[it.idx[0]] * it.w[0] + grid[it.idx[1]] * it.w[1]
+                          + grid[it.idx[2]] * it.w[2] + grid[it.idx[3]] * it.w[3] + 8) >> 4;
+    }
+
+    uint8x4_t e0[4], e1[4];
+    for (int p = 0; p < config.num_parts; ++p) {
+        for (int c = 0; c < 4; ++c) {
+            e0[p].v[c] = d0[p][c];
+            e1[p].v[c] = d1[p][c];
+        }
+    }
+    result.error = error_kernel(texels, num_texels, parts, e0, e1, texel_weights);
+}
+
+/**
+ * Quantise each partition's endpoints e0/e1 with the given config, choose
+ * the weights, and compute the error of the result. texel_weights receives
+ * the (infilled) weight of each texel.
+ */
+void Compressor::try_endpoints(const block_config &config, const uint8x4_t *texels, const uint8_t *parts,
+        const int (*e0)[4], const int (*e1)[4], trial &result, int *texel_weights) const
+{
+    int d0[4][4], d1[4][4];
+    int values_per_part = ((config.cem >> 2) + 1) * 2;
+    for (int p = 0; p < config.num_parts; ++p)
+        quantise_endpoints(config, e0[p], e1[p], &result.endpoints_quant[p * values_per_part], d0[p], d1[p]);
+
+    int ideal[144];
+    project_weights(texels, parts, config.num_parts, d0, d1, ideal);
+    fit_weights(config, ideal, 4, result);
+    measure_error(config, texels, parts, d0, d1, result, texel_weights);
+}
+
+/**
+ * Try the config with the endpoints e0/e1 of each partition, and again with
+ * the endpoints refitted to the resulting weights. Updates the best trial if
+ * either has a lower error. Does nothing if a seed already tried the same
+ * config and partitioning.
+ */
+void Compressor::try_config(const block_config &config, const uint8x4_t *texels,
+        const uint8_t *parts, int partition_index, const int (*e0)[4], const int (*e1)[4],
+        search_state &search) const
+{
+    for (int i = 0; i < search.num_seeded; ++i)
+        if (search.seeded_configs[i] == &config && search.seeded_partitions[i] == partition_index)
+            return;
+
+    trial current;
+    current.partition_index = partition_index;
+    int texel_weights[144];
+
+    try_endpoints(config, texels, parts, e0, e1, current, texel_weights);
+    if (search.best.error < 0 || current.error < search.best.error) {
+        search.best = current;
+        search.best_config = &config;
+    }
+
+    // Refit each partition's endpoints to the weights we ended up with
+    if (current.error == 0)
+        return;
+    int r0[4][4], r1[4][4];
+    memcpy(r0, e0, sizeof(int[4]) * config.num_parts);
+    memcpy(r1, e1, sizeof(int[4]) * config.num_parts);
+    bool refitted = false;
+    for (int p = 0; p < config.num_parts; ++p) {
+        uint8x4_t part_texels[144];
+        int part_weights[144];
+        int n = 0;
+        for (int i = 0; i < num_texels; ++i) {
+            if (!parts || parts[i] == p) {
+                part_texels[n] = texels[i];
+                part_weights[n++] = texel_weights[i];
+            }
+        }
+        refitted |= refit_endpoints(part_texels, part_weights, n, r0[p], r1[p]);
+    }
+    if (refitted) {
+        try_endpoints(config, texels, parts, r0, r1, current, texel_weights);
+        if (current.error < search.best.error) {
+            search.best = current;
+            search.best_config = &config;
+        }
+    }
+}
+
+/**
+ * try_config() every config in the list, stopping early if the block is
+ * represented exactly
+ */
+void Compressor::search_configs(const std::vector<block_config> &list, const uint8x4_t *texels,
+        const uint8_t *parts, int partition_index, const int (*e0)[4], const int (*e1)[4],
+        search_state &search) const
+{
+    for (const block_config &config : list) {
+        if (search.best.error == 0)
+            break;
+        try_config(config, texels, parts, partition_index, e0, e1, search);
+    }
+}
+
+/**
+ * Set parts to the partition of each texel in the pattern, and fit
+ * endpoints to each partition's colours
+ */
+void Compressor::fit_pattern(const uint8x4_t *texels, int cls, const PartitionLibrary::pattern &pat,
+        uint8_t *parts, int (*e0)[4], int (*e1)[4]) const
+{
+    for (int i = 0; i < num_texels; ++i)
+        parts[i] = PartitionLibrary::texel_partition(pat, i);
+
+    for (int p = 0; p < pat.num_parts; ++p) {
+        uint8x4_t part_texels[144];
+        int n = 0;
+        for (int i = 0; i < num_texels; ++i)
+            if (parts[i] == p)
+                part_texels[n++] = texels[i];
+        fit_principal_axis(part_texels, n, channel_mask_for_class[cls], e0[p], e1[p]);
+    }
+}
+
+/**
+ * Try the best-ranked partitionings of the block, with endpoints fitted to
+ * each partition's colours
+ */
+void Compressor::try_partitions(const uint8x4_t *texels, int cls, search_state &search) const
+{
+    for (int num_parts = 2; num_parts <= max_parts; ++num_parts) {
+        int ranked[16];
+        int num_ranked = partitions->rank(texels, num_parts, std::min(max_patterns, 16), ranked);
+        for (int r = 0; r < num_ranked; ++r) {
+            const PartitionLibrary::pattern &pat = partitions->patterns(num_parts)[ranked[r]];
+            uint8_t parts[144];
+            int e0[4][4], e1[4][4];
+            fit_pattern(texels, cls, pat, parts, e0, e1);
+            search_configs(configs[num_parts - 1][cls], texels, parts, pat.partition_index, e0, e1, search);
+        }
+    }
+}
+
+bool Compressor::is_constant(const uint8x4_t *texels) const
+{
+    uint32_t first;
+    memcpy(&first, texels[0].v, 4);
+    for (int i = 1; i < num_texels; ++i) {
+        uint32_t v;
+        memcpy(&v, texels[i].v, 4);
+        if (v != first)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Encode a void-extent block of the given colour. If image_w is 0 the block
+ * has no extent, otherwise the extent is the part of the image covered by
+ * the block at (x, y).
+ */
+void Compressor::encode_void_extent(const uint8x4_t &colour, int x, int y, int image_w, int image_h, uint8_t *output) const
+{
+    Block blk;
+    blk.is_void_extent = true;
+    blk.void_extent_d = 0;
+
+    // UNORM16 values that decode back to exactly the 8-bit colour
+    blk.void_extent_colour_r = colour.v[0] * 257;
+    blk.void_extent_colour_g = colour.v[1] * 257;
+    blk.void_extent_colour_b = colour.v[2] * 257;
+    blk.void_extent_colour_a = colour.v[3] * 257;
+
+    blk.void_extent_min_s = blk.void_extent_max_s = 0x1fff;
+    blk.void_extent_min_t = blk.void_extent_max_t = 0x1fff;
+
+    if (image_w > 0 && image_h > 0) {
+        // The extent is in texture coordinates with 13 fractional bits.
+        // Bilinear samples between the centres of the first and last texels
+        // only touch texels inside the block, so round inwards from them
+        int x1 = std::min(x + block_w, image_w) - 1;
+        int y1 = std::min(y + block_h, image_h) - 1;
+        int min_s = ((2 * x + 1) * 8192 + 2 * image_w - 1) / (2 * image_w);
+        int max_s = (2 * x1 + 1) * 8192 / (2 * image_w);
+        int min_t = ((2 * y + 1) * 8192 + 2 * image_h - 1) / (2 * image_h);
+        int max_t = (2 * y1 + 1) * 8192 / (2 * image_h);
+
+        // Blocks too narrow to have an extent at this precision (or a
+        // single texel wide) have to go without
+        if (min_s < max_s && min_t < max_t) {
+            blk.void_extent_min_s = min_s;
+            blk.void_extent_max_s = max_s;
+            blk.void_extent_min_t = min_t;
+            blk.void_extent_max_t = max_t;
+        }
+    }
+
+    OutputBitVector encoded = blk.encode(encoder);
+    memcpy(output, encoded.data, 16);
+}
+
+void Compressor::compress_block(const uint8_t *input, uint8_t *output) const
+{
+    uint8x4_t texels[144];
+    memcpy(texels, input, num_texels * 4);
+
+    if (is_constant(texels)) {
+        encode_void_extent(texels[0], 0, 0, 0, 0, output);
+        return;
+    }
+
+    compress_stats stats;
+    compress_block_search(texels, output, nullptr, 0, stats);
+}
+
+void Compressor::compress_block(const uint8_t *input, uint8_t *output, int x, int y, int image_w, int image_h) const
+{
+    compress_stats stats;
+    compress_block_seeded(input, output, x, y, image_w, image_h, nullptr, 0, stats);
+}
+
+void Compressor::compress_block_seeded(const uint8_t *input, uint8_t *output, int x, int y, int image_w, int image_h,
+        const seed_mode *seeds, int num_seeds, compress_stats &stats) const
+{
+    uint8x4_t texels[144];
+    memcpy(texels, input, num_texels * 4);
+
+    ++stats.blocks;
+    if (is_constant(texels)) {
+        ++stats.void_extent_blocks;
+        encode_void_extent(texels[0], x, y, image_w, image_h, output);
+        return;
+    }
+
+    compress_block_search(texels, output, seeds, num_seeds, stats);
+}
+
+/**
+ * Find the block modes of the already-compressed left and top neighbours of
+ * block bx in a row, where above_blocks is null if the row is the first in
+ * its seed group. Returns the number of distinct modes.
+ */
+int Compressor::neighbour_seeds(const uint8_t *row_blocks, const uint8_t *above_blocks, int bx, seed_mode *seeds) const
+{
+    if (!use_seeds)
+        return 0;
+
+    const uint8_t *neighbours[2] = { bx > 0 ? &row_blocks[(bx - 1) * 16] : nullptr,
+                                     above_blocks ? &above_blocks[bx * 16] : nullptr };
+    int num_seeds = 0;
+    for (const uint8_t *neighbour : neighbours) {
+        if (!neighbour)
+            continue;
+
+        Block blk;
+        blk.is_void_extent = false;
+        InputBitVector in;
+        memcpy(&in.data, neighbour, 16);
+        if (blk.decode_block_mode(in) != decode_error::ok || blk.is_void_extent)
+            continue;
+
+        seed_mode seed;
+        seed.num_parts = in.get_bits(11, 2) + 1;
+        seed.wt_w = blk.wt_w;
+        seed.wt_h = blk.wt_h;
+        seed.high_prec = blk.high_prec;
+        seed.wt_range = blk.wt_range;
+        if (num_seeds == 0 || !(seeds[0] == seed))
+            seeds[num_seeds++] = seed;
+    }
+    return num_seeds;
+}
+
+/**
+ * The config we'd use for the seed's block mode in a block of endpoint
+ * class cls, or null if there isn't one
+ */
+const Compressor::block_config *Compressor::find_seed_config(const seed_mode &seed, int cls) const
+{
+    if (seed.num_parts > max_parts)
+        return nullptr;
+    for (const block_config &config : configs[seed.num_parts - 1][cls])
+        if (config.wt_w == seed.wt_w && config.wt_h == seed.wt_h
+                && config.high_prec == seed.high_prec && config.wt_range == seed.wt_range)
+            return &config;
+    return nullptr;
+}
+
+void Compressor::compress_block_search(const uint8x4_t *texels, uint8_t *output,
+        const seed_mode *seeds, int num_seeds, compress_stats &stats) const
+{
+    if (quality == compress_quality::ultrafast) {
+        compress_block_ultrafast(texels, output);
+        return;
+    }
+
+    int cls = endpoint_class(texels, num_texels);
+
+    int e0[1][4], e1[1][4];
+    fit_principal_axis(texels, num_texels, channel_mask_for_class[cls], e0[0], e1[0]);
+
+    search_state search;
+    search.best.error = -1;
+    search.best_config = nullptr;
+    search.num_seeded = 0;
+
+    // Try the neighbours' block modes first (with the best-ranked pattern,
+    // for partitioned modes), and stop there if one is good enough
+    for (int i = 0; i < num_seeds; ++i) {
+        const block_config *config = find_seed_config(seeds[i], cls);
+        if (!config)
+            continue;
+        if (config->num_parts == 1) {
+            try_config(*config, texels, nullptr, -1, e0, e1, search);
+            search.seeded_partitions[search.num_seeded] = -1;
+        } else {
+            int ranked;
+            if (partitions->rank(texels, config->num_parts, 1, &ranked) == 0)
+                continue;
+            const PartitionLibrary::pattern &pat = partitions->patterns(config->num_parts)[ranked];
+            uint8_t parts[144];
+            int pe0[4][4], pe1[4][4];
+            fit_pattern(texels, cls, pat, parts, pe0, pe1);
+            try_config(*config, texels, parts, pat.partition_index, pe0, pe1, search);
+            search.seeded_partitions[search.num_seeded] = pat.partition_index;
+        }
+        search.seeded_configs[search.num_seeded++] = config;
+    }
+
+    if (search.num_seeded) {
+        ++stats.seeded_blocks;
+        if (search.best.error <= seed_accept_error) {
+            ++stats.seed_accepted;
+            encode(*search.best_config, search.best, output);
+            return;
+        }
+    }
+    const block_config *seeded_best = search.best_config;
+
+    search_configs(configs[0][cls], texels, nullptr, -1, e0, e1, search);
+
+    // Blocks that a single partition already represents to within about one
+    // level per channel aren't worth partitioning
+    if (max_parts > 1 && search.best.error > num_texels * 4)
+        try_partitions(texels, cls, search);
+
+    if (search.num_seeded && search.best_config == seeded_best)
+        ++stats.seed_best;
+
+    ASSERT(search.best_config);
+    encode(*search.best_config, search.best, output);
+}
+
+void Compressor::compress_block_ultrafast(const uint8x4_t *texels, uint8_t *output) const
+{
+    // Bounding box of the colours, and endpoint_class() in the same pass
+    int lo[4] = { 255, 255, 255, 255 }, hi[4] = { 0, 0, 0, 0 }, sum[4] = { 0, 0, 0, 0 };
+    bool grey = true;
+    for (int i = 0; i < num_texels; ++i) {
+        const uint8_t *v = texels[i].v;
+        for (int c = 0; c < 4; ++c) {
+            lo[c] = std::min(lo[c], (int)v[c]);
+            hi[c] = std::max(hi[c], (int)v[c]);
+            sum[c] += v[c];
+        }
+        grey &= (v[0] == v[1] && v[0] == v[2]);
+    }
+    int cls = (grey ? 0 : 2) + (lo[3] == 0xff ? 0 : 1);
+    int channel_mask = channel_mask_for_class[cls];
+
+    // Use the diagonal of the box that runs the same way as the channel
+    // with the largest range, so anti-correlated channels are handled
+    int major = 0;
+    for (int c = 1; c < 4; ++c)
+        if ((channel_mask & (1 << c)) && hi[c] - lo[c] > hi[major] - lo[major])
+            major = c;
+
+    int mean[4], cov[4] = { 0, 0, 0, 0 };
+    for (int c = 0; c < 4; ++c)
+        mean[c] = sum[c] / num_texels;
+    for (int i = 0; i < num_texels; ++i) {
+        int d = texels[i].v[major] - mean[major];
+        for (int c = 0; c < 4; ++c)
+            cov[c] += d * (texels[i].v[c] - mean[c]);
+    }
+
+    int e0[4], e1[4];
+    for (int c = 0; c < 4; ++c) {
+        if (!(channel_mask & (1 << c))) {
+            e0[c] = e1[c] = 255;
+        } else if (cov[c] < 0) {
+            e0[c] = hi[c];
+            e1[c] = lo[c];
+        } else {
+            e0[c] = lo[c];
+            e1[c] = hi[c];
+        }
+    }
+
+    // Every block of this class uses the best-ranked block mode
+    const block_config &config = configs[0][cls][0];
+    trial t;
+    t.partition_index = -1;
+    int d0[1][4], d1[1][4];
+    quantise_endpoints(config, e0, e1, t.endpoints_quant, d0[0], d1[0]);
+    int ideal[144];
+    project_weights(texels, nullptr, 1, d0, d1, ideal);
+    fit_weights(config, ideal, 0, t);
+    encode(config, t, output);
+}
+
+void Compressor::encode(const block_config &config, const trial &t, uint8_t *output) const
+{
+    Block blk = config.block;
+    if (config.num_parts > 1)
+        blk.partition_index = t.partition_index;
+    memcpy(blk.colour_endpoints_quant, t.endpoints_quant, blk.num_cem_values);
+    memcpy(blk.weights_quant, t.weights_quant, blk.num_weights);
+
+    OutputBitVector encoded = blk.encode(encoder);
+    memcpy(output, encoded.data, 16);
+}
+
+void Compressor::compress_rows(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch,
+        int block_y_begin, int block_y_end, uint8_t *blocks, compress_stats *stats) const
+{
+    ASSERT(block_y_begin % seed_group_rows == 0);
+
+    int blocks_x = (image_w + block_w - 1) / block_w;
+
+    uint8_t texels[12*12*4];
+    compress_stats row_stats;
+
+    for (int by = block_y_begin; by < block_y_end; ++by) {
+        uint8_t *row_blocks = &blocks[(size_t)by * blocks_x * 16];
+        const uint8_t *above_blocks = (by % seed_group_rows) ? row_blocks - blocks_x * 16 : nullptr;
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            seed_mode seeds[2];
+            int num_seeds = neighbour_seeds(row_blocks, above_blocks, bx, seeds);
+            gather_block(rgba, image_w, image_h, row_pitch, bx, by, texels);
+            compress_block_seeded(texels, &row_blocks[bx * 16], bx * block_w, by * block_h, image_w, image_h,
+                    seeds, num_seeds, row_stats);
+        }
+    }
+
+    if (stats)
+        *stats += row_stats;
+}
+
+void Compressor::gather_block(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, int bx, int by,
+        uint8_t *texels) const
+{
+    for (int y = 0; y < block_h; ++y) {
+        const uint8_t *row = rgba + (size_t)std::min(by * block_h + y, image_h - 1) * row_pitch;
+        int x0 = bx * block_w;
+        if (x0 + block_w <= image_w) {
+            memcpy(&texels[y * block_w * 4], &row[x0 * 4], block_w * 4);
+        } else {
+            for (int x = 0; x < block_w; ++x)
+                memcpy(&texels[(y * block_w + x) * 4], &row[std::min(x0 + x, image_w - 1) * 4], 4);
+        }
+    }
+}
+
+void Compressor::compress_image(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, uint8_t *blocks,
+        int num_threads, compress_stats *stats) const
+{
+    int blocks_y = (image_h + block_h - 1) / block_h;
+
+    // Every seed group is compressed independently, so the output is the
+    // same however the rows are split between threads
+    std::mutex stats_mutex;
+    parallel_for_chunks(blocks_y, rows_per_chunk(image_w), num_threads,
+            [&](int begin, int end) {
+                compress_stats chunk_stats;
+                compress_rows(rgba, image_w, image_h, row_pitch, begin, end, blocks, &chunk_stats);
+                if (stats) {
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    *stats += chunk_stats;
+                }
+            });
+}
+
+void Compressor::hash_blocks(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch, uint64_t *hashes,
+        int num_threads) const
+{
+    int blocks_x = (image_w + block_w - 1) / block_w;
+    int blocks_y = (image_h + block_h - 1) / block_h;
+
+    // Hashing is much cheaper than compressing, so use the biggest chunks
+    int chunk_rows = std::max(1, 4096 / blocks_x);
+    parallel_for_chunks(blocks_y, chunk_rows, num_threads,
+            [&](int begin, int end) {
+                uint8_t texels[12*12*4];
+                for (int by = begin; by < end; ++by) {
+                    for (int bx = 0; bx < blocks_x; ++bx) {
+                        gather_block(rgba, image_w, image_h, row_pitch, bx, by, texels);
+                        hashes[(size_t)by * blocks_x + bx] = hash_bytes(texels, num_texels * 4);
+                    }
+                }
+            });
+}
+
+int Compressor::compress_changed_blocks(const uint8_t *rgba, int image_w, int image_h, size_t row_pitch,
+        const uint64_t *old_hashes, const uint64_t *new_hashes, uint8_t *blocks, int num_threads) const
+{
+    int blocks_x = (image_w + block_w - 1) / block_w;
+    int blocks_y = (image_h + block_h - 1) / block_h;
+
+    std::atomic<int> num_changed(0);
+    parallel_for_chunks(blocks_y, rows_per_chunk(image_w), num_threads,
+            [&](int begin, int end) {
+                uint8_t texels[12*12*4];
+                compress_stats unused_stats;
+                int n = 0;
+
+                // The old blocks of the current and previous rows, to tell
+                // whether a block's seeds have changed
+                std::vector<uint8_t> old_rows[2];
+                old_rows[0].resize(blocks_x * 16);
+                old_rows[1].resize(blocks_x * 16);
+
+                for (int by = begin; by < end; ++by) {
+                    uint8_t *row_blocks = &blocks[(size_t)by * blocks_x * 16];
+                    const uint8_t *above_blocks = (by % seed_group_rows) ? row_blocks - blocks_x * 16 : nullptr;
+                    std::vector<uint8_t> &old_row = old_rows[by & 1];
+                    const uint8_t *old_above = above_blocks ? old_rows[(by + 1) & 1].data() : nullptr;
+                    memcpy(old_row.data(), row_blocks, blocks_x * 16);
+
+                    for (int bx = 0; bx < blocks_x; ++bx) {
+                        seed_mode seeds[2], old_seeds[2];
+                        int num_seeds = neighbour_seeds(row_blocks, above_blocks, bx, seeds);
+                        int num_old_seeds = neighbour_seeds(old_row.data(), old_above, bx, old_seeds);
+
+                        size_t i = (size_t)by * blocks_x + bx;
+                        if (old_hashes[i] == new_hashes[i] && num_seeds == num_old_seeds
+                                && std::equal(seeds, seeds + num_seeds, old_seeds))
+                            continue;
+
+                        gather_block(rgba, image_w, image_h, row_pitch, bx, by, texels);
+                        compress_block_seeded(texels, &row_blocks[bx * 16], bx * block_w, by * block_h, image_w, image_h,
+                                seeds, num_seeds, unused_stats);
+                        ++n;
+                    }
+                }
+                num_changed += n;
+            });
+    return num_changed;
+}
+
+int Compressor::rows_per_chunk(int image_w) const
+{
+    int blocks_per_chunk = 0;
+    switch (quality) {
+    case compress_quality::ultrafast: blocks_per_chunk = 4096; break;
+    case compress_quality::fast: blocks_per_chunk = 1024; break;
+    case compress_quality::medium: blocks_per_chunk = 256; break;
+    case compress_quality::thorough: blocks_per_chunk = 64; break;
+    }
+    int blocks_x = (image_w + block_w - 1) / block_w;
+    int rows = std::max(1, blocks_per_chunk / blocks_x);
+    return (rows + seed_group_rows - 1) / seed_group_rows * seed_group_rows;
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_COMPRESS
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_CONFIGS
+#define INCLUDED_OASTC_CONFIGS
+
+#include <vector>
+
+#include "oastc.h"
+
+namespace oastc
+{
+
+/**
+ * Call fn(wt_w, wt_h, wt_d) for every weight grid size that a block mode
+ * can represent with the given dual_plane and high_prec, in the order of the
+ * block mode layouts. This doesn't check the grid against any block size.
+ *
+ * A few 3D grids (like 6x2x2) fit two layouts, and are produced once for
+ * each.
+ */
+template<typename F>
+static void for_each_block_mode_grid(bool is_3d, int dual_plane, int high_prec, F fn)
+{
+    if (!is_3d) {
+        fn(6, 10, 1);
+        fn(10, 6, 1);
+
+        for (int b = 0; b < 4; ++b) {
+            for (int a = 0; a < 4; ++a) {
+                fn(b+4, a+2, 1);
+                fn(b+8, a+2, 1);
+                fn(a+2, b+8, 1);
+                if (b < 2) {
+                    fn(a+2, b+6, 1);
+                    fn(b+2, a+2, 1);
+                }
+                if (b == 0) {
+                    fn(12, a+2, 1);
+                    fn(a+2, 12, 1);
+                }
+                if (dual_plane == 0 && high_prec == 0) {
+                    fn(a+6, b+6, 1);
+                }
+            }
+        }
+    } else {
+        fn(6, 2, 2);
+        fn(2, 6, 2);
+        fn(2, 2, 6);
+
+        if (dual_plane == 0 && high_prec == 0) {
+            for (int b = 0; b < 4; ++b) {
+                for (int a = 0; a < 4; ++a) {
+                    fn(6, b+2, a+2);
+                    fn(a+2, 6, b+2);
+                    fn(a+2, b+2, 6);
+                }
+            }
+        }
+
+        for (int c = 0; c < 4; ++c) {
+            for (int b = 0; b < 4; ++b) {
+                for (int a = 0; a < 4; ++a) {
+                    fn(a+2, b+2, c+2);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * A legal combination of block mode, partition count and colour endpoint
+ * mode class, with the bit budget that results from it. Every partition
+ * uses the same CEM, which can be any of the four in cem_class.
+ */
+struct encoding_config
+{
+    uint8_t wt_w, wt_h, wt_d;
+    uint8_t dual_plane, high_prec, wt_range;
+    uint8_t num_parts;
+    uint8_t cem_class; // CEM >> 2
+    uint8_t ce_range; // index into cem_ranges
+
+    uint8_t num_weights;
+    uint8_t num_cem_values;
+    uint8_t weight_bits;
+    uint8_t colour_endpoint_bits;
+    uint8_t remaining_bits;
+
+    /**
+     * Set up everything in blk apart from the weights, the colour endpoint
+     * values, the partition index and the colour component selector, for an
+     * LDR or HDR endpoint mode 'cem' in this config's class
+     */
+    void setup_block(Block &blk, int cem) const;
+};
+
+void encoding_config::setup_block(Block &blk, int cem) const
+{
+    ASSERT((cem >> 2) == cem_class);
+
+    blk.is_error = false;
+    blk.bogus_colour_endpoints = false;
+    blk.bogus_weights = false;
+    blk.is_void_extent = false;
+
+    blk.dual_plane = dual_plane;
+    blk.colour_component_selector = 0;
+    blk.high_prec = high_prec;
+    blk.wt_range = wt_range;
+    blk.wt_w = wt_w;
+    blk.wt_h = wt_h;
+    blk.wt_d = wt_d;
+    blk.calculate_from_weights();
+
+    blk.num_parts = num_parts;
+    blk.partition_index = (num_parts > 1) ? 0 : -1;
+    blk.is_multi_cem = false;
+    blk.cem_base_class = cem_class;
+    for (int p = 0; p < 4; ++p)
+        blk.cems[p] = (p < num_parts) ? cem : -1;
+    blk.num_cem_values = num_cem_values;
+    blk.calculate_remaining_bits();
+    decode_error err = blk.calculate_colour_endpoints_size();
+    ASSERT(err == decode_error::ok);
+    (void)err;
+
+    memset(blk.colour_endpoints_quant, 0, sizeof(blk.colour_endpoints_quant));
+    memset(blk.weights_quant, 0, sizeof(blk.weights_quant));
+}
+
+/**
+ * Every legal encoding_config for one block size. The illegal ones (weight
+ * grids larger than the block, more than 64 weights, weights that don't fit
+ * in 24..96 bits, more than 18 colour endpoint values, too few bits left for
+ * the endpoints, or dual planes with 4 partitions) are already removed, so
+ * an encoder can search this list without checking anything per block.
+ *
+ * The list is ordered by dual_plane, high_prec, wt_range, weight grid (in
+ * for_each_block_mode_grid() order), num_parts and cem_class.
+ */
+class ConfigTable
+{
+public:
+    ConfigTable(int block_w, int block_h, int block_d);
+
+    const std::vector<encoding_config> &configs() const { return all; }
+
+    int block_w, block_h, block_d;
+
+private:
+    std::vector<encoding_config> all;
+};
+
+ConfigTable::ConfigTable(int block_w, int block_h, int block_d)
+  : block_w(block_w), block_h(block_h), block_d(block_d)
+{
+    Block blk;
+    for (int dual_plane = 0; dual_plane <= 1; ++dual_plane) {
+        for (int high_prec = 0; high_prec <= 1; ++high_prec) {
+            for (int wt_range = 2; wt_range < 8; ++wt_range) {
+                std::vector<bool> seen(7 * 13 * 13);
+                for_each_block_mode_grid(block_d > 1, dual_plane, high_prec, [&](int wt_w, int wt_h, int wt_d) {
+                    if (wt_w > block_w || wt_h > block_h || wt_d > block_d)
+                        return;
+                    int grid_id = (wt_d * 13 + wt_h) * 13 + wt_w;
+                    if (seen[grid_id])
+                        return;
+                    seen[grid_id] = true;
+                    if (wt_w * wt_h * wt_d * (dual_plane ? 2 : 1) > 64)
+                        return;
+
+                    blk.dual_plane = dual_plane;
+                    blk.high_prec = high_prec;
+                    blk.wt_range = wt_range;
+                    blk.wt_w = wt_w;
+                    blk.wt_h = wt_h;
+                    blk.wt_d = wt_d;
+                    blk.calculate_from_weights();
+                    if (blk.weight_bits < 24 || blk.weight_bits > 96)
+                        return;
+
+                    for (int num_parts = 1; num_parts <= 4; ++num_parts) {
+                        if (dual_plane && num_parts == 4)
+                            continue;
+                        for (int cem_class = 0; cem_class < 4; ++cem_class) {
+                            blk.num_parts = num_parts;
+                            blk.is_multi_cem = false;
+                            blk.num_cem_values = (cem_class + 1) * 2 * num_parts;
+                            if (blk.num_cem_values > 18)
+                                continue;
+                            blk.calculate_remaining_bits();
+                            if (blk.calculate_colour_endpoints_size() != decode_error::ok)
+                                continue;
+
+                            encoding_config config;
+                            config.wt_w = wt_w;
+                            config.wt_h = wt_h;
+                            config.wt_d = wt_d;
+                            config.dual_plane = dual_plane;
+                            config.high_prec = high_prec;
+                            config.wt_range = wt_range;
+                            config.num_parts = num_parts;
+                            config.cem_class = cem_class;
+                            for (config.ce_range = 0; cem_ranges[config.ce_range].max != blk.ce_max; ++config.ce_range)
+                                ;
+                            config.num_weights = blk.num_weights;
+                            config.num_cem_values = blk.num_cem_values;
+                            config.weight_bits = blk.weight_bits;
+                            config.colour_endpoint_bits = blk.colour_endpoint_bits;
+                            config.remaining_bits = blk.remaining_bits;
+                            all.push_back(config);
+                        }
+                    }
+                });
+            }
+        }
+    }
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_CONFIGS
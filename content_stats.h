@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_CONTENT_STATS
+#define INCLUDED_OASTC_CONTENT_STATS
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "oastc.h"
+
+#include "image_io.h"
+
+// Histograms of which ASTC features an image's blocks use (for oastc_dec
+// --stats), to show which decoder paths real content depends on
+
+struct content_stats
+{
+    uint64_t blocks = 0;
+    uint64_t errors[oastc::num_decode_errors] = {};
+    uint64_t void_extent_ldr = 0;
+    uint64_t void_extent_hdr = 0;
+    uint64_t dual_plane = 0;
+    uint64_t duplicate_blocks = 0; // blocks identical to an earlier block in the image
+
+    std::map<int, uint64_t> partitions;
+    std::map<std::string, uint64_t> cems; // e.g. "8" or "8,12" for a 2-partition block
+    std::map<std::string, uint64_t> weight_grids; // e.g. "4x4" or "3x3x3"
+    std::map<int, uint64_t> weight_levels; // number of quantisation levels
+    std::map<int, uint64_t> endpoint_levels;
+};
+
+/**
+ * Collect the stats for every block in img. This only decodes the parts of
+ * each block needed to validate it and find its modes and ranges, not the
+ * endpoints or weights.
+ */
+static inline void gather_content_stats(const oastc::Decoder &dec, const astc_image &img, content_stats &stats)
+{
+    size_t num_blocks = img.blocks.size() / 16;
+    stats.blocks += num_blocks;
+
+    oastc::Block blk;
+    for (size_t i = 0; i < num_blocks; ++i) {
+        oastc::InputBitVector in;
+        memcpy(&in.data, &img.blocks[i * 16], 16);
+
+        oastc::decode_error err = blk.decode_header(dec, in, dec.profile);
+        stats.errors[(int)err]++;
+        if (err != oastc::decode_error::ok)
+            continue;
+
+        if (blk.is_void_extent) {
+            if (blk.void_extent_d)
+                stats.void_extent_hdr++;
+            else
+                stats.void_extent_ldr++;
+            continue;
+        }
+
+        stats.partitions[blk.num_parts]++;
+        if (blk.dual_plane)
+            stats.dual_plane++;
+
+        std::string cems;
+        for (int p = 0; p < blk.num_parts; ++p) {
+            if (p)
+                cems += ",";
+            cems += std::to_string(blk.cems[p]);
+        }
+        stats.cems[cems]++;
+
+        std::string grid = std::to_string(blk.wt_w) + "x" + std::to_string(blk.wt_h);
+        if (img.block_d > 1)
+            grid += "x" + std::to_string(blk.wt_d);
+        stats.weight_grids[grid]++;
+
+        stats.weight_levels[blk.wt_max + 1]++;
+        stats.endpoint_levels[blk.ce_max + 1]++;
+    }
+
+    // Sort a copy of the blocks, so identical ones are adjacent
+    std::vector<std::pair<uint64_t, uint64_t>> sorted(num_blocks);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        memcpy(&sorted[i].first, &img.blocks[i * 16], 8);
+        memcpy(&sorted[i].second, &img.blocks[i * 16 + 8], 8);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 1; i < num_blocks; ++i)
+        if (sorted[i] == sorted[i - 1])
+            stats.duplicate_blocks++;
+}
+
+static inline void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static inline std::string histogram_key(int k) { return std::to_string(k); }
+static inline std::string histogram_key(const std::string &k) { return k; }
+
+template<typename K>
+static void write_json_histogram(FILE *f, const char *name, const std::map<K, uint64_t> &hist)
+{
+    fprintf(f, "      \"%s\": {", name);
+    bool first = true;
+    for (auto &kv : hist) {
+        fprintf(f, first ? " " : ", ");
+        write_json_string(f, histogram_key(kv.first).c_str());
+        fprintf(f, ": %llu", (unsigned long long)kv.second);
+        first = false;
+    }
+    fprintf(f, first ? "}" : " }");
+}
+
+/**
+ * Write one file's stats as a JSON object, as an element of the "files"
+ * array written by oastc_dec --stats
+ */
+static inline void write_content_stats_json(FILE *f, const char *filename, const astc_image &img, const content_stats &stats)
+{
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"file\": ");
+    write_json_string(f, filename);
+    fprintf(f, ",\n");
+    if (img.block_d > 1)
+        fprintf(f, "      \"footprint\": \"%dx%dx%d\",\n", img.block_w, img.block_h, img.block_d);
+    else
+        fprintf(f, "      \"footprint\": \"%dx%d\",\n", img.block_w, img.block_h);
+    fprintf(f, "      \"image_size\": [%d, %d, %d],\n", img.image_w, img.image_h, img.image_d);
+    fprintf(f, "      \"blocks\": %llu,\n", (unsigned long long)stats.blocks);
+
+    fprintf(f, "      \"errors\": {");
+    bool first = true;
+    for (int i = 1; i < oastc::num_decode_errors; ++i) {
+        if (stats.errors[i]) {
+            fprintf(f, "%s\"%s\": %llu", first ? " " : ", ", oastc::decode_error_name((oastc::decode_error)i),
+                    (unsigned long long)stats.errors[i]);
+            first = false;
+        }
+    }
+    fprintf(f, first ? "},\n" : " },\n");
+
+    fprintf(f, "      \"void_extent\": { \"ldr\": %llu, \"hdr\": %llu },\n",
+            (unsigned long long)stats.void_extent_ldr, (unsigned long long)stats.void_extent_hdr);
+    fprintf(f, "      \"dual_plane\": %llu,\n", (unsigned long long)stats.dual_plane);
+    fprintf(f, "      \"duplicate_blocks\": %llu,\n", (unsigned long long)stats.duplicate_blocks);
+    write_json_histogram(f, "partitions", stats.partitions);
+    fprintf(f, ",\n");
+    write_json_histogram(f, "cems", stats.cems);
+    fprintf(f, ",\n");
+    write_json_histogram(f, "weight_grids", stats.weight_grids);
+    fprintf(f, ",\n");
+    write_json_histogram(f, "weight_levels", stats.weight_levels);
+    fprintf(f, ",\n");
+    write_json_histogram(f, "endpoint_levels", stats.endpoint_levels);
+    fprintf(f, "\n    }");
+}
+
+#endif // INCLUDED_OASTC_CONTENT_STATS
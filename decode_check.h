@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_DECODE_CHECK
+#define INCLUDED_OASTC_DECODE_CHECK
+
+#include "oastc.h"
+
+namespace oastc
+{
+
+// Differential testing of the decoder's public entry points against the
+// reference decode path.
+//
+// The reference is Block::decode() followed by Block::write_decoded() (or
+// write_decoded_unorm8()), using a Decoder with no precomputed tables, so
+// every texel's partition comes from select_partition(). Faster paths
+// (precomputed tables, SIMD, specialisations for common block modes) belong
+// behind Decoder::decode() and decode_unorm8() and must leave that scalar
+// path intact, so DecodeChecker can show they give bit-identical results,
+// including the error code and error colour for invalid blocks.
+
+struct decode_mismatch
+{
+    const char *path; // the entry point that disagreed with the reference
+    decode_error reference_err;
+    decode_error err;
+    int texel; // -1 if only the error codes differ
+    int channel;
+    uint16_t reference_value; // fp16 bits, or unorm8
+    uint16_t value;
+};
+
+class DecodeChecker
+{
+public:
+    DecodeChecker(int block_w, int block_h, int block_d, decode_profile profile);
+
+    /**
+     * Decode the 16-byte block with the reference path and with every
+     * optimised path. Returns false, and describes the first difference in
+     * 'mismatch', if any path disagrees with the reference.
+     */
+    bool check(const uint8_t *block, decode_mismatch &mismatch) const;
+
+    /**
+     * Print the block's bits and fields as decoded by the reference path
+     * (in the VERBOSE_DECODE format) and the mismatching output
+     */
+    void print_mismatch(const uint8_t *block, const decode_mismatch &mismatch) const;
+
+    /**
+     * Check that the reference path's unorm8 output agrees with its fp16
+     * output for one block: equal after converting fp16 to unorm8, or in
+     * the sRGB profile, fp16 colour equal to srgb_to_linear_fp16 of the
+     * unorm8 value and fp16 alpha equal to the unorm8 alpha / 255. check()
+     * does this for every block.
+     */
+    bool check_unorm8_matches_fp16(decode_error err, const fp16 *ref_fp16, const uint8_t *ref_unorm8,
+            decode_mismatch &mismatch) const;
+
+    const Decoder &reference_decoder() const { return reference; }
+
+private:
+    bool compare(const char *path, decode_error ref_err, decode_error err,
+            const uint16_t *ref, const uint16_t *out, decode_mismatch &mismatch) const;
+    decode_error decode_reference(const uint8_t *block, fp16 *output) const;
+    decode_error decode_reference_unorm8(const uint8_t *block, uint8_t *output) const;
+
+    Decoder reference;
+    Decoder optimised;
+    int num_texels;
+};
+
+DecodeChecker::DecodeChecker(int block_w, int block_h, int block_d, decode_profile profile)
+    : reference(block_w, block_h, block_d, profile), optimised(block_w, block_h, block_d, profile),
+      num_texels(block_w * block_h * block_d)
+{
+    optimised.build_partition_table();
+}
+
+decode_error DecodeChecker::decode_reference(const uint8_t *block, fp16 *output) const
+{
+    Block blk;
+    InputBitVector in;
+    memcpy(&in.data, block, 16);
+    decode_error err = blk.decode(reference, in);
+    if (err == decode_error::ok) {
+        blk.write_decoded(reference, reference.profile, output);
+    } else {
+        for (int i = 0; i < num_texels; ++i) {
+            output[i*4] = output[i*4+2] = output[i*4+3] = fp16::one();
+            output[i*4+1] = fp16::zero();
+        }
+    }
+    return err;
+}
+
+decode_error DecodeChecker::decode_reference_unorm8(const uint8_t *block, uint8_t *output) const
+{
+    Block blk;
+    InputBitVector in;
+    memcpy(&in.data, block, 16);
+    decode_error err = blk.decode(reference, in);
+    if (err == decode_error::ok) {
+        blk.write_decoded_unorm8(reference, reference.profile, output);
+    } else {
+        for (int i = 0; i < num_texels; ++i) {
+            output[i*4] = output[i*4+2] = output[i*4+3] = 0xff;
+            output[i*4+1] = 0x00;
+        }
+    }
+    return err;
+}
+
+bool DecodeChecker::compare(const char *path, decode_error ref_err, decode_error err,
+        const uint16_t *ref, const uint16_t *out, decode_mismatch &mismatch) const
+{
+    mismatch.path = path;
+    mismatch.reference_err = ref_err;
+    mismatch.err = err;
+    mismatch.texel = -1;
+    if (err != ref_err)
+        return false;
+    for (int i = 0; i < num_texels * 4; ++i) {
+        if (ref[i] != out[i]) {
+            mismatch.texel = i / 4;
+            mismatch.channel = i % 4;
+            mismatch.reference_value = ref[i];
+            mismatch.value = out[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DecodeChecker::check(const uint8_t *block, decode_mismatch &mismatch) const
+{
+    fp16 ref_fp16[216*4], out_fp16[216*4];
+    uint8_t ref_unorm8[216*4], out_unorm8[216*4];
+
+    decode_error ref_err = decode_reference(block, ref_fp16);
+    decode_error ref_err_unorm8 = decode_reference_unorm8(block, ref_unorm8);
+    ASSERT(ref_err == ref_err_unorm8);
+
+    uint16_t ref[216*4], out[216*4];
+
+    decode_error err = optimised.decode(block, out_fp16);
+    for (int i = 0; i < num_texels * 4; ++i) {
+        ref[i] = ref_fp16[i].u;
+        out[i] = out_fp16[i].u;
+    }
+    if (!compare("Decoder::decode", ref_err, err, ref, out, mismatch))
+        return false;
+
+    err = optimised.decode_unorm8(block, out_unorm8);
+    for (int i = 0; i < num_texels * 4; ++i) {
+        ref[i] = ref_unorm8[i];
+        out[i] = out_unorm8[i];
+    }
+    if (!compare("Decoder::decode_unorm8", ref_err, err, ref, out, mismatch))
+        return false;
+
+    return check_unorm8_matches_fp16(ref_err, ref_fp16, ref_unorm8, mismatch);
+}
+
+bool DecodeChecker::check_unorm8_matches_fp16(decode_error err, const fp16 *ref_fp16, const uint8_t *ref_unorm8,
+        decode_mismatch &mismatch) const
+{
+    // write_decoded_unorm8() skips the fp16 intermediate, but must round
+    // the same way. In sRGB, the unorm8 colour is the sRGB-encoded value
+    // that write_decoded() looks up, and alpha is linear in both
+    uint16_t ref[216*4], out[216*4];
+    for (int i = 0; i < num_texels * 4; ++i) {
+        fp16 f = ref_fp16[i];
+        if (reference.profile == decode_profile::ldr_srgb) {
+            // Not just equal after rounding to unorm8: 0xff80/65536 would
+            // round to 255 but isn't 1.0
+            uint16_t a = ref_unorm8[i] * 257;
+            ref[i] = f.u;
+            out[i] = i % 4 != 3 ? srgb_to_linear_fp16[ref_unorm8[i]]
+                   : a == 65535 ? fp16::one().u : fp16::from_uint16_div_64k(a).u;
+        } else {
+            ref[i] = reference.profile == decode_profile::hdr ? f.to_unorm8_saturate() : f.to_unorm8();
+            out[i] = ref_unorm8[i];
+        }
+    }
+    return compare("Block::write_decoded_unorm8 (vs fp16 to unorm8)", err, err, ref, out, mismatch);
+}
+
+void DecodeChecker::print_mismatch(const uint8_t *block, const decode_mismatch &mismatch) const
+{
+    printf("Mismatch in %s for %dx%dx%d block:", mismatch.path,
+            reference.block_w, reference.block_h, reference.block_d);
+    for (int i = 0; i < 16; ++i)
+        printf(" %02x", block[i]);
+    printf("\n");
+
+    if (mismatch.err != mismatch.reference_err) {
+        printf("  error: reference %s, got %s\n",
+                decode_error_name(mismatch.reference_err), decode_error_name(mismatch.err));
+    } else {
+        int x = mismatch.texel % reference.block_w;
+        int y = (mismatch.texel / reference.block_w) % reference.block_h;
+        int z = mismatch.texel / (reference.block_w * reference.block_h);
+        printf("  texel (%d,%d,%d) channel %d: reference 0x%04x, got 0x%04x\n",
+                x, y, z, mismatch.channel, mismatch.reference_value, mismatch.value);
+    }
+
+    printf("\nReference decode:\n");
+    bool verbose = VERBOSE_DECODE;
+    VERBOSE_DECODE = true;
+    Block blk;
+    InputBitVector in;
+    memcpy(&in.data, block, 16);
+    decode_error err = blk.decode(reference, in);
+    VERBOSE_DECODE = verbose;
+    if (err == decode_error::ok && !blk.is_void_extent)
+        blk.print();
+    printf("\n");
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_DECODE_CHECK
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_DECODE_IMAGE
+#define INCLUDED_OASTC_DECODE_IMAGE
+
+#include <atomic>
+#include <thread>
+
+#include "oastc.h"
+
+#include "image_io.h"
+#include "trace.h"
+
+// Decoding of whole .astc images, shared by oastc_dec and oastc_bench so the
+// benchmarks measure the same code
+
+static inline oastc::decode_error decode_block(const oastc::Decoder &dec, const uint8_t *block, uint8_t *out)
+{
+    return dec.decode_unorm8(block, out);
+}
+
+static inline oastc::decode_error decode_block(const oastc::Decoder &dec, const uint8_t *block, uint16_t *out)
+{
+    oastc::fp16 texels[216*4];
+    oastc::decode_error err = dec.decode(block, texels);
+    memcpy(out, texels, dec.block_w * dec.block_h * dec.block_d * 4 * sizeof(uint16_t));
+    return err;
+}
+
+/**
+ * Decode the blocks with the given z and y in [y_begin, y_end) into the
+ * RGBA output image, with channels of type T (uint8_t for RGBA8, or uint16_t
+ * for fp16 bit patterns). Every call writes a disjoint set of output texels,
+ * so different rows/slabs can be decoded concurrently.
+ */
+template<typename T>
+static void decode_blocks(const oastc::Decoder &dec, const astc_image &img,
+        int z, int y_begin, int y_end, T *image_out)
+{
+    int block_w = img.block_w;
+    int block_h = img.block_h;
+    int block_d = img.block_d;
+    int image_w = img.image_w;
+    int image_h = img.image_h;
+    int image_d = img.image_d;
+
+    std::vector<T> block_out(block_w * block_h * block_d * 4);
+
+    for (int y = y_begin; y < y_end; ++y) {
+        for (int x = 0; x < img.blocks_x; ++x) {
+            const uint8_t *block = &img.blocks[((size_t)(z * img.blocks_y + y) * img.blocks_x + x) * 16];
+
+            oastc::decode_error err = decode_block(dec, block, block_out.data());
+            if (err != oastc::decode_error::ok)
+                printf("Decode error %d\n", (int)err);
+
+            for (int bz = 0; bz < std::min(block_d, image_d - z*block_d); ++bz) {
+                for (int by = 0; by < std::min(block_h, image_h - y*block_h); ++by) {
+                    size_t image_idx = x*block_w + (size_t)(y*block_h+by) * image_w + (size_t)(z*block_d+bz) * image_w * image_h;
+                    int block_idx = by * block_w + bz * block_w * block_h;
+                    memcpy(&image_out[image_idx*4], &block_out[block_idx*4], std::min(block_w, image_w - x*block_w)*4*sizeof(T));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Decode the whole image using num_threads threads. 3D images are split
+ * into z-slabs of blocks (each one block deep); 2D images only have a
+ * single slab so they are split into rows of blocks instead.
+ */
+template<typename T>
+static void decode_image(const oastc::Decoder &dec, const astc_image &img,
+        int num_threads, std::vector<T> &image_out)
+{
+    bool by_slab = img.blocks_z > 1;
+    int num_items = by_slab ? img.blocks_z : img.blocks_y;
+
+    std::atomic<int> next_item(0);
+
+    auto worker = [&]() {
+        int item;
+        while ((item = next_item++) < num_items) {
+            oastc::TraceSpan span(by_slab ? "decode_slab" : "decode_row", item);
+            if (by_slab)
+                decode_blocks(dec, img, item, 0, img.blocks_y, image_out.data());
+            else
+                decode_blocks(dec, img, 0, item, item + 1, image_out.data());
+        }
+    };
+
+    num_threads = std::max(1, std::min(num_threads, num_items));
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+
+#endif // INCLUDED_OASTC_DECODE_IMAGE
@@ -64,6 +64,13 @@ struct fp16
         return { 0, 0, 0 };
     }
 
+    static fp16 from_bits(uint16_t u)
+    {
+        fp16 r;
+        r.u = u;
+        return r;
+    }
+
     /**
      * Convert 0.0 to 0x00, 1.0 to 0xff.
      * Values outside the range [0.0, 1.0] will give undefined results.
@@ -86,6 +93,19 @@ struct fp16
         return v;
     }
 
+    /**
+     * Like to_unorm8(), but clamps values outside [0.0, 1.0] (including
+     * infinities and NaNs, which are clamped to 1.0).
+     */
+    uint8_t to_unorm8_saturate()
+    {
+        if (s)
+            return 0;
+        if (u >= one().u)
+            return 0xff;
+        return to_unorm8();
+    }
+
     /**
      * Takes a uint16_t, divides by 65536, converts the infinite-precision
      * result to fp16 with round-to-zero.
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// libFuzzer entry point for differential testing of the decoder (see
+// decode_check.h). Build with clang and cmake -DOASTC_FUZZ=ON, then run
+// e.g. ./oastc_fuzz_decode -max_len=18 corpus_dir
+//
+// Each input is one byte choosing the block size, one choosing the profile,
+// then the 16-byte block. Any difference from the reference decoder (or any
+// crash or sanitizer error in either) aborts with a dump of the block.
+
+#include <memory>
+
+#include "oastc.h"
+
+#include "decode_check.h"
+
+static const int block_sizes[][3] = {
+    { 4, 4, 1 }, { 5, 4, 1 }, { 5, 5, 1 }, { 6, 5, 1 }, { 6, 6, 1 }, { 8, 5, 1 }, { 8, 6, 1 },
+    { 8, 8, 1 }, { 10, 5, 1 }, { 10, 6, 1 }, { 10, 8, 1 }, { 10, 10, 1 }, { 12, 10, 1 }, { 12, 12, 1 },
+    { 3, 3, 3 }, { 4, 3, 3 }, { 4, 4, 3 }, { 4, 4, 4 }, { 5, 4, 4 },
+    { 5, 5, 4 }, { 5, 5, 5 }, { 6, 5, 5 }, { 6, 6, 5 }, { 6, 6, 6 },
+};
+static const int num_block_sizes = sizeof(block_sizes) / sizeof(block_sizes[0]);
+
+static const oastc::decode_profile profiles[] = {
+    oastc::decode_profile::ldr, oastc::decode_profile::ldr_srgb, oastc::decode_profile::hdr
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size != 18)
+        return 0;
+
+    // Building the optimised decoder's tables is slow, so keep each one
+    static std::unique_ptr<oastc::DecodeChecker> checkers[num_block_sizes][3];
+
+    int size_idx = data[0] % num_block_sizes;
+    int profile_idx = data[1] % 3;
+    std::unique_ptr<oastc::DecodeChecker> &checker = checkers[size_idx][profile_idx];
+    if (!checker) {
+        const int *s = block_sizes[size_idx];
+        checker.reset(new oastc::DecodeChecker(s[0], s[1], s[2], profiles[profile_idx]));
+    }
+
+    oastc::decode_mismatch mismatch;
+    if (!checker->check(data + 2, mismatch)) {
+        checker->print_mismatch(data + 2, mismatch);
+        fflush(stdout);
+        abort();
+    }
+    return 0;
+}
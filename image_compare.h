@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_IMAGE_COMPARE
+#define INCLUDED_OASTC_IMAGE_COMPARE
+
+#include <cmath>
+
+#include "block_error.h"
+
+namespace oastc
+{
+
+/*
+ * Kernels that compare two arrays of unorm8 values (usually RGBA8 images),
+ * for checking decoded images against a reference without writing them to
+ * disk. Channel order doesn't matter as long as both arrays use the same.
+ */
+
+struct image_diff
+{
+    uint64_t num_values = 0;
+    uint64_t mismatches = 0; // values that differ at all
+    uint64_t sum_sq_error = 0;
+    int max_error = 0;
+
+    image_diff &operator+=(const image_diff &o)
+    {
+        num_values += o.num_values;
+        mismatches += o.mismatches;
+        sum_sq_error += o.sum_sq_error;
+        max_error = std::max(max_error, o.max_error);
+        return *this;
+    }
+
+    /**
+     * Peak signal-to-noise ratio in dB, or infinity if there is no error
+     */
+    double psnr() const
+    {
+        if (sum_sq_error == 0)
+            return INFINITY;
+        double mse = (double)sum_sq_error / num_values;
+        return 10.0 * log10(255.0 * 255.0 / mse);
+    }
+};
+
+typedef image_diff (*compare_unorm8_fn)(const uint8_t *a, const uint8_t *b, size_t n);
+
+static image_diff compare_unorm8_scalar(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    image_diff diff;
+    diff.num_values = n;
+    for (size_t i = 0; i < n; ++i) {
+        int d = std::abs(a[i] - b[i]);
+        diff.mismatches += d != 0;
+        diff.sum_sq_error += d * d;
+        diff.max_error = std::max(diff.max_error, d);
+    }
+    return diff;
+}
+
+#if OASTC_X86_SIMD
+
+// The squared errors are summed in 32-bit lanes, which can't overflow
+// within this many iterations (each adds at most 4 * 255^2 per lane)
+static const size_t compare_flush_iterations = 4096;
+
+__attribute__((target("sse2")))
+static image_diff compare_unorm8_sse2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    image_diff diff;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i max = zero;
+
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i sum = zero;
+        for (size_t iter = 0; iter < compare_flush_iterations && i + 16 <= n; ++iter, i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            max = _mm_max_epu8(max, d);
+            diff.mismatches += __builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(d, zero)) & 0xffff);
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, sum);
+        diff.sum_sq_error += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    uint8_t max_lanes[16];
+    _mm_storeu_si128((__m128i *)max_lanes, max);
+    for (int j = 0; j < 16; ++j)
+        diff.max_error = std::max(diff.max_error, (int)max_lanes[j]);
+    diff.num_values = i;
+
+    return diff += compare_unorm8_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static image_diff compare_unorm8_avx2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    image_diff diff;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i max = zero;
+
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256i sum = zero;
+        for (size_t iter = 0; iter < compare_flush_iterations && i + 32 <= n; ++iter, i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+            __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            max = _mm256_max_epu8(max, d);
+            diff.mismatches += __builtin_popcount(~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, zero)));
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, sum);
+        for (int j = 0; j < 8; ++j)
+            diff.sum_sq_error += lanes[j];
+    }
+
+    uint8_t max_lanes[32];
+    _mm256_storeu_si256((__m256i *)max_lanes, max);
+    for (int j = 0; j < 32; ++j)
+        diff.max_error = std::max(diff.max_error, (int)max_lanes[j]);
+    diff.num_values = i;
+
+    return diff += compare_unorm8_scalar(a + i, b + i, n - i);
+}
+
+#endif // OASTC_X86_SIMD
+
+/**
+ * Returns the comparison kernel for the given level, which must be
+ * supported
+ */
+static inline compare_unorm8_fn compare_unorm8_kernel(simd_level level)
+{
+    ASSERT(simd_level_supported(level));
+    switch (level) {
+    case simd_level::scalar:
+        return compare_unorm8_scalar;
+#if OASTC_X86_SIMD
+    case simd_level::sse2:
+        return compare_unorm8_sse2;
+    case simd_level::avx2:
+        return compare_unorm8_avx2;
+#else
+    case simd_level::sse2:
+    case simd_level::avx2:
+        break;
+#endif
+    }
+    UNREACHABLE();
+}
+
+/**
+ * Compare n unorm8 values with the fastest kernel this CPU supports
+ */
+static inline image_diff compare_unorm8(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    static const compare_unorm8_fn kernel =
+        simd_level_supported(simd_level::avx2) ? compare_unorm8_kernel(simd_level::avx2) :
+        simd_level_supported(simd_level::sse2) ? compare_unorm8_kernel(simd_level::sse2) :
+        compare_unorm8_kernel(simd_level::scalar);
+    return kernel(a, b, n);
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_IMAGE_COMPARE
@@ -0,0 +1,1207 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_OASTC_IMAGE_IO
+#define INCLUDED_OASTC_IMAGE_IO
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "common.h"
+
+// Functions here are inline so that tools which only use some of them don't
+// get unused-function warnings
+
+/**
+ * Returns true if filename ends with the given extension (including the '.').
+ */
+static inline bool has_extension(const char *filename, const char *ext)
+{
+    size_t len = strlen(filename);
+    size_t ext_len = strlen(ext);
+    return len >= ext_len && strcasecmp(filename + len - ext_len, ext) == 0;
+}
+
+/**
+ * Write a 2D RGBA8 image as an uncompressed 24-bit or 32-bit .tga file.
+ * The alpha channel is only written if some texel is not fully opaque.
+ */
+static inline bool write_tga(const char *filename, int image_w, int image_h, const std::vector<uint8_t> &image)
+{
+    if (image_w > 0xffff || image_h > 0xffff) {
+        fprintf(stderr, "Image size %dx%d is too large for .tga output\n", image_w, image_h);
+        return false;
+    }
+
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    bool has_alpha = false;
+    for (size_t i = 0; i < image.size(); i += 4) {
+        if (image[i+3] != 255) {
+            has_alpha = true;
+            break;
+        }
+    }
+
+    const uint8_t tga_header[18] = {
+        0, 0, 2,
+        0, 0, 0, 0, 0,
+        0, 0, 0, 0,
+        (uint8_t)(image_w & 0xff), (uint8_t)(image_w >> 8),
+        (uint8_t)(image_h & 0xff), (uint8_t)(image_h >> 8),
+        (uint8_t)(has_alpha ? 32 : 24), 0,
+    };
+    output.write((const char *)tga_header, sizeof(tga_header));
+
+    static const size_t output_buffer_px = 4096;
+    std::vector<uint8_t> output_buffer(output_buffer_px * 4);
+
+    for (size_t offset = 0; offset < image.size(); offset += output_buffer_px * 4) {
+        uint8_t *p = output_buffer.data();
+        size_t num_px = std::min(output_buffer_px, (image.size() - offset) / 4);
+        if (has_alpha) {
+            for (size_t i = 0; i < num_px; ++i) {
+                *p++ = image[offset + i*4+2];
+                *p++ = image[offset + i*4+1];
+                *p++ = image[offset + i*4+0];
+                *p++ = image[offset + i*4+3];
+            }
+        } else {
+            for (size_t i = 0; i < num_px; ++i) {
+                *p++ = image[offset + i*4+2];
+                *p++ = image[offset + i*4+1];
+                *p++ = image[offset + i*4+0];
+            }
+        }
+        output.write((const char *)output_buffer.data(), num_px * (has_alpha ? 4 : 3));
+    }
+
+    return true;
+}
+
+/**
+ * Read an uncompressed 24-bit or 32-bit .tga file as RGBA8, with the rows
+ * bottom-up whichever origin the file uses
+ */
+static inline bool read_tga(const char *filename, int &image_w, int &image_h, std::vector<uint8_t> &image)
+{
+    std::ifstream input(filename, std::ios_base::binary | std::ios_base::in);
+    if (!input) {
+        fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+        return false;
+    }
+
+    uint8_t header[18];
+    input.read((char *)header, sizeof(header));
+    int bpp = header[16];
+    if (!input || header[1] != 0 || header[2] != 2 || (bpp != 24 && bpp != 32)) {
+        fprintf(stderr, "\"%s\" is not an uncompressed 24-bit or 32-bit .tga file\n", filename);
+        return false;
+    }
+
+    image_w = header[12] | (header[13] << 8);
+    image_h = header[14] | (header[15] << 8);
+    bool top_down = header[17] & 0x20;
+    input.seekg(sizeof(header) + header[0]);
+
+    int bytes_pp = bpp / 8;
+    std::vector<uint8_t> row(image_w * bytes_pp);
+    image.resize((size_t)image_w * image_h * 4);
+    for (int y = 0; y < image_h; ++y) {
+        input.read((char *)row.data(), row.size());
+        uint8_t *out = &image[(size_t)(top_down ? image_h - 1 - y : y) * image_w * 4];
+        for (int x = 0; x < image_w; ++x) {
+            out[x*4+0] = row[x*bytes_pp+2];
+            out[x*4+1] = row[x*bytes_pp+1];
+            out[x*4+2] = row[x*bytes_pp+0];
+            out[x*4+3] = bytes_pp == 4 ? row[x*bytes_pp+3] : 0xff;
+        }
+    }
+
+    if (!input) {
+        fprintf(stderr, "Unexpected end of file in \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Minimal DEFLATE decoder (RFC 1951), only fast enough for loading
+ * textures. Based on the canonical-Huffman approach of zlib's puff.c.
+ */
+class Inflater
+{
+public:
+    Inflater(const uint8_t *in, size_t in_size, std::vector<uint8_t> &out)
+        : in(in), in_size(in_size), in_pos(0), bit_buf(0), bit_count(0), out(out) { }
+
+    /**
+     * Decompress the whole stream, appending to 'out'.
+     * Returns false if the data is invalid.
+     */
+    bool inflate()
+    {
+        int last;
+        do {
+            last = bits(1);
+            int type = bits(2);
+            bool ok;
+            if (type == 0)
+                ok = stored();
+            else if (type == 1)
+                ok = fixed();
+            else if (type == 2)
+                ok = dynamic();
+            else
+                ok = false;
+            if (!ok || error)
+                return false;
+        } while (!last);
+        return true;
+    }
+
+private:
+    struct huffman
+    {
+        uint16_t count[16];
+        uint16_t symbol[288];
+    };
+
+    const uint8_t *in;
+    size_t in_size;
+    size_t in_pos;
+    uint32_t bit_buf;
+    int bit_count;
+    bool error = false;
+    std::vector<uint8_t> &out;
+
+    int bits(int n)
+    {
+        while (bit_count < n) {
+            if (in_pos >= in_size) {
+                error = true;
+                return 0;
+            }
+            bit_buf |= (uint32_t)in[in_pos++] << bit_count;
+            bit_count += 8;
+        }
+        int v = bit_buf & ((1u << n) - 1);
+        bit_buf >>= n;
+        bit_count -= n;
+        return v;
+    }
+
+    bool stored()
+    {
+        bit_buf = 0;
+        bit_count = 0;
+        if (in_pos + 4 > in_size)
+            return false;
+        int len = in[in_pos] | (in[in_pos+1] << 8);
+        int nlen = in[in_pos+2] | (in[in_pos+3] << 8);
+        in_pos += 4;
+        if (len != (~nlen & 0xffff) || in_pos + len > in_size)
+            return false;
+        out.insert(out.end(), in + in_pos, in + in_pos + len);
+        in_pos += len;
+        return true;
+    }
+
+    static bool build(huffman &h, const uint8_t *lengths, int n)
+    {
+        memset(h.count, 0, sizeof(h.count));
+        for (int i = 0; i < n; ++i)
+            h.count[lengths[i]]++;
+        if (h.count[0] == n)
+            return true;
+
+        int left = 1;
+        for (int len = 1; len < 16; ++len) {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0)
+                return false;
+        }
+
+        uint16_t offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; ++len)
+            offs[len + 1] = offs[len] + h.count[len];
+        for (int i = 0; i < n; ++i)
+            if (lengths[i])
+                h.symbol[offs[lengths[i]]++] = i;
+        return true;
+    }
+
+    int decode(const huffman &h)
+    {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; ++len) {
+            code |= bits(1);
+            int count = h.count[len];
+            if (code - count < first)
+                return h.symbol[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        error = true;
+        return -1;
+    }
+
+    bool codes(const huffman &lencode, const huffman &distcode)
+    {
+        static const uint16_t len_base[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t len_extra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t dist_base[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+            8193, 12289, 16385, 24577 };
+        static const uint8_t dist_extra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        for (;;) {
+            int symbol = decode(lencode);
+            if (error || symbol < 0)
+                return false;
+            if (symbol < 256) {
+                out.push_back(symbol);
+            } else if (symbol == 256) {
+                return true;
+            } else {
+                symbol -= 257;
+                if (symbol >= 29)
+                    return false;
+                int len = len_base[symbol] + bits(len_extra[symbol]);
+                symbol = decode(distcode);
+                if (error || symbol < 0 || symbol >= 30)
+                    return false;
+                size_t dist = dist_base[symbol] + bits(dist_extra[symbol]);
+                if (dist > out.size())
+                    return false;
+                size_t from = out.size() - dist;
+                for (int i = 0; i < len; ++i)
+                    out.push_back(out[from + i]);
+            }
+        }
+    }
+
+    bool fixed()
+    {
+        static huffman lencode, distcode;
+        static bool built = false;
+        if (!built) {
+            uint8_t lengths[288];
+            int i = 0;
+            for (; i < 144; ++i) lengths[i] = 8;
+            for (; i < 256; ++i) lengths[i] = 9;
+            for (; i < 280; ++i) lengths[i] = 7;
+            for (; i < 288; ++i) lengths[i] = 8;
+            build(lencode, lengths, 288);
+            for (i = 0; i < 30; ++i) lengths[i] = 5;
+            build(distcode, lengths, 30);
+            built = true;
+        }
+        return codes(lencode, distcode);
+    }
+
+    bool dynamic()
+    {
+        static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        int nlen = bits(5) + 257;
+        int ndist = bits(5) + 1;
+        int ncode = bits(4) + 4;
+        if (nlen > 286 || ndist > 30)
+            return false;
+
+        uint8_t lengths[320];
+        memset(lengths, 0, sizeof(lengths));
+        for (int i = 0; i < ncode; ++i)
+            lengths[order[i]] = bits(3);
+
+        huffman lencode, distcode;
+        if (!build(lencode, lengths, 19))
+            return false;
+
+        int index = 0;
+        while (index < nlen + ndist) {
+            int symbol = decode(lencode);
+            if (error || symbol < 0)
+                return false;
+            if (symbol < 16) {
+                lengths[index++] = symbol;
+            } else {
+                int len = 0, repeat;
+                if (symbol == 16) {
+                    if (index == 0)
+                        return false;
+                    len = lengths[index - 1];
+                    repeat = 3 + bits(2);
+                } else if (symbol == 17) {
+                    repeat = 3 + bits(3);
+                } else {
+                    repeat = 11 + bits(7);
+                }
+                if (index + repeat > nlen + ndist)
+                    return false;
+                while (repeat--)
+                    lengths[index++] = len;
+            }
+        }
+
+        if (!build(lencode, lengths, nlen) || !build(distcode, lengths + nlen, ndist))
+            return false;
+        return codes(lencode, distcode);
+    }
+};
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Read an 8-bit non-interlaced .png file (greyscale, RGB, palette,
+ * greyscale+alpha or RGBA) as RGBA8. Like read_tga, the rows are returned
+ * bottom-up, matching the row order of decoded .astc images
+ */
+static inline bool read_png(const char *filename, int &image_w, int &image_h, std::vector<uint8_t> &image)
+{
+    std::ifstream input(filename, std::ios_base::binary | std::ios_base::in);
+    if (!input) {
+        fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+        return false;
+    }
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    if (file.size() < 8 || memcmp(file.data(), signature, 8) != 0) {
+        fprintf(stderr, "\"%s\" is not a .png file\n", filename);
+        return false;
+    }
+
+    int bit_depth = 0, colour_type = 0, interlace = 0;
+    std::vector<uint8_t> idat;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> palette_alpha;
+    image_w = image_h = 0;
+
+    size_t pos = 8;
+    while (pos + 12 <= file.size()) {
+        uint32_t len = read_be32(&file[pos]);
+        const uint8_t *type = &file[pos + 4];
+        const uint8_t *data = &file[pos + 8];
+        if (len > file.size() - pos - 12)
+            break;
+
+        if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+            image_w = read_be32(data);
+            image_h = read_be32(data + 4);
+            bit_depth = data[8];
+            colour_type = data[9];
+            interlace = data[12];
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            palette.assign(data, data + len);
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            palette_alpha.assign(data, data + len);
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), data, data + len);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += len + 12;
+    }
+
+    int channels;
+    switch (colour_type) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: channels = 0; break;
+    }
+
+    if (image_w <= 0 || image_h <= 0 || bit_depth != 8 || channels == 0 || interlace != 0) {
+        fprintf(stderr, "\"%s\" is not a supported .png file (must be 8 bits per channel, non-interlaced)\n", filename);
+        return false;
+    }
+
+    // Skip the 2-byte zlib header; the Adler-32 checksum at the end is ignored
+    std::vector<uint8_t> raw;
+    size_t stride = (size_t)image_w * channels;
+    raw.reserve((stride + 1) * image_h);
+    Inflater inflater(idat.data() + std::min<size_t>(2, idat.size()), idat.size() - std::min<size_t>(2, idat.size()), raw);
+    if (!inflater.inflate() || raw.size() < (stride + 1) * image_h) {
+        fprintf(stderr, "Invalid compressed data in \"%s\"\n", filename);
+        return false;
+    }
+
+    // Undo the per-row filters in place
+    std::vector<uint8_t> zero_row(stride);
+    for (int y = 0; y < image_h; ++y) {
+        uint8_t *row = &raw[y * (stride + 1) + 1];
+        const uint8_t *prev = y > 0 ? &raw[(y - 1) * (stride + 1) + 1] : zero_row.data();
+        int filter = row[-1];
+        for (size_t x = 0; x < stride; ++x) {
+            int a = x >= (size_t)channels ? row[x - channels] : 0;
+            int b = prev[x];
+            int c = x >= (size_t)channels ? prev[x - channels] : 0;
+            switch (filter) {
+            case 0: break;
+            case 1: row[x] += a; break;
+            case 2: row[x] += b; break;
+            case 3: row[x] += (a + b) >> 1; break;
+            case 4: {
+                int p = a + b - c;
+                int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                row[x] += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+                break;
+            }
+            default:
+                fprintf(stderr, "Invalid row filter in \"%s\"\n", filename);
+                return false;
+            }
+        }
+    }
+
+    image.resize((size_t)image_w * image_h * 4);
+    for (int y = 0; y < image_h; ++y) {
+        const uint8_t *row = &raw[y * (stride + 1) + 1];
+        uint8_t *out = &image[(size_t)(image_h - 1 - y) * image_w * 4];
+        for (int x = 0; x < image_w; ++x) {
+            const uint8_t *p = &row[x * channels];
+            switch (colour_type) {
+            case 0: out[0] = out[1] = out[2] = p[0]; out[3] = 0xff; break;
+            case 2: out[0] = p[0]; out[1] = p[1]; out[2] = p[2]; out[3] = 0xff; break;
+            case 3:
+                if ((size_t)p[0] * 3 + 2 >= palette.size()) {
+                    fprintf(stderr, "Invalid palette index in \"%s\"\n", filename);
+                    return false;
+                }
+                out[0] = palette[p[0]*3+0];
+                out[1] = palette[p[0]*3+1];
+                out[2] = palette[p[0]*3+2];
+                out[3] = p[0] < palette_alpha.size() ? palette_alpha[p[0]] : 0xff;
+                break;
+            case 4: out[0] = out[1] = out[2] = p[0]; out[3] = p[1]; break;
+            case 6: memcpy(out, p, 4); break;
+            }
+            out += 4;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read a .png or .tga file as RGBA8, based on its extension
+ */
+static inline bool read_image(const char *filename, int &image_w, int &image_h, std::vector<uint8_t> &image)
+{
+    if (has_extension(filename, ".png"))
+        return read_png(filename, image_w, image_h, image);
+    if (has_extension(filename, ".tga"))
+        return read_tga(filename, image_w, image_h, image);
+    fprintf(stderr, "Unrecognised input format for \"%s\" - must be .png or .tga\n", filename);
+    return false;
+}
+
+// GL enums used in .ktx headers
+enum
+{
+    GL_UNSIGNED_BYTE_ = 0x1401,
+    GL_HALF_FLOAT_ = 0x140B,
+    GL_RGBA_ = 0x1908,
+    GL_RGBA8_ = 0x8058,
+    GL_RGBA16F_ = 0x881A,
+    GL_SRGB8_ALPHA8_ = 0x8C43,
+    GL_RGB_ = 0x1907,
+    GL_COMPRESSED_RGB_S3TC_DXT1_EXT_ = 0x83F0,
+    GL_COMPRESSED_SRGB_S3TC_DXT1_EXT_ = 0x8C4C,
+    GL_COMPRESSED_RGBA_BPTC_UNORM_ = 0x8E8C,
+    GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ = 0x8E8D,
+};
+
+// .ktx (version 1) file format described at
+// https://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/
+struct ktx_header
+{
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t gl_type;
+    uint32_t gl_type_size;
+    uint32_t gl_format;
+    uint32_t gl_internal_format;
+    uint32_t gl_base_internal_format;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t number_of_array_elements;
+    uint32_t number_of_faces;
+    uint32_t number_of_mipmap_levels;
+    uint32_t bytes_of_key_value_data;
+};
+static_assert(sizeof(ktx_header) == 64, "no unexpected padding in ktx_header");
+
+/**
+ * Write a single-level 2D or 3D image as a .ktx file. 'data' must already be
+ * in the layout KTX expects (rows padded to 4 bytes, x-major, then y, then z).
+ */
+static inline bool write_ktx(const char *filename, int image_w, int image_h, int image_d,
+        uint32_t gl_type, uint32_t gl_type_size, uint32_t gl_format,
+        uint32_t gl_internal_format, uint32_t gl_base_internal_format,
+        const uint8_t *data, size_t size)
+{
+    // KTX 1.1 stores each level's imageSize in 32 bits
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "Image is too large for .ktx output (%llu bytes, the limit is 4GB)\n",
+                (unsigned long long)size);
+        return false;
+    }
+
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+    ktx_header header{};
+    memcpy(header.identifier, identifier, sizeof(identifier));
+    header.endianness = 0x04030201;
+    header.gl_type = gl_type;
+    header.gl_type_size = gl_type_size;
+    header.gl_format = gl_format;
+    header.gl_internal_format = gl_internal_format;
+    header.gl_base_internal_format = gl_base_internal_format;
+    header.pixel_width = image_w;
+    header.pixel_height = image_h;
+    header.pixel_depth = image_d > 1 ? image_d : 0;
+    header.number_of_array_elements = 0;
+    header.number_of_faces = 1;
+    header.number_of_mipmap_levels = 1;
+    header.bytes_of_key_value_data = 0;
+    output.write((const char *)&header, sizeof(header));
+
+    uint32_t image_size = size;
+    output.write((const char *)&image_size, sizeof(image_size));
+    output.write((const char *)data, size);
+
+    if (!output) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Write a 2D or 3D RGBA8 image as an uncompressed .ktx file,
+ * tagged as sRGB-encoded if 'srgb' is set
+ */
+static inline bool write_ktx_rgba8(const char *filename, int image_w, int image_h, int image_d, bool srgb, const std::vector<uint8_t> &image)
+{
+    return write_ktx(filename, image_w, image_h, image_d,
+            GL_UNSIGNED_BYTE_, 1, GL_RGBA_, srgb ? GL_SRGB8_ALPHA8_ : GL_RGBA8_, GL_RGBA_,
+            image.data(), image.size());
+}
+
+/**
+ * Write a 2D or 3D RGBA image of fp16 bit patterns as an uncompressed
+ * RGBA16F .ktx file
+ */
+static inline bool write_ktx_rgba16f(const char *filename, int image_w, int image_h, int image_d, const std::vector<uint16_t> &image)
+{
+    return write_ktx(filename, image_w, image_h, image_d,
+            GL_HALF_FLOAT_, 2, GL_RGBA_, GL_RGBA16F_, GL_RGBA_,
+            (const uint8_t *)image.data(), image.size() * sizeof(uint16_t));
+}
+
+/**
+ * Write a 2D or 3D RGBA image of fp16 bit patterns as a headerless file of
+ * little-endian RGBA16F texels (x-major, then y, then z). The dimensions are
+ * not stored, so the reader has to know them already.
+ */
+static inline bool write_raw_rgba16f(const char *filename, const std::vector<uint16_t> &image)
+{
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    output.write((const char *)image.data(), image.size() * sizeof(uint16_t));
+
+    if (!output) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// .raw file format, designed to be memory-mapped and uploaded to a GPU
+// without any parsing or copying. All fields are little-endian.
+//
+// The file starts with a raw_header, followed by num_levels raw_level_header
+// entries. Each level's texels start at a multiple of level_alignment bytes
+// from the start of the file. Rows are bottom-up, so the first row is the
+// bottom row of the image (t = 0), in the same order as the blocks of an
+// .astc file and the rows of a .tga file. Texels are in RGBA order, and each
+// row starts at a multiple of row_alignment bytes from the start of its
+// level. Slices of 3D levels are row_pitch * height bytes apart.
+enum raw_format
+{
+    RAW_FORMAT_RGBA8_UNORM = 1,
+    RAW_FORMAT_RGBA8_SRGB = 2,
+    RAW_FORMAT_RGBA16F = 3,
+};
+
+static const uint32_t raw_row_alignment = 256;
+static const uint32_t raw_level_alignment = 4096;
+
+struct raw_header
+{
+    uint8_t magic[8]; // "OASTCRAW"
+    uint32_t version; // 1
+    uint32_t header_size; // sizeof(raw_header)
+    uint32_t pixel_format; // raw_format
+    uint32_t bytes_per_pixel;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t num_levels;
+    uint32_t row_alignment;
+    uint32_t level_alignment;
+    uint32_t reserved[4];
+};
+static_assert(sizeof(raw_header) == 64, "no unexpected padding in raw_header");
+
+struct raw_level_header
+{
+    uint64_t offset; // from the start of the file
+    uint64_t size; // including row padding
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t row_pitch;
+};
+static_assert(sizeof(raw_level_header) == 32, "no unexpected padding in raw_level_header");
+
+/**
+ * A level of an image, with tightly-packed rows
+ */
+struct raw_level
+{
+    int width, height, depth;
+    const uint8_t *data;
+};
+
+/**
+ * Write a .raw file with the given levels (usually just one)
+ */
+static inline bool write_raw(const char *filename, raw_format format, const std::vector<raw_level> &levels)
+{
+    ASSERT(!levels.empty());
+
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    uint32_t bytes_per_pixel = (format == RAW_FORMAT_RGBA16F ? 8 : 4);
+
+    raw_header header{};
+    memcpy(header.magic, "OASTCRAW", 8);
+    header.version = 1;
+    header.header_size = sizeof(raw_header);
+    header.pixel_format = format;
+    header.bytes_per_pixel = bytes_per_pixel;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.depth = levels[0].depth;
+    header.num_levels = levels.size();
+    header.row_alignment = raw_row_alignment;
+    header.level_alignment = raw_level_alignment;
+
+    std::vector<raw_level_header> level_headers(levels.size());
+    uint64_t offset = sizeof(raw_header) + levels.size() * sizeof(raw_level_header);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        raw_level_header &lh = level_headers[i];
+        offset = (offset + raw_level_alignment - 1) & ~(uint64_t)(raw_level_alignment - 1);
+        lh.offset = offset;
+        lh.width = levels[i].width;
+        lh.height = levels[i].height;
+        lh.depth = levels[i].depth;
+        lh.row_pitch = (levels[i].width * bytes_per_pixel + raw_row_alignment - 1) & ~(raw_row_alignment - 1);
+        lh.size = (uint64_t)lh.row_pitch * lh.height * lh.depth;
+        offset += lh.size;
+    }
+
+    output.write((const char *)&header, sizeof(header));
+    output.write((const char *)level_headers.data(), level_headers.size() * sizeof(raw_level_header));
+
+    std::vector<char> padding(std::max(raw_level_alignment, raw_row_alignment));
+    uint64_t written = sizeof(raw_header) + levels.size() * sizeof(raw_level_header);
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        const raw_level_header &lh = level_headers[i];
+        output.write(padding.data(), lh.offset - written);
+
+        size_t row_bytes = (size_t)lh.width * bytes_per_pixel;
+        for (size_t row = 0; row < (size_t)lh.height * lh.depth; ++row) {
+            output.write((const char *)levels[i].data + row * row_bytes, row_bytes);
+            output.write(padding.data(), lh.row_pitch - row_bytes);
+        }
+        written = lh.offset + lh.size;
+    }
+
+    if (!output) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A read-only memory mapping of a whole file
+ */
+class MappedFile
+{
+public:
+    MappedFile() : ptr(nullptr), len(0) { }
+    ~MappedFile() { unmap(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool map(const char *filename)
+    {
+        unmap();
+
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            fprintf(stderr, "Failed to stat \"%s\"\n", filename);
+            close(fd);
+            return false;
+        }
+
+        // mmap rejects empty files, but they're easier to report as truncated
+        // than as unmappable
+        if (st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                fprintf(stderr, "Failed to map \"%s\"\n", filename);
+                close(fd);
+                return false;
+            }
+            ptr = (const uint8_t *)p;
+            len = st.st_size;
+        }
+
+        close(fd);
+        return true;
+    }
+
+    const uint8_t *data() const { return ptr; }
+    size_t size() const { return len; }
+
+private:
+    void unmap()
+    {
+        if (ptr)
+            munmap((void *)ptr, len);
+        ptr = nullptr;
+        len = 0;
+    }
+
+    const uint8_t *ptr;
+    size_t len;
+};
+
+/**
+ * The texels of an uncompressed .tga file or an RGBA8 .raw file, used in
+ * place in a memory mapping instead of being copied and converted to RGBA8
+ */
+struct mapped_image
+{
+    MappedFile file;
+    int width, height;
+    int bytes_per_pixel; // 3 or 4
+    bool bgr; // .tga files store BGR(A)
+    bool top_down; // .tga top-left origin flag: the rows are stored last row first
+    size_t row_pitch;
+    const uint8_t *pixels; // the first row in the file
+
+    /**
+     * The texels of row y, counting from the bottom of the image like
+     * read_png() and read_tga()
+     */
+    const uint8_t *row(int y) const
+    {
+        return pixels + (size_t)(top_down ? height - 1 - y : y) * row_pitch;
+    }
+
+    /**
+     * Whether rows of this and o can be compared byte for byte
+     */
+    bool same_layout(const mapped_image &o) const
+    {
+        return width == o.width && height == o.height && bytes_per_pixel == o.bytes_per_pixel && bgr == o.bgr;
+    }
+
+    /**
+     * Convert row y (counting from the bottom) to RGBA8
+     */
+    void row_rgba8(int y, uint8_t *out) const
+    {
+        const uint8_t *in = row(y);
+        if (bytes_per_pixel == 4 && !bgr) {
+            memcpy(out, in, (size_t)width * 4);
+            return;
+        }
+        int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+        for (int x = 0; x < width; ++x) {
+            out[x*4+0] = in[x*bytes_per_pixel+r];
+            out[x*4+1] = in[x*bytes_per_pixel+1];
+            out[x*4+2] = in[x*bytes_per_pixel+b];
+            out[x*4+3] = bytes_per_pixel == 4 ? in[x*bytes_per_pixel+3] : 0xff;
+        }
+    }
+};
+
+/**
+ * Map an uncompressed 24-bit or 32-bit .tga file, or the first level of a
+ * 2D RGBA8 .raw file
+ */
+static inline bool map_image(const char *filename, mapped_image &img)
+{
+    if (!img.file.map(filename))
+        return false;
+
+    const uint8_t *data = img.file.data();
+    size_t size = img.file.size();
+
+    uint64_t offset, row_bytes;
+    if (has_extension(filename, ".raw")) {
+        raw_header header;
+        raw_level_header level;
+        if (size < sizeof(header) + sizeof(level)) {
+            fprintf(stderr, "Unexpected end of file in \"%s\"\n", filename);
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        memcpy(&level, data + sizeof(header), sizeof(level));
+
+        if (memcmp(header.magic, "OASTCRAW", 8) != 0 || header.version != 1 || header.header_size != sizeof(header)) {
+            fprintf(stderr, "\"%s\" is not a valid .raw file\n", filename);
+            return false;
+        }
+        if ((header.pixel_format != RAW_FORMAT_RGBA8_UNORM && header.pixel_format != RAW_FORMAT_RGBA8_SRGB)
+                || header.num_levels < 1 || level.depth != 1) {
+            fprintf(stderr, "\"%s\" is not a 2D RGBA8 .raw file\n", filename);
+            return false;
+        }
+
+        img.width = level.width;
+        img.height = level.height;
+        img.bytes_per_pixel = 4;
+        img.bgr = false;
+        img.top_down = false; // write_raw() stores image row 0 first
+        img.row_pitch = level.row_pitch;
+        offset = level.offset;
+    } else if (has_extension(filename, ".tga")) {
+        if (size < 18 || data[1] != 0 || data[2] != 2 || (data[16] != 24 && data[16] != 32)) {
+            fprintf(stderr, "\"%s\" is not an uncompressed 24-bit or 32-bit .tga file\n", filename);
+            return false;
+        }
+
+        img.width = data[12] | (data[13] << 8);
+        img.height = data[14] | (data[15] << 8);
+        img.bytes_per_pixel = data[16] / 8;
+        img.bgr = true;
+        img.top_down = data[17] & 0x20;
+        img.row_pitch = (size_t)img.width * img.bytes_per_pixel;
+        offset = 18 + data[0];
+    } else {
+        fprintf(stderr, "Unrecognised format for \"%s\" - must be .tga or .raw\n", filename);
+        return false;
+    }
+
+    row_bytes = (uint64_t)img.width * img.bytes_per_pixel;
+    if (img.row_pitch < row_bytes
+            || (img.height > 0 && offset + (uint64_t)img.row_pitch * (img.height - 1) + row_bytes > size)) {
+        fprintf(stderr, "Unexpected end of file in \"%s\"\n", filename);
+        return false;
+    }
+
+    img.pixels = data + offset;
+    return true;
+}
+
+// .astc file format described at http://malideveloper.arm.com/downloads/Stacy_ASTC_white%20paper.pdf
+struct astc_header
+{
+    uint32_t magic;
+    uint8_t blockdim_x;
+    uint8_t blockdim_y;
+    uint8_t blockdim_z;
+    uint8_t xsize[3];
+    uint8_t ysize[3];
+    uint8_t zsize[3];
+};
+static_assert(sizeof(astc_header) == 16, "no unexpected padding in astc_header");
+
+/**
+ * Whether w x h x d is one of the block footprints defined by ASTC (d = 1
+ * for 2D blocks)
+ */
+static inline bool is_valid_block_size(int w, int h, int d = 1)
+{
+    static const int sizes[][3] = {
+        { 4, 4, 1 }, { 5, 4, 1 }, { 5, 5, 1 }, { 6, 5, 1 }, { 6, 6, 1 }, { 8, 5, 1 }, { 8, 6, 1 },
+        { 8, 8, 1 }, { 10, 5, 1 }, { 10, 6, 1 }, { 10, 8, 1 }, { 10, 10, 1 }, { 12, 10, 1 }, { 12, 12, 1 },
+        { 3, 3, 3 }, { 4, 3, 3 }, { 4, 4, 3 }, { 4, 4, 4 }, { 5, 4, 4 },
+        { 5, 5, 4 }, { 5, 5, 5 }, { 6, 5, 5 }, { 6, 6, 5 }, { 6, 6, 6 },
+    };
+    for (auto &s : sizes)
+        if (s[0] == w && s[1] == h && s[2] == d)
+            return true;
+    return false;
+}
+
+struct astc_image
+{
+    int block_w, block_h, block_d;
+    int image_w, image_h, image_d;
+    int blocks_x, blocks_y, blocks_z;
+    std::vector<uint8_t> blocks;
+};
+
+/**
+ * Read a whole .astc file into memory
+ */
+static inline bool read_astc(const char *filename, astc_image &img)
+{
+    std::ifstream input(filename, std::ios_base::binary | std::ios_base::in);
+    if (!input) {
+        fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+        return false;
+    }
+
+    astc_header header{};
+
+    input.read((char *)&header, sizeof(astc_header));
+
+    if (header.magic != 0x5ca1ab13) {
+        fprintf(stderr, "Invalid header magic 0x%08x - input must be a valid .astc file\n", header.magic);
+        return false;
+    }
+
+    img.block_w = header.blockdim_x;
+    img.block_h = header.blockdim_y;
+    img.block_d = header.blockdim_z;
+
+    // The decoders' texel buffers are sized for the largest real footprint
+    if (!is_valid_block_size(img.block_w, img.block_h, img.block_d)) {
+        fprintf(stderr, "Invalid block size %dx%dx%d in \"%s\"\n", img.block_w, img.block_h, img.block_d, filename);
+        return false;
+    }
+
+    img.image_w = (header.xsize[0] + (header.xsize[1] << 8) + (header.xsize[2] << 16));
+    img.image_h = (header.ysize[0] + (header.ysize[1] << 8) + (header.ysize[2] << 16));
+    img.image_d = (header.zsize[0] + (header.zsize[1] << 8) + (header.zsize[2] << 16));
+
+    img.blocks_x = (img.image_w + img.block_w - 1) / img.block_w;
+    img.blocks_y = (img.image_h + img.block_h - 1) / img.block_h;
+    img.blocks_z = (img.image_d + img.block_d - 1) / img.block_d;
+
+    img.blocks.resize((size_t)img.blocks_x * img.blocks_y * img.blocks_z * 16);
+    input.read((char *)img.blocks.data(), img.blocks.size());
+    if (!input) {
+        fprintf(stderr, "Unexpected end of file in \"%s\"\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Write the header and blocks of an .astc file
+ */
+static inline bool write_astc(const char *filename, int block_w, int block_h, int block_d,
+        int image_w, int image_h, int image_d, const std::vector<uint8_t> &blocks)
+{
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    uint8_t header[16] = {
+        0x13, 0xab, 0xa1, 0x5c,
+        (uint8_t)block_w, (uint8_t)block_h, (uint8_t)block_d,
+        (uint8_t)image_w, (uint8_t)(image_w >> 8), (uint8_t)(image_w >> 16),
+        (uint8_t)image_h, (uint8_t)(image_h >> 8), (uint8_t)(image_h >> 16),
+        (uint8_t)image_d, (uint8_t)(image_d >> 8), (uint8_t)(image_d >> 16),
+    };
+    output.write((const char *)header, sizeof(header));
+    output.write((const char *)blocks.data(), blocks.size());
+
+    if (!output) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// Sidecar file for incremental encoding: a hash of the source texels of
+// every block of an .astc file, plus enough about how it was encoded to tell
+// whether the .astc file is still the one those hashes describe
+struct block_hash_header
+{
+    uint8_t magic[8]; // "OASTCHSH"
+    uint32_t version; // 1
+    uint32_t header_size; // sizeof(block_hash_header)
+    uint32_t block_w;
+    uint32_t block_h;
+    uint32_t image_w;
+    uint32_t image_h;
+    uint32_t encoder_settings; // opaque to this file; the encoder's quality etc
+    uint32_t reserved;
+    uint64_t astc_hash; // hash of the .astc file's blocks
+    uint64_t num_blocks;
+    // followed by num_blocks uint64_t hashes, in .astc block order
+};
+static_assert(sizeof(block_hash_header) == 56, "no unexpected padding in block_hash_header");
+
+struct block_hashes
+{
+    int block_w, block_h;
+    int image_w, image_h;
+    uint32_t encoder_settings;
+    uint64_t astc_hash;
+    std::vector<uint64_t> hashes;
+};
+
+/**
+ * Read a block hash sidecar file
+ */
+static inline bool read_block_hashes(const char *filename, block_hashes &bh)
+{
+    std::ifstream input(filename, std::ios_base::binary | std::ios_base::in);
+    if (!input) {
+        fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+        return false;
+    }
+
+    block_hash_header header{};
+    input.read((char *)&header, sizeof(header));
+    if (!input || memcmp(header.magic, "OASTCHSH", 8) != 0 || header.version != 1
+            || header.header_size != sizeof(header)) {
+        fprintf(stderr, "\"%s\" is not a valid block hash file\n", filename);
+        return false;
+    }
+
+    if (header.num_blocks > ((uint64_t)1 << 40)) {
+        fprintf(stderr, "Invalid block count in \"%s\"\n", filename);
+        return false;
+    }
+
+    bh.block_w = header.block_w;
+    bh.block_h = header.block_h;
+    bh.image_w = header.image_w;
+    bh.image_h = header.image_h;
+    bh.encoder_settings = header.encoder_settings;
+    bh.astc_hash = header.astc_hash;
+    bh.hashes.resize(header.num_blocks);
+    input.read((char *)bh.hashes.data(), bh.hashes.size() * sizeof(uint64_t));
+    if (!input) {
+        fprintf(stderr, "Unexpected end of file in \"%s\"\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Write a block hash sidecar file
+ */
+static inline bool write_block_hashes(const char *filename, const block_hashes &bh)
+{
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::out);
+    if (!output) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    block_hash_header header{};
+    memcpy(header.magic, "OASTCHSH", 8);
+    header.version = 1;
+    header.header_size = sizeof(header);
+    header.block_w = bh.block_w;
+    header.block_h = bh.block_h;
+    header.image_w = bh.image_w;
+    header.image_h = bh.image_h;
+    header.encoder_settings = bh.encoder_settings;
+    header.astc_hash = bh.astc_hash;
+    header.num_blocks = bh.hashes.size();
+    output.write((const char *)&header, sizeof(header));
+    output.write((const char *)bh.hashes.data(), bh.hashes.size() * sizeof(uint64_t));
+
+    if (!output) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+#endif // INCLUDED_OASTC_IMAGE_IO
@@ -26,6 +26,27 @@
 #include <algorithm>
 #include <cstdarg>
 #include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Build with -DOASTC_DECODE_TIMING=1 to count the time spent in each stage of
+// decoding, and the errors returned, for get_decode_timing(). Otherwise the
+// instrumentation compiles to nothing
+#ifndef OASTC_DECODE_TIMING
+#define OASTC_DECODE_TIMING 0
+#endif
+
+#if OASTC_DECODE_TIMING
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#endif
 
 #include "fp16.h"
 #include "common.h"
@@ -50,7 +71,315 @@ enum class decode_error
     invalid_weight_bits,
     invalid_num_weights,
 };
+static const int num_decode_errors = (int)decode_error::invalid_num_weights + 1;
 
+static inline const char *decode_error_name(decode_error err)
+{
+    switch (err) {
+    case decode_error::ok: return "ok";
+    case decode_error::unsupported_hdr_void_extent: return "unsupported_hdr_void_extent";
+    case decode_error::reserved_block_mode_1: return "reserved_block_mode_1";
+    case decode_error::reserved_block_mode_2: return "reserved_block_mode_2";
+    case decode_error::dual_plane_and_too_many_partitions: return "dual_plane_and_too_many_partitions";
+    case decode_error::invalid_range_in_void_extent: return "invalid_range_in_void_extent";
+    case decode_error::weight_grid_exceeds_block_size: return "weight_grid_exceeds_block_size";
+    case decode_error::invalid_colour_endpoints_size: return "invalid_colour_endpoints_size";
+    case decode_error::invalid_colour_endpoints_count: return "invalid_colour_endpoints_count";
+    case decode_error::invalid_weight_bits: return "invalid_weight_bits";
+    case decode_error::invalid_num_weights: return "invalid_num_weights";
+    }
+    UNREACHABLE();
+}
+
+/**
+ * The stages of decoding a block, in order, as timed by OASTC_DECODE_TIMING.
+ * Each one also includes the validation and size calculations between it
+ * and the next stage.
+ */
+enum class decode_stage
+{
+    block_mode,
+    cem,
+    unpack_colour_endpoints,
+    unquantise_colour_endpoints,
+    decode_colour_endpoints,
+    unpack_weights,
+    unquantise_weights,
+    infill_weights,
+    write_decoded,
+};
+static const int num_decode_stages = (int)decode_stage::write_decoded + 1;
+
+static inline const char *decode_stage_name(decode_stage stage)
+{
+    switch (stage) {
+    case decode_stage::block_mode: return "decode_block_mode";
+    case decode_stage::cem: return "decode_cem";
+    case decode_stage::unpack_colour_endpoints: return "unpack_colour_endpoints";
+    case decode_stage::unquantise_colour_endpoints: return "unquantise_colour_endpoints";
+    case decode_stage::decode_colour_endpoints: return "decode_colour_endpoints";
+    case decode_stage::unpack_weights: return "unpack_weights";
+    case decode_stage::unquantise_weights: return "unquantise_weights";
+    case decode_stage::infill_weights: return "compute_infill_weights";
+    case decode_stage::write_decoded: return "write_decoded";
+    }
+    UNREACHABLE();
+}
+
+/**
+ * Totals of the ticks spent in (and number of calls to) each decode_stage,
+ * and of the decode_errors returned by Decoder::decode*(). Ticks are the CPU
+ * timestamp counter on x86, and nanoseconds elsewhere.
+ */
+struct decode_timing
+{
+    uint64_t ticks[num_decode_stages];
+    uint64_t calls[num_decode_stages];
+    uint64_t errors[num_decode_errors];
+};
+
+/**
+ * Totals over every thread (including ones that have exited) since the
+ * start or the last reset_decode_timing(). All zero unless built with
+ * OASTC_DECODE_TIMING.
+ */
+static inline decode_timing get_decode_timing();
+
+/**
+ * Zero the totals. Must not be called while any thread is decoding.
+ */
+static inline void reset_decode_timing();
+
+#if OASTC_DECODE_TIMING
+
+/**
+ * The counters of a single thread. Only that thread updates them, so they
+ * need no locks or atomic read-modify-writes; they're atomic only so that
+ * get_decode_timing() can read them from another thread. The registry lock
+ * is only taken when a thread first decodes and when it exits.
+ */
+class ThreadDecodeTiming
+{
+public:
+    static ThreadDecodeTiming &get()
+    {
+        thread_local ThreadDecodeTiming timing;
+        return timing;
+    }
+
+    static uint64_t now()
+    {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void add_stage(decode_stage stage, uint64_t ticks)
+    {
+        add(counters.ticks[(int)stage], ticks);
+        add(counters.calls[(int)stage], 1);
+    }
+
+    void add_error(decode_error err)
+    {
+        add(counters.errors[(int)err], 1);
+    }
+
+    static decode_timing total()
+    {
+        Registry &registry = Registry::get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        decode_timing result = registry.exited;
+        for (ThreadDecodeTiming *t : registry.threads)
+            t->add_to(result);
+        return result;
+    }
+
+    static void reset()
+    {
+        Registry &registry = Registry::get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.exited = decode_timing();
+        for (ThreadDecodeTiming *t : registry.threads)
+            t->counters = atomic_timing();
+    }
+
+private:
+    struct atomic_timing
+    {
+        std::atomic<uint64_t> ticks[num_decode_stages];
+        std::atomic<uint64_t> calls[num_decode_stages];
+        std::atomic<uint64_t> errors[num_decode_errors];
+
+        atomic_timing()
+        {
+            for (auto &c : ticks) c = 0;
+            for (auto &c : calls) c = 0;
+            for (auto &c : errors) c = 0;
+        }
+
+        atomic_timing &operator=(const atomic_timing &o)
+        {
+            for (int i = 0; i < num_decode_stages; ++i) {
+                ticks[i].store(o.ticks[i].load());
+                calls[i].store(o.calls[i].load());
+            }
+            for (int i = 0; i < num_decode_errors; ++i)
+                errors[i].store(o.errors[i].load());
+            return *this;
+        }
+    };
+
+    struct Registry
+    {
+        static Registry &get()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        std::mutex mutex;
+        std::vector<ThreadDecodeTiming *> threads;
+        decode_timing exited = decode_timing(); // totals of threads that have exited
+    };
+
+    ThreadDecodeTiming()
+    {
+        Registry &registry = Registry::get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(this);
+    }
+
+    ~ThreadDecodeTiming()
+    {
+        Registry &registry = Registry::get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        add_to(registry.exited);
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    }
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void add_to(decode_timing &result) const
+    {
+        for (int i = 0; i < num_decode_stages; ++i) {
+            result.ticks[i] += counters.ticks[i].load(std::memory_order_relaxed);
+            result.calls[i] += counters.calls[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < num_decode_errors; ++i)
+            result.errors[i] += counters.errors[i].load(std::memory_order_relaxed);
+    }
+
+    atomic_timing counters;
+};
+
+/**
+ * Attributes the time since construction or the previous mark() to a stage
+ */
+class DecodeStageTimer
+{
+public:
+    DecodeStageTimer() : timing(ThreadDecodeTiming::get()), last(ThreadDecodeTiming::now()) { }
+
+    void mark(decode_stage stage)
+    {
+        uint64_t t = ThreadDecodeTiming::now();
+        timing.add_stage(stage, t - last);
+        last = t;
+    }
+
+private:
+    ThreadDecodeTiming &timing;
+    uint64_t last;
+};
+
+static inline void count_decode_error(decode_error err)
+{
+    ThreadDecodeTiming::get().add_error(err);
+}
+
+static inline decode_timing get_decode_timing()
+{
+    return ThreadDecodeTiming::total();
+}
+
+static inline void reset_decode_timing()
+{
+    ThreadDecodeTiming::reset();
+}
+
+#else // !OASTC_DECODE_TIMING
+
+class DecodeStageTimer
+{
+public:
+    void mark(decode_stage) { }
+};
+
+static inline void count_decode_error(decode_error) { }
+
+static inline decode_timing get_decode_timing()
+{
+    return decode_timing();
+}
+
+static inline void reset_decode_timing() { }
+
+#endif // OASTC_DECODE_TIMING
+
+
+enum class decode_profile
+{
+    ldr,
+    ldr_srgb,
+    hdr,
+};
+
+/**
+ * sRGB-to-linear conversion of every 8-bit sRGB value, as fp16 bit patterns
+ * (rounded to nearest). Used when decoding in the sRGB profile, where the
+ * top 8 bits of each interpolated colour are the sRGB-encoded value.
+ */
+static const uint16_t srgb_to_linear_fp16[256] = {
+    0x0000, 0x0cf9, 0x10f9, 0x1376, 0x14f9, 0x1637, 0x1776, 0x185a,
+    0x18f9, 0x1998, 0x1a37, 0x1adb, 0x1b88, 0x1c1f, 0x1c7f, 0x1ce4,
+    0x1d4e, 0x1dbd, 0x1e32, 0x1eab, 0x1f2a, 0x1fae, 0x201c, 0x2063,
+    0x20ad, 0x20fa, 0x214a, 0x219d, 0x21f2, 0x224a, 0x22a6, 0x2304,
+    0x2365, 0x23c9, 0x2418, 0x244d, 0x2484, 0x24bc, 0x24f6, 0x2532,
+    0x256f, 0x25ad, 0x25ed, 0x262f, 0x2673, 0x26b8, 0x26ff, 0x2747,
+    0x2791, 0x27dd, 0x2815, 0x283d, 0x2865, 0x288f, 0x28b9, 0x28e4,
+    0x2910, 0x293d, 0x296a, 0x2999, 0x29c9, 0x29f9, 0x2a2a, 0x2a5d,
+    0x2a90, 0x2ac4, 0x2af9, 0x2b2f, 0x2b66, 0x2b9e, 0x2bd7, 0x2c08,
+    0x2c26, 0x2c44, 0x2c62, 0x2c81, 0x2ca0, 0x2cc0, 0x2ce0, 0x2d01,
+    0x2d22, 0x2d44, 0x2d66, 0x2d89, 0x2dad, 0x2dd0, 0x2df5, 0x2e1a,
+    0x2e3f, 0x2e65, 0x2e8b, 0x2eb2, 0x2ed9, 0x2f01, 0x2f2a, 0x2f53,
+    0x2f7c, 0x2fa7, 0x2fd1, 0x2ffc, 0x3014, 0x302a, 0x3040, 0x3057,
+    0x306e, 0x3085, 0x309d, 0x30b4, 0x30cc, 0x30e5, 0x30fd, 0x3116,
+    0x312f, 0x3149, 0x3162, 0x317c, 0x3197, 0x31b1, 0x31cc, 0x31e7,
+    0x3203, 0x321e, 0x323a, 0x3257, 0x3273, 0x3290, 0x32ad, 0x32cb,
+    0x32e8, 0x3306, 0x3325, 0x3343, 0x3362, 0x3381, 0x33a1, 0x33c1,
+    0x33e1, 0x3401, 0x3411, 0x3422, 0x3432, 0x3443, 0x3454, 0x3465,
+    0x3476, 0x3488, 0x3499, 0x34ab, 0x34bd, 0x34cf, 0x34e1, 0x34f4,
+    0x3506, 0x3519, 0x352c, 0x353f, 0x3552, 0x3565, 0x3578, 0x358c,
+    0x35a0, 0x35b4, 0x35c8, 0x35dc, 0x35f1, 0x3605, 0x361a, 0x362f,
+    0x3644, 0x3659, 0x366f, 0x3684, 0x369a, 0x36b0, 0x36c6, 0x36dc,
+    0x36f2, 0x3709, 0x3720, 0x3736, 0x374d, 0x3765, 0x377c, 0x3794,
+    0x37ab, 0x37c3, 0x37db, 0x37f3, 0x3806, 0x3812, 0x381f, 0x382b,
+    0x3838, 0x3844, 0x3851, 0x385e, 0x386b, 0x3877, 0x3885, 0x3892,
+    0x389f, 0x38ac, 0x38ba, 0x38c7, 0x38d5, 0x38e2, 0x38f0, 0x38fe,
+    0x390c, 0x391a, 0x3928, 0x3936, 0x3944, 0x3953, 0x3961, 0x3970,
+    0x397e, 0x398d, 0x399c, 0x39ab, 0x39ba, 0x39c9, 0x39d8, 0x39e7,
+    0x39f7, 0x3a06, 0x3a16, 0x3a25, 0x3a35, 0x3a45, 0x3a55, 0x3a65,
+    0x3a75, 0x3a85, 0x3a95, 0x3aa5, 0x3ab6, 0x3ac6, 0x3ad7, 0x3ae8,
+    0x3af9, 0x3b09, 0x3b1a, 0x3b2c, 0x3b3d, 0x3b4e, 0x3b5f, 0x3b71,
+    0x3b82, 0x3b94, 0x3ba6, 0x3bb8, 0x3bca, 0x3bdc, 0x3bee, 0x3c00,
+};
 
 struct cem_range {
     uint8_t max;
@@ -195,6 +524,45 @@ static void unpack_quint_block(int n, uint32_t in, uint8_t *out)
     out[2] = (q2 << n) | m2;
 }
 
+/**
+ * For encoding trits: the 8 bits which unpack_trit_block(0, ...) unpacks to
+ * each t0 + t1*3 + t2*3^2 + t3*3^3 + t4*3^4. Where several bit patterns
+ * unpack to the same trits, this is the lowest.
+ */
+static const uint8_t trit_encode_table[243] = {
+      0,   1,   2,   4,   5,   6,   8,   9,  10,  16,  17,  18,  20,  21,  22,  24,
+     25,  26,   3,   7,  11,  19,  23,  27,  12,  13,  14,  32,  33,  34,  36,  37,
+     38,  40,  41,  42,  48,  49,  50,  52,  53,  54,  56,  57,  58,  35,  39,  43,
+     51,  55,  59,  44,  45,  46,  64,  65,  66,  68,  69,  70,  72,  73,  74,  80,
+     81,  82,  84,  85,  86,  88,  89,  90,  67,  71,  75,  83,  87,  91,  76,  77,
+     78, 128, 129, 130, 132, 133, 134, 136, 137, 138, 144, 145, 146, 148, 149, 150,
+    152, 153, 154, 131, 135, 139, 147, 151, 155, 140, 141, 142, 160, 161, 162, 164,
+    165, 166, 168, 169, 170, 176, 177, 178, 180, 181, 182, 184, 185, 186, 163, 167,
+    171, 179, 183, 187, 172, 173, 174, 192, 193, 194, 196, 197, 198, 200, 201, 202,
+    208, 209, 210, 212, 213, 214, 216, 217, 218, 195, 199, 203, 211, 215, 219, 204,
+    205, 206,  96,  97,  98, 100, 101, 102, 104, 105, 106, 112, 113, 114, 116, 117,
+    118, 120, 121, 122,  99, 103, 107, 115, 119, 123, 108, 109, 110, 224, 225, 226,
+    228, 229, 230, 232, 233, 234, 240, 241, 242, 244, 245, 246, 248, 249, 250, 227,
+    231, 235, 243, 247, 251, 236, 237, 238,  28,  29,  30,  60,  61,  62,  92,  93,
+     94, 156, 157, 158, 188, 189, 190, 220, 221, 222,  31,  63,  95, 159, 191, 223,
+    124, 125, 126,
+};
+
+/**
+ * For encoding quints: the 7 bits which unpack_quint_block(0, ...) unpacks
+ * to each q0 + q1*5 + q2*5^2, choosing the lowest like trit_encode_table
+ */
+static const uint8_t quint_encode_table[125] = {
+      0,   1,   2,   3,   4,   8,   9,  10,  11,  12,  16,  17,  18,  19,  20,  24,
+     25,  26,  27,  28,   5,  13,  21,  29,   6,  32,  33,  34,  35,  36,  40,  41,
+     42,  43,  44,  48,  49,  50,  51,  52,  56,  57,  58,  59,  60,  37,  45,  53,
+     61,  14,  64,  65,  66,  67,  68,  72,  73,  74,  75,  76,  80,  81,  82,  83,
+     84,  88,  89,  90,  91,  92,  69,  77,  85,  93,  22,  96,  97,  98,  99, 100,
+    104, 105, 106, 107, 108, 112, 113, 114, 115, 116, 120, 121, 122, 123, 124, 101,
+    109, 117, 125,  30, 102, 103,  70,  71,  38, 110, 111,  78,  79,  46, 118, 119,
+     86,  87,  54, 126, 127,  94,  95,  62,  39,  47,  55,  63,   7,
+};
+
 
 struct uint8x4_t
 {
@@ -235,6 +603,288 @@ static uint8x4_t blue_contract_clamped(int r, int g, int b, int a)
     return uint8x4_t::clamped((r+b) >> 1, (g+b) >> 1, b, a);
 }
 
+struct uint16x4_t
+{
+    uint16_t v[4];
+
+    uint16x4_t() { }
+
+    uint16x4_t(int a, int b, int c, int d)
+    {
+        ASSERT(0 <= a && a <= 0xffff);
+        ASSERT(0 <= b && b <= 0xffff);
+        ASSERT(0 <= c && c <= 0xffff);
+        ASSERT(0 <= d && d <= 0xffff);
+        v[0] = a;
+        v[1] = b;
+        v[2] = c;
+        v[3] = d;
+    }
+};
+
+static int clamp_hdr(int v)
+{
+    return std::max(0, std::min(0xfff, v));
+}
+
+/**
+ * The HDR endpoint modes all produce 12-bit values, which are shifted up
+ * to 16 bits (with 0 in the low bits) before interpolation.
+ * HDR alpha of 0x780 corresponds to 1.0 after conversion to fp16.
+ */
+static void unpack_hdr_luminance_large_range(int v0, int v1, uint16x4_t &e0, uint16x4_t &e1)
+{
+    int y0, y1;
+    if (v1 >= v0) {
+        y0 = v0 << 4;
+        y1 = v1 << 4;
+    } else {
+        y0 = (v1 << 4) + 8;
+        y1 = (v0 << 4) - 8;
+    }
+    e0 = uint16x4_t(y0 << 4, y0 << 4, y0 << 4, 0x780 << 4);
+    e1 = uint16x4_t(y1 << 4, y1 << 4, y1 << 4, 0x780 << 4);
+}
+
+static void unpack_hdr_luminance_small_range(int v0, int v1, uint16x4_t &e0, uint16x4_t &e1)
+{
+    int y0, d;
+    if (v0 & 0x80) {
+        y0 = ((v1 & 0xe0) << 4) | ((v0 & 0x7f) << 2);
+        d = (v1 & 0x1f) << 2;
+    } else {
+        y0 = ((v1 & 0xf0) << 4) | ((v0 & 0x7f) << 1);
+        d = (v1 & 0x0f) << 1;
+    }
+    int y1 = std::min(0xfff, y0 + d);
+    e0 = uint16x4_t(y0 << 4, y0 << 4, y0 << 4, 0x780 << 4);
+    e1 = uint16x4_t(y1 << 4, y1 << 4, y1 << 4, 0x780 << 4);
+}
+
+static void unpack_hdr_rgb_base_scale(int v0, int v1, int v2, int v3, uint16x4_t &e0, uint16x4_t &e1)
+{
+    int modeval = ((v0 & 0xc0) >> 6) | ((v1 & 0x80) >> 5) | ((v2 & 0x80) >> 4);
+    int majcomp, mode;
+    if ((modeval & 0xc) != 0xc) {
+        majcomp = modeval >> 2;
+        mode = modeval & 3;
+    } else if (modeval != 0xf) {
+        majcomp = modeval & 3;
+        mode = 4;
+    } else {
+        majcomp = 0;
+        mode = 5;
+    }
+
+    int red = v0 & 0x3f;
+    int green = v1 & 0x1f;
+    int blue = v2 & 0x1f;
+    int scale = v3 & 0x1f;
+
+    int x0 = (v1 >> 6) & 1;
+    int x1 = (v1 >> 5) & 1;
+    int x2 = (v2 >> 6) & 1;
+    int x3 = (v2 >> 5) & 1;
+    int x4 = (v3 >> 7) & 1;
+    int x5 = (v3 >> 6) & 1;
+    int x6 = (v3 >> 5) & 1;
+
+    // Bits whose placement depends on the mode
+    int ohm = 1 << mode;
+    if (ohm & 0x30) green |= x0 << 6;
+    if (ohm & 0x3a) green |= x1 << 5;
+    if (ohm & 0x30) blue |= x2 << 6;
+    if (ohm & 0x3a) blue |= x3 << 5;
+    if (ohm & 0x3d) scale |= x6 << 5;
+    if (ohm & 0x2d) scale |= x5 << 6;
+    if (ohm & 0x04) scale |= x4 << 7;
+    if (ohm & 0x3b) red |= x4 << 6;
+    if (ohm & 0x04) red |= x3 << 6;
+    if (ohm & 0x10) red |= x5 << 7;
+    if (ohm & 0x0f) red |= x2 << 7;
+    if (ohm & 0x05) red |= x1 << 8;
+    if (ohm & 0x0a) red |= x0 << 8;
+    if (ohm & 0x05) red |= x0 << 9;
+    if (ohm & 0x02) red |= x6 << 9;
+    if (ohm & 0x01) red |= x3 << 10;
+    if (ohm & 0x02) red |= x5 << 10;
+
+    static const int shamts[6] = { 1, 1, 2, 3, 4, 5 };
+    int shamt = shamts[mode];
+    red <<= shamt;
+    green <<= shamt;
+    blue <<= shamt;
+    scale <<= shamt;
+
+    // Green and blue are stored relative to red, except in mode 5
+    if (mode != 5) {
+        green = red - green;
+        blue = red - blue;
+    }
+
+    if (majcomp == 1)
+        std::swap(red, green);
+    else if (majcomp == 2)
+        std::swap(red, blue);
+
+    e0 = uint16x4_t(clamp_hdr(red - scale) << 4, clamp_hdr(green - scale) << 4, clamp_hdr(blue - scale) << 4, 0x780 << 4);
+    e1 = uint16x4_t(clamp_hdr(red) << 4, clamp_hdr(green) << 4, clamp_hdr(blue) << 4, 0x780 << 4);
+}
+
+static void unpack_hdr_rgb(int v0, int v1, int v2, int v3, int v4, int v5, uint16x4_t &e0, uint16x4_t &e1)
+{
+    int majcomp = ((v4 & 0x80) >> 7) | ((v5 & 0x80) >> 6);
+
+    if (majcomp == 3) {
+        e0 = uint16x4_t(v0 << 8, v2 << 8, (v4 & 0x7f) << 9, 0x780 << 4);
+        e1 = uint16x4_t(v1 << 8, v3 << 8, (v5 & 0x7f) << 9, 0x780 << 4);
+        return;
+    }
+
+    int mode = ((v1 & 0x80) >> 7) | ((v2 & 0x80) >> 6) | ((v3 & 0x80) >> 5);
+    int va = v0 | ((v1 & 0x40) << 2);
+    int vb0 = v2 & 0x3f;
+    int vb1 = v3 & 0x3f;
+    int vc = v1 & 0x3f;
+    int vd0 = v4 & 0x7f;
+    int vd1 = v5 & 0x7f;
+
+    int x0 = (v2 >> 6) & 1;
+    int x1 = (v3 >> 6) & 1;
+    int x2 = (v4 >> 6) & 1;
+    int x3 = (v5 >> 6) & 1;
+    int x4 = (v4 >> 5) & 1;
+    int x5 = (v5 >> 5) & 1;
+
+    // Bits whose placement depends on the mode
+    int ohm = 1 << mode;
+    if (ohm & 0xa4) va |= x0 << 9;
+    if (ohm & 0x08) va |= x2 << 9;
+    if (ohm & 0x50) va |= x4 << 9;
+    if (ohm & 0x50) va |= x5 << 10;
+    if (ohm & 0xa0) va |= x1 << 10;
+    if (ohm & 0xc0) va |= x2 << 11;
+    if (ohm & 0x04) vc |= x1 << 6;
+    if (ohm & 0xe8) vc |= x3 << 6;
+    if (ohm & 0x20) vc |= x2 << 7;
+    if (ohm & 0x5b) vb0 |= x0 << 6;
+    if (ohm & 0x5b) vb1 |= x1 << 6;
+    if (ohm & 0x12) vb0 |= x2 << 7;
+    if (ohm & 0x12) vb1 |= x3 << 7;
+
+    // vd0/vd1 are signed, with a mode-dependent number of bits
+    static const int dbits_table[8] = { 7, 6, 7, 6, 5, 6, 5, 6 };
+    int dbits = dbits_table[mode];
+    vd0 &= (1 << dbits) - 1;
+    vd1 &= (1 << dbits) - 1;
+    if (vd0 & (1 << (dbits - 1)))
+        vd0 -= 1 << dbits;
+    if (vd1 & (1 << (dbits - 1)))
+        vd1 -= 1 << dbits;
+
+    int shamt = (mode >> 1) ^ 3;
+    va <<= shamt;
+    vb0 <<= shamt;
+    vb1 <<= shamt;
+    vc <<= shamt;
+    vd0 *= 1 << shamt;
+    vd1 *= 1 << shamt;
+
+    int r1 = clamp_hdr(va);
+    int g1 = clamp_hdr(va - vb0);
+    int b1 = clamp_hdr(va - vb1);
+    int r0 = clamp_hdr(va - vc);
+    int g0 = clamp_hdr(va - vb0 - vc - vd0);
+    int b0 = clamp_hdr(va - vb1 - vc - vd1);
+
+    if (majcomp == 1) {
+        std::swap(r0, g0);
+        std::swap(r1, g1);
+    } else if (majcomp == 2) {
+        std::swap(r0, b0);
+        std::swap(r1, b1);
+    }
+
+    e0 = uint16x4_t(r0 << 4, g0 << 4, b0 << 4, 0x780 << 4);
+    e1 = uint16x4_t(r1 << 4, g1 << 4, b1 << 4, 0x780 << 4);
+}
+
+static void unpack_hdr_alpha(int v6, int v7, uint16x4_t &e0, uint16x4_t &e1)
+{
+    int selector = ((v6 >> 7) & 1) | ((v7 >> 6) & 2);
+    v6 &= 0x7f;
+    v7 &= 0x7f;
+
+    int a0, a1;
+    if (selector == 3) {
+        a0 = v6 << 5;
+        a1 = v7 << 5;
+    } else {
+        v6 |= (v7 << (selector + 1)) & 0x780;
+        v7 &= (0x3f >> selector);
+        v7 ^= 32 >> selector;
+        v7 -= 32 >> selector;
+        v6 <<= (4 - selector);
+        v7 *= 1 << (4 - selector);
+        v7 += v6;
+        a0 = v6;
+        a1 = clamp_hdr(v7);
+    }
+
+    e0.v[3] = a0 << 4;
+    e1.v[3] = a1 << 4;
+}
+
+/**
+ * Convert n interpolated HDR values from ASTC's pseudo-logarithmic
+ * representation into fp16 bit patterns. (Infinities are clamped to the
+ * largest finite fp16 value.)
+ */
+static void lns_to_fp16(const uint16_t *in, uint16_t *out, int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i mask_m = _mm_set1_epi16(0x7ff);
+    const __m128i c_511 = _mm_set1_epi16(511);
+    const __m128i c_1535 = _mm_set1_epi16(1535);
+    const __m128i c_512 = _mm_set1_epi16(512);
+    const __m128i c_2048 = _mm_set1_epi16(2048);
+    const __m128i max_finite = _mm_set1_epi16(0x7bff);
+    for (; i + 8 <= n; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)&in[i]);
+        __m128i e = _mm_srli_epi16(c, 11);
+        __m128i m = _mm_and_si128(c, mask_m);
+
+        __m128i m3 = _mm_add_epi16(m, _mm_add_epi16(m, m));
+        __m128i m4 = _mm_sub_epi16(_mm_slli_epi16(m, 2), c_512);
+        __m128i m5 = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(m, 2), m), c_2048);
+
+        __m128i lo = _mm_cmpgt_epi16(m, c_511); // m >= 512
+        __m128i hi = _mm_cmpgt_epi16(m, c_1535); // m >= 1536
+        __m128i mt = _mm_or_si128(_mm_andnot_si128(lo, m3), _mm_and_si128(lo, m4));
+        mt = _mm_or_si128(_mm_andnot_si128(hi, mt), _mm_and_si128(hi, m5));
+
+        __m128i r = _mm_add_epi16(_mm_slli_epi16(e, 10), _mm_srli_epi16(mt, 3));
+        r = _mm_min_epi16(r, max_finite);
+        _mm_storeu_si128((__m128i *)&out[i], r);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        int e = in[i] >> 11;
+        int m = in[i] & 0x7ff;
+        int mt;
+        if (m < 512)
+            mt = 3 * m;
+        else if (m >= 1536)
+            mt = 5 * m - 2048;
+        else
+            mt = 4 * m - 512;
+        out[i] = std::min(0x7bff, (e << 10) + (mt >> 3));
+    }
+}
+
 static void bit_transfer_signed(int &a, int &b)
 {
     b >>= 1;
@@ -498,10 +1148,25 @@ struct OutputBitVector
             append(v.data[i] & ((1 << size) - 1), size);
     }
 
+    // Insert the first 'size' bits of v in reverse order at the end of the
+    // block, so bit i of v becomes bit 127-i
     void append_end(OutputBitVector &v, int size)
     {
-        for (int i = 0; i < size; ++i)
-            data[(127 - i) >> 5] |= ((v.data[i >> 5] >> (i & 31)) & 1) << ((127 - i) & 31);
+        for (int i = 0; i < 4 && size > 0; ++i, size -= 32) {
+            uint32_t bits = v.data[i];
+            if (size < 32)
+                bits &= (1u << size) - 1;
+            data[3 - i] |= reverse_bits(bits);
+        }
+    }
+
+    static uint32_t reverse_bits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+        v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+        return (v >> 16) | (v << 16);
     }
 
     // Insert the given number of '1' bits. (We could use 0s instead, but 1s are
@@ -525,19 +1190,83 @@ struct OutputBitVector
 class Decoder
 {
 public:
-    Decoder(int block_w, int block_h, int block_d);
+    Decoder(int block_w, int block_h, int block_d, decode_profile profile = decode_profile::ldr);
 
+    /**
+     * Decode a 16-byte block into block_w*block_h*block_d RGBA fp16 texels,
+     * using the decoder's profile or the given one. In the sRGB profile the
+     * RGB channels are converted to linear.
+     */
     decode_error decode(const uint8_t *in, fp16 *output) const;
+    decode_error decode(const uint8_t *in, fp16 *output, decode_profile profile) const;
+
+    /**
+     * Decode a 16-byte block into RGBA unorm8 texels. In the sRGB profile
+     * the output is sRGB-encoded (i.e. suitable for an SRGB8_ALPHA8 texture).
+     */
+    decode_error decode_unorm8(const uint8_t *in, uint8_t *output) const;
+    decode_error decode_unorm8(const uint8_t *in, uint8_t *output, decode_profile profile) const;
+
+    /**
+     * Precompute the partition assignment of every texel for every
+     * partition index and partition count, so decoding doesn't have to
+     * call select_partition() per texel. This is a few hundred KB for
+     * the larger (especially 3D) block sizes, so it's opt-in.
+     */
+    void build_partition_table();
+
+    /**
+     * Returns the partition (0..num_parts-1) that the texel at 'idx'
+     * (in x-major order within the block) belongs to.
+     */
+    int texel_partition(int partition_index, int num_parts, int idx) const;
 
     int block_w, block_h, block_d;
+    decode_profile profile;
 
 private:
     friend class Block;
+
+    int num_texels;
+    bool small_block;
+
+    // [num_parts-2][partition_index][texel]
+    std::vector<uint8_t> partition_table;
 };
 
-Decoder::Decoder(int block_w, int block_h, int block_d)
-  : block_w(block_w), block_h(block_h), block_d(block_d)
+Decoder::Decoder(int block_w, int block_h, int block_d, decode_profile profile)
+  : block_w(block_w), block_h(block_h), block_d(block_d), profile(profile)
 {
+    num_texels = block_w * block_h * block_d;
+    small_block = num_texels < 31;
+}
+
+void Decoder::build_partition_table()
+{
+    partition_table.resize(3 * 1024 * num_texels);
+    uint8_t *p = partition_table.data();
+    for (int num_parts = 2; num_parts <= 4; ++num_parts) {
+        for (int seed = 0; seed < 1024; ++seed) {
+            for (int z = 0; z < block_d; ++z)
+                for (int y = 0; y < block_h; ++y)
+                    for (int x = 0; x < block_w; ++x)
+                        *p++ = select_partition(seed, x, y, z, num_parts, small_block);
+        }
+    }
+}
+
+int Decoder::texel_partition(int partition_index, int num_parts, int idx) const
+{
+    if (num_parts == 1)
+        return 0;
+
+    if (!partition_table.empty())
+        return partition_table[((num_parts - 2) * 1024 + partition_index) * num_texels + idx];
+
+    int x = idx % block_w;
+    int y = (idx / block_w) % block_h;
+    int z = idx / (block_w * block_h);
+    return select_partition(partition_index, x, y, z, num_parts, small_block);
 }
 
 class Encoder
@@ -546,78 +1275,47 @@ public:
     Encoder(int block_w, int block_h, int block_d);
 
     int block_w, block_h, block_d;
-    uint8_t trit_lookup[243];
-    uint8_t quint_lookup[125];
-
-private:
-    void compute_trit_lookup();
-    void compute_quint_lookup();
 };
 
 Encoder::Encoder(int block_w, int block_h, int block_d)
   : block_w(block_w), block_h(block_h), block_d(block_d)
 {
-    compute_trit_lookup();
-    compute_quint_lookup();
-}
-
-void Encoder::compute_trit_lookup()
-{
-    // Compute lookup table for fast encoding of trits
-
-    std::vector<std::pair<int, int>> vals(256);
-
-    for (int p = 0; p < 256; ++p) {
-        uint8_t v[5];
-        unpack_trit_block(0, p, v);
-        int c = v[0] + v[1]*3 + v[2]*(3*3) + v[3]*(3*3*3) + v[4]*(3*3*3*3);
-        vals[p] = std::make_pair(c, p);
-    }
-
-    std::sort(vals.begin(), vals.end());
-
-    size_t idx = 0;
-    for (size_t i = 0; i < vals.size(); ++i) {
-        int c = vals[i].first;
-        int p = vals[i].second;
-
-        // Ignore all but the first occurrence of each value
-        if (i > 0 && vals[i-1].first == c)
-            continue;
-
-        trit_lookup[idx++] = p;
-    }
-    ASSERT(idx == 243);
 }
 
-void Encoder::compute_quint_lookup()
+/**
+ * The nearest quantised value (and what it unquantises to) for every
+ * unquantised weight and colour endpoint value, in every range, so encoders
+ * can quantise with a single lookup. The tables are built once, from Block's
+ * own unquantisation, so they always agree with the decoder.
+ */
+class QuantisationTables
 {
-    // Compute lookup table for fast encoding of quints
-
-    std::vector<std::pair<int, int>> vals(256);
+public:
+    struct entry
+    {
+        uint8_t quant; // the nearest quantised value (the lowest, if two are equally near)
+        uint8_t unquant; // what the decoder unquantises it to
+    };
 
-    for (int p = 0; p < 256; ++p) {
-        uint8_t v[3];
-        unpack_quint_block(0, p, v);
-        int c = v[0] + v[1]*5 + v[2]*(5*5);
-        vals[p] = std::make_pair(c, p);
-    }
+    /**
+     * Returns the tables, building them on first use. Safe to call from
+     * multiple threads.
+     */
+    static const QuantisationTables &get();
 
-    std::sort(vals.begin(), vals.end());
+    // Indexed by [high_prec][wt_range][weight 0..64]
+    entry weights[2][8][65];
 
-    size_t idx = 0;
-    for (size_t i = 0; i < vals.size(); ++i) {
-        int c = vals[i].first;
-        int p = vals[i].second;
+    // Indexed by [index into cem_ranges][endpoint value 0..255]
+    entry endpoints[ARRAY_SIZE(cem_ranges)][256];
 
-        // Ignore all but the first occurrence of each value
-        if (i > 0 && vals[i-1].first == c)
-            continue;
+    // The reverse mappings, indexed by quantised value
+    uint8_t weights_unquant[2][8][32];
+    uint8_t endpoints_unquant[ARRAY_SIZE(cem_ranges)][256];
 
-        quint_lookup[idx++] = p;
-    }
-    ASSERT(idx == 125);
-}
+private:
+    QuantisationTables();
+};
 
 struct Block
 {
@@ -639,6 +1337,8 @@ struct Block
     int void_extent_max_s;
     int void_extent_min_t;
     int void_extent_max_t;
+    int void_extent_min_p;
+    int void_extent_max_p;
     uint16_t void_extent_colour_r;
     uint16_t void_extent_colour_g;
     uint16_t void_extent_colour_b;
@@ -657,7 +1357,7 @@ struct Block
     uint8_t weights_quant[64 + 4]; // max 64 values, plus padding for overflows in trit parsing
 
     // Calculated by unquantise_weights():
-    uint8_t weights[64 + 18]; // max 64 values, plus padding for the infill interpolation
+    uint8_t weights[64 + 42]; // max 64 values, plus padding for the infill interpolation (3D reads further past the end)
 
     // Calculated by unpack_colour_endpoints():
     uint8_t colour_endpoints_quant[18 + 4]; // max 18 values, plus padding for overflows in trit parsing
@@ -689,6 +1389,13 @@ struct Block
     // Calculated by decode_colour_endpoints();
     uint8x4_t endpoints_decoded[2][4];
 
+    // Calculated by decode_colour_endpoints(), for partitions using the HDR
+    // endpoint modes (which are decoded to the error colour in
+    // endpoints_decoded, as the LDR profile requires):
+    uint16x4_t endpoints_hdr[2][4];
+    bool hdr_rgb[4];
+    bool hdr_alpha[4];
+
     void print()
     {
         printf("high_prec=%d dual_plane=%d ccs=%d wt_range=%d wt=%dx%dx%d num_parts=%d part_idx=%d\n",
@@ -720,33 +1427,56 @@ struct Block
     void unquantise_colour_endpoints();
 
     OutputBitVector encode(const Encoder &encoder);
+    OutputBitVector encode_void_extent(const Encoder &encoder);
     uint32_t encode_block_mode();
-    static OutputBitVector encode_sequence_trits(const Encoder &encoder, uint8_t *data, int count, int bits);
-    static OutputBitVector encode_sequence_quints(const Encoder &encoder, uint8_t *data, int count, int bits);
+    uint32_t encode_block_mode_3d();
+    static OutputBitVector encode_sequence_trits(uint8_t *data, int count, int bits);
+    static OutputBitVector encode_sequence_quints(uint8_t *data, int count, int bits);
     static OutputBitVector encode_sequence_bits(uint8_t *data, int count, int bits);
 
     decode_error decode(const Decoder &decoder, InputBitVector in);
+    decode_error decode(const Decoder &decoder, InputBitVector in, decode_profile profile);
+
+    /**
+     * Decode and validate everything except the colour endpoints and
+     * weights: the block mode (or void extent), partitions, endpoint modes
+     * and their ranges. Returns the same error as decode() would.
+     */
+    decode_error decode_header(const Decoder &decoder, InputBitVector in, decode_profile profile);
 
     decode_error decode_block_mode(InputBitVector in);
+    decode_error decode_block_mode_3d(InputBitVector in);
     decode_error decode_void_extent(InputBitVector in);
+    decode_error decode_void_extent_3d(InputBitVector in);
     void decode_cem(InputBitVector in);
     void unpack_colour_endpoints(InputBitVector in);
     void decode_colour_endpoints();
     void unpack_weights(InputBitVector in);
     void compute_infill_weights(int block_w, int block_h, int block_d);
 
-    void write_decoded(const Decoder &decoder, fp16 *output);
+    void interpolate(const Decoder &decoder, decode_profile profile, uint16_t *output, bool *is_lns);
+    void write_decoded(const Decoder &decoder, decode_profile profile, fp16 *output);
+    void write_decoded_hdr(const Decoder &decoder, fp16 *output);
+    void write_decoded_unorm8(const Decoder &decoder, decode_profile profile, uint8_t *output);
 };
 
 
 decode_error Decoder::decode(const uint8_t *in, fp16 *output) const
+{
+    return decode(in, output, profile);
+}
+
+decode_error Decoder::decode(const uint8_t *in, fp16 *output, decode_profile profile) const
 {
     Block blk;
     InputBitVector in_vec;
     memcpy(&in_vec.data, in, 16);
-    decode_error err = blk.decode(*this, in_vec);
+    decode_error err = blk.decode(*this, in_vec, profile);
+    count_decode_error(err);
     if (err == decode_error::ok) {
-        blk.write_decoded(*this, output);
+        DecodeStageTimer timer;
+        blk.write_decoded(*this, profile, output);
+        timer.mark(decode_stage::write_decoded);
     } else {
         // Fill output with the error colour
         for (int i = 0; i < block_w * block_h * block_d; ++i) {
@@ -757,11 +1487,35 @@ decode_error Decoder::decode(const uint8_t *in, fp16 *output) const
     return err;
 }
 
+decode_error Decoder::decode_unorm8(const uint8_t *in, uint8_t *output) const
+{
+    return decode_unorm8(in, output, profile);
+}
 
-decode_error Block::decode_void_extent(InputBitVector block)
+decode_error Decoder::decode_unorm8(const uint8_t *in, uint8_t *output, decode_profile profile) const
 {
-    // TODO: 3D
+    Block blk;
+    InputBitVector in_vec;
+    memcpy(&in_vec.data, in, 16);
+    decode_error err = blk.decode(*this, in_vec, profile);
+    count_decode_error(err);
+    if (err == decode_error::ok) {
+        DecodeStageTimer timer;
+        blk.write_decoded_unorm8(*this, profile, output);
+        timer.mark(decode_stage::write_decoded);
+    } else {
+        // Fill output with the error colour
+        for (int i = 0; i < block_w * block_h * block_d; ++i) {
+            output[i*4] = output[i*4+2] = output[i*4+3] = 0xff;
+            output[i*4+1] = 0x00;
+        }
+    }
+    return err;
+}
+
 
+decode_error Block::decode_void_extent(InputBitVector block)
+{
     is_void_extent = true;
     void_extent_d = block.get_bits(9, 1);
     void_extent_min_s = block.get_bits(12, 13);
@@ -775,10 +1529,6 @@ decode_error Block::decode_void_extent(InputBitVector block)
 
     // TODO: maybe we should do something useful with the extent coordinates?
 
-    if (void_extent_d) {
-        return decode_error::unsupported_hdr_void_extent;
-    }
-
     if (void_extent_min_s == 0x1fff && void_extent_max_s == 0x1fff
         && void_extent_min_t == 0x1fff && void_extent_max_t == 0x1fff) {
 
@@ -792,7 +1542,39 @@ decode_error Block::decode_void_extent(InputBitVector block)
         }
     }
 
-    // TODO: sRGB
+    return decode_error::ok;
+}
+
+decode_error Block::decode_void_extent_3d(InputBitVector block)
+{
+    is_void_extent = true;
+    void_extent_d = block.get_bits(9, 1);
+    void_extent_min_s = block.get_bits(10, 9);
+    void_extent_max_s = block.get_bits(19, 9);
+    void_extent_min_t = block.get_bits(28, 9);
+    void_extent_max_t = block.get_bits(37, 9);
+    void_extent_min_p = block.get_bits(46, 9);
+    void_extent_max_p = block.get_bits(55, 9);
+    void_extent_colour_r = block.get_bits(64, 16);
+    void_extent_colour_g = block.get_bits(80, 16);
+    void_extent_colour_b = block.get_bits(96, 16);
+    void_extent_colour_a = block.get_bits(112, 16);
+
+    if (void_extent_min_s == 0x1ff && void_extent_max_s == 0x1ff
+        && void_extent_min_t == 0x1ff && void_extent_max_t == 0x1ff
+        && void_extent_min_p == 0x1ff && void_extent_max_p == 0x1ff) {
+
+        // No extents
+
+    } else {
+
+        // Check for illegal encoding
+        if (void_extent_min_s >= void_extent_max_s
+            || void_extent_min_t >= void_extent_max_t
+            || void_extent_min_p >= void_extent_max_p) {
+            return decode_error::invalid_range_in_void_extent;
+        }
+    }
 
     return decode_error::ok;
 }
@@ -901,6 +1683,84 @@ decode_error Block::decode_block_mode(InputBitVector in)
     return decode_error::ok;
 }
 
+decode_error Block::decode_block_mode_3d(InputBitVector in)
+{
+    dual_plane = in.get_bits(10, 1);
+    high_prec = in.get_bits(9, 1);
+
+    if (in.get_bits(0, 2) != 0x0) {
+        if (VERBOSE_DECODE)
+            in.printf_bits(0, 11, "DHBBAARCCRR");
+        wt_range = (in.get_bits(0, 2) << 1) | in.get_bits(4, 1);
+        wt_w = in.get_bits(5, 2) + 2;
+        wt_h = in.get_bits(7, 2) + 2;
+        wt_d = in.get_bits(2, 2) + 2;
+    } else {
+        if (in.get_bits(5, 4) == 0xf) {
+            if (in.get_bits(0, 9) == 0x1fc) {
+                if (VERBOSE_DECODE)
+                    in.printf_bits(0, 11, "xx111111100 (void extent)");
+                return decode_void_extent_3d(in);
+            } else {
+                if (VERBOSE_DECODE)
+                    in.printf_bits(0, 11, "xx1111xxx00");
+                return decode_error::reserved_block_mode_1;
+            }
+        }
+        if (in.get_bits(0, 4) == 0x0) {
+            if (VERBOSE_DECODE)
+                in.printf_bits(0, 11, "xxxxxxx0000");
+            return decode_error::reserved_block_mode_2;
+        }
+
+        wt_range = in.get_bits(1, 3) | in.get_bits(4, 1);
+        int a = in.get_bits(5, 2);
+        int b = in.get_bits(9, 2);
+
+        switch (in.get_bits(7, 2)) {
+        case 0b00:
+            if (VERBOSE_DECODE)
+                in.printf_bits(0, 11, "BB00AARRR00");
+            wt_w = 6;
+            wt_h = b + 2;
+            wt_d = a + 2;
+            dual_plane = 0;
+            high_prec = 0;
+            break;
+        case 0b01:
+            if (VERBOSE_DECODE)
+                in.printf_bits(0, 11, "BB01AARRR00");
+            wt_w = a + 2;
+            wt_h = 6;
+            wt_d = b + 2;
+            dual_plane = 0;
+            high_prec = 0;
+            break;
+        case 0b10:
+            if (VERBOSE_DECODE)
+                in.printf_bits(0, 11, "BB10AARRR00");
+            wt_w = a + 2;
+            wt_h = b + 2;
+            wt_d = 6;
+            dual_plane = 0;
+            high_prec = 0;
+            break;
+        case 0b11:
+            if (VERBOSE_DECODE)
+                in.printf_bits(0, 11, "DH11AARRR00");
+            wt_w = wt_h = wt_d = 2;
+            switch (a) {
+            case 0: wt_w = 6; break;
+            case 1: wt_h = 6; break;
+            case 2: wt_d = 6; break;
+            default: UNREACHABLE(); // handled by the void extent check
+            }
+            break;
+        }
+    }
+    return decode_error::ok;
+}
+
 void Block::decode_cem(InputBitVector in)
 {
     cems[0] = cems[1] = cems[2] = cems[3] = -1;
@@ -1095,6 +1955,8 @@ void Block::decode_colour_endpoints()
         uint8x4_t e0, e1;
         int s0, s1, L0, L1;
 
+        hdr_rgb[part] = hdr_alpha[part] = false;
+
         switch (cems[part])
         {
         case 0:
@@ -1175,7 +2037,7 @@ void Block::decode_colour_endpoints()
             }
             break;
         default:
-            // HDR endpoints not supported; return error colour
+            // HDR endpoints (handled below); LDR profile returns error colour
             e0 = uint8x4_t(255, 0, 255, 255);
             e1 = uint8x4_t(255, 0, 255, 255);
             break;
@@ -1184,6 +2046,50 @@ void Block::decode_colour_endpoints()
         endpoints_decoded[0][part] = e0;
         endpoints_decoded[1][part] = e1;
 
+        uint16x4_t h0, h1;
+        switch (cems[part])
+        {
+        case 2:
+            unpack_hdr_luminance_large_range(v0, v1, h0, h1);
+            hdr_rgb[part] = hdr_alpha[part] = true;
+            break;
+        case 3:
+            unpack_hdr_luminance_small_range(v0, v1, h0, h1);
+            hdr_rgb[part] = hdr_alpha[part] = true;
+            break;
+        case 7:
+            unpack_hdr_rgb_base_scale(v0, v1, v2, v3, h0, h1);
+            hdr_rgb[part] = hdr_alpha[part] = true;
+            break;
+        case 11:
+            unpack_hdr_rgb(v0, v1, v2, v3, v4, v5, h0, h1);
+            hdr_rgb[part] = hdr_alpha[part] = true;
+            break;
+        case 14:
+            // LDR alpha, expanded to 16 bits the same way as LDR endpoints
+            unpack_hdr_rgb(v0, v1, v2, v3, v4, v5, h0, h1);
+            h0.v[3] = (v6 << 8) | v6;
+            h1.v[3] = (v7 << 8) | v7;
+            hdr_rgb[part] = true;
+            break;
+        case 15:
+            unpack_hdr_rgb(v0, v1, v2, v3, v4, v5, h0, h1);
+            unpack_hdr_alpha(v6, v7, h0, h1);
+            hdr_rgb[part] = hdr_alpha[part] = true;
+            break;
+        }
+
+        if (hdr_rgb[part]) {
+            endpoints_hdr[0][part] = h0;
+            endpoints_hdr[1][part] = h1;
+
+            if (VERBOSE_DECODE) {
+                printf("cems[%d]=%d hdr e0=[%5d,%5d,%5d,%5d] e1=[%5d,%5d,%5d,%5d]\n", part, cems[part],
+                        h0.v[0], h0.v[1], h0.v[2], h0.v[3],
+                        h1.v[0], h1.v[1], h1.v[2], h1.v[3]);
+            }
+        }
+
         if (VERBOSE_DECODE) {
             printf("cems[%d]=%d v=[", part, cems[part]);
             for (int i = 0; i < (cems[part] >> 2) + 1; ++i) {
@@ -1371,9 +2277,53 @@ void Block::compute_infill_weights(int block_w, int block_h, int block_d)
                 int jr = gr >> 4;
                 int fr = gr & 0xf;
 
-                // TODO: 3D
-                (void)jr;
-                (void)fr;
+                if (block_d > 1) {
+                    // 3D blocks use simplex interpolation: pick the 4 corners
+                    // of the weight grid cell that form the tetrahedron
+                    // containing the sample point
+                    int stride = 1 + dual_plane;
+                    int v0 = js + jt * wt_w + jr * wt_w * wt_h;
+                    int os = 1;
+                    int ot = wt_w;
+                    int orr = wt_w * wt_h;
+                    int o1, o2, w0, w1, w2, w3;
+                    if (fs > ft) {
+                        if (ft > fr) {
+                            o1 = os; o2 = os + ot;
+                            w0 = 16 - fs; w1 = fs - ft; w2 = ft - fr; w3 = fr;
+                        } else if (fs > fr) {
+                            o1 = os; o2 = os + orr;
+                            w0 = 16 - fs; w1 = fs - fr; w2 = fr - ft; w3 = ft;
+                        } else {
+                            o1 = orr; o2 = os + orr;
+                            w0 = 16 - fr; w1 = fr - fs; w2 = fs - ft; w3 = ft;
+                        }
+                    } else {
+                        if (fs > fr) {
+                            o1 = ot; o2 = os + ot;
+                            w0 = 16 - ft; w1 = ft - fs; w2 = fs - fr; w3 = fr;
+                        } else if (ft > fr) {
+                            o1 = ot; o2 = ot + orr;
+                            w0 = 16 - ft; w1 = ft - fr; w2 = fr - fs; w3 = fs;
+                        } else {
+                            o1 = orr; o2 = ot + orr;
+                            w0 = 16 - fr; w1 = fr - ft; w2 = ft - fs; w3 = fs;
+                        }
+                    }
+                    int o3 = os + ot + orr;
+                    ASSERT((v0 + o3) * stride + dual_plane < ARRAY_SIZE(weights));
+
+                    for (int plane = 0; plane <= dual_plane; ++plane) {
+                        int p0 = weights[v0 * stride + plane];
+                        int p1 = weights[(v0 + o1) * stride + plane];
+                        int p2 = weights[(v0 + o2) * stride + plane];
+                        int p3 = weights[(v0 + o3) * stride + plane];
+                        int i = (p0*w0 + p1*w1 + p2*w2 + p3*w3 + 8) >> 4;
+                        ASSERT(0 <= i && i <= 64);
+                        infill_weights[plane][s + t*block_w + r*block_w*block_h] = i;
+                    }
+                    continue;
+                }
 
                 int w11 = (fs * ft + 8) >> 4;
                 int w10 = ft - w11;
@@ -1527,8 +2477,14 @@ void Block::unquantise_colour_endpoints()
 }
 
 decode_error Block::decode(const Decoder &decoder, InputBitVector in)
+{
+    return decode(decoder, in, decoder.profile);
+}
+
+decode_error Block::decode_header(const Decoder &decoder, InputBitVector in, decode_profile profile)
 {
     decode_error err;
+    DecodeStageTimer timer;
 
     is_error = false;
     bogus_colour_endpoints = false;
@@ -1536,21 +2492,25 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
     is_void_extent = false;
 
     wt_d = 1;
-    // TODO: 3D
 
     // TODO: test for all the illegal encodings
 
     if (VERBOSE_DECODE)
         in.printf_bits(0, 128);
 
-    err = decode_block_mode(in);
+    if (decoder.block_d > 1)
+        err = decode_block_mode_3d(in);
+    else
+        err = decode_block_mode(in);
     if (err != decode_error::ok)
         return err;
 
-    if (is_void_extent)
+    if (is_void_extent) {
+        timer.mark(decode_stage::block_mode);
+        if (void_extent_d && profile != decode_profile::hdr)
+            return decode_error::unsupported_hdr_void_extent;
         return decode_error::ok;
-
-    // TODO: 3D
+    }
 
     calculate_from_weights();
 
@@ -1569,6 +2529,7 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
     if (dual_plane && num_parts > 3)
         return decode_error::dual_plane_and_too_many_partitions;
 
+    timer.mark(decode_stage::block_mode);
     decode_cem(in);
 
     if (VERBOSE_DECODE)
@@ -1587,6 +2548,40 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
                 "endpoint data (%d bits, %d vals, %dt %dq %db)",
                 colour_endpoint_bits, num_cem_values, ce_trits, ce_quints, ce_bits);
 
+    if (num_cem_values > 18)
+        return decode_error::invalid_colour_endpoints_count;
+
+    if (dual_plane) {
+        int ccs_offset = 128 - weight_bits - num_extra_cem_bits - 2;
+        colour_component_selector = in.get_bits(ccs_offset, 2);
+
+        if (VERBOSE_DECODE)
+            in.printf_bits(ccs_offset, 2, "colour component selector = %d", colour_component_selector);
+    } else {
+        colour_component_selector = 0;
+    }
+
+    if (VERBOSE_DECODE)
+        in.printf_bits(128 - weight_bits, weight_bits, "weights (%d bits)", weight_bits);
+
+    if (num_weights > 64)
+        return decode_error::invalid_num_weights;
+
+    if (weight_bits < 24 || weight_bits > 96)
+        return decode_error::invalid_weight_bits;
+
+    timer.mark(decode_stage::cem);
+    return decode_error::ok;
+}
+
+decode_error Block::decode(const Decoder &decoder, InputBitVector in, decode_profile profile)
+{
+    decode_error err = decode_header(decoder, in, profile);
+    if (err != decode_error::ok || is_void_extent)
+        return err;
+
+    DecodeStageTimer timer;
+
     unpack_colour_endpoints(in);
 
     if (VERBOSE_DECODE) {
@@ -1599,9 +2594,7 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
         printf("]\n");
     }
 
-    if (num_cem_values > 18)
-        return decode_error::invalid_colour_endpoints_count;
-
+    timer.mark(decode_stage::unpack_colour_endpoints);
     unquantise_colour_endpoints();
 
     if (VERBOSE_DECODE) {
@@ -1614,31 +2607,15 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
         printf("]\n");
     }
 
+    timer.mark(decode_stage::unquantise_colour_endpoints);
     decode_colour_endpoints();
 
-    if (dual_plane) {
-        int ccs_offset = 128 - weight_bits - num_extra_cem_bits - 2;
-        colour_component_selector = in.get_bits(ccs_offset, 2);
-
-        if (VERBOSE_DECODE)
-            in.printf_bits(ccs_offset, 2, "colour component selector = %d", colour_component_selector);
-    } else {
-        colour_component_selector = 0;
-    }
-
-
-    if (VERBOSE_DECODE)
-        in.printf_bits(128 - weight_bits, weight_bits, "weights (%d bits)", weight_bits);
-
-    if (num_weights > 64)
-        return decode_error::invalid_num_weights;
-
-    if (weight_bits < 24 || weight_bits > 96)
-        return decode_error::invalid_weight_bits;
-
+    timer.mark(decode_stage::decode_colour_endpoints);
     unpack_weights(in);
+    timer.mark(decode_stage::unpack_weights);
 
     unquantise_weights();
+    timer.mark(decode_stage::unquantise_weights);
 
     if (VERBOSE_DECODE) {
         printf("weights=[");
@@ -1666,6 +2643,7 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
     }
 
     compute_infill_weights(decoder.block_w, decoder.block_h, decoder.block_d);
+    timer.mark(decode_stage::infill_weights);
 
     if (VERBOSE_DECODE) {
         for (int plane = 0; plane <= dual_plane; ++plane) {
@@ -1689,51 +2667,44 @@ decode_error Block::decode(const Decoder &decoder, InputBitVector in)
     return decode_error::ok;
 }
 
-void Block::write_decoded(const Decoder &decoder, fp16 *output)
+/**
+ * Compute the 16-bit interpolated RGBA colour of every texel.
+ * Must not be called for void-extent blocks.
+ */
+void Block::interpolate(const Decoder &decoder, decode_profile profile, uint16_t *output, bool *is_lns)
 {
-    if (is_void_extent) {
-        for (int idx = 0; idx < decoder.block_w*decoder.block_h*decoder.block_d; ++idx) {
-            output[idx*4+0] = fp16::from_uint16_div_64k(void_extent_colour_r);
-            output[idx*4+1] = fp16::from_uint16_div_64k(void_extent_colour_g);
-            output[idx*4+2] = fp16::from_uint16_div_64k(void_extent_colour_b);
-            output[idx*4+3] = fp16::from_uint16_div_64k(void_extent_colour_a);
-        }
-        return;
-    }
+    ASSERT(!is_void_extent);
 
-    int small_block = (decoder.block_w * decoder.block_h * decoder.block_d) < 31;
+    // In the sRGB profile, endpoints are expanded with 0x80 in the low bits
+    // instead of being replicated, so that the top 8 bits of the result are
+    // the correctly-rounded sRGB value
+    bool srgb = (profile == decode_profile::ldr_srgb);
 
     int idx = 0;
     for (int z = 0; z < decoder.block_d; ++z) {
         for (int y = 0; y < decoder.block_h; ++y) {
             for (int x = 0; x < decoder.block_w; ++x) {
 
-                int partition;
-                if (num_parts > 1) {
-                    partition = select_partition(partition_index, x, y, z, num_parts, small_block);
-                    ASSERT(partition < num_parts);
+                int partition = decoder.texel_partition(partition_index, num_parts, idx);
+                ASSERT(partition < num_parts);
+
+                uint16_t c0[4], c1[4];
+                if (profile == decode_profile::hdr && hdr_rgb[partition]) {
+                    memcpy(c0, endpoints_hdr[0][partition].v, sizeof(c0));
+                    memcpy(c1, endpoints_hdr[1][partition].v, sizeof(c1));
+                    is_lns[idx*4+0] = is_lns[idx*4+1] = is_lns[idx*4+2] = true;
+                    is_lns[idx*4+3] = hdr_alpha[partition];
                 } else {
-                    partition = 0;
+                    uint8x4_t e0 = endpoints_decoded[0][partition];
+                    uint8x4_t e1 = endpoints_decoded[1][partition];
+                    for (int i = 0; i < 4; ++i) {
+                        c0[i] = (e0.v[i] << 8) | (srgb ? 0x80 : e0.v[i]);
+                        c1[i] = (e1.v[i] << 8) | (srgb ? 0x80 : e1.v[i]);
+                    }
+                    if (is_lns)
+                        is_lns[idx*4+0] = is_lns[idx*4+1] = is_lns[idx*4+2] = is_lns[idx*4+3] = false;
                 }
 
-                // TODO: sRGB
-                // TODO: HDR
-
-                uint8x4_t e0 = endpoints_decoded[0][partition];
-                uint8x4_t e1 = endpoints_decoded[1][partition];
-                uint16_t c0[4] = {
-                        (uint16_t)((e0.v[0] << 8) | e0.v[0]),
-                        (uint16_t)((e0.v[1] << 8) | e0.v[1]),
-                        (uint16_t)((e0.v[2] << 8) | e0.v[2]),
-                        (uint16_t)((e0.v[3] << 8) | e0.v[3]),
-                };
-                uint16_t c1[4] = {
-                        (uint16_t)((e1.v[0] << 8) | e1.v[0]),
-                        (uint16_t)((e1.v[1] << 8) | e1.v[1]),
-                        (uint16_t)((e1.v[2] << 8) | e1.v[2]),
-                        (uint16_t)((e1.v[3] << 8) | e1.v[3]),
-                };
-
                 int w[4];
                 if (dual_plane) {
                     int w0 = infill_weights[0][idx];
@@ -1745,17 +2716,10 @@ void Block::write_decoded(const Decoder &decoder, fp16 *output)
                     w[0] = w[1] = w[2] = w[3] = w0;
                 }
 
-                uint16_t c[4] = {
-                        (uint16_t)((c0[0] * (64 - w[0]) + c1[0] * w[0] + 32) >> 6),
-                        (uint16_t)((c0[1] * (64 - w[1]) + c1[1] * w[1] + 32) >> 6),
-                        (uint16_t)((c0[2] * (64 - w[2]) + c1[2] * w[2] + 32) >> 6),
-                        (uint16_t)((c0[3] * (64 - w[3]) + c1[3] * w[3] + 32) >> 6),
-                };
-
-                output[idx*4+0] = c[0] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[0]);
-                output[idx*4+1] = c[1] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[1]);
-                output[idx*4+2] = c[2] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[2]);
-                output[idx*4+3] = c[3] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[3]);
+                output[idx*4+0] = (c0[0] * (64 - w[0]) + c1[0] * w[0] + 32) >> 6;
+                output[idx*4+1] = (c0[1] * (64 - w[1]) + c1[1] * w[1] + 32) >> 6;
+                output[idx*4+2] = (c0[2] * (64 - w[2]) + c1[2] * w[2] + 32) >> 6;
+                output[idx*4+3] = (c0[3] * (64 - w[3]) + c1[3] * w[3] + 32) >> 6;
 
                 idx++;
             }
@@ -1763,6 +2727,133 @@ void Block::write_decoded(const Decoder &decoder, fp16 *output)
     }
 }
 
+void Block::write_decoded(const Decoder &decoder, decode_profile profile, fp16 *output)
+{
+    int num_texels = decoder.block_w * decoder.block_h * decoder.block_d;
+
+    if (profile == decode_profile::hdr) {
+        write_decoded_hdr(decoder, output);
+        return;
+    }
+
+    if (profile == decode_profile::ldr_srgb) {
+        // Only the top 8 bits are significant in sRGB mode, for void extents too.
+        // Alpha is never sRGB-encoded
+        uint16_t c[216*4];
+        if (is_void_extent) {
+            for (int idx = 0; idx < num_texels; ++idx) {
+                c[idx*4+0] = void_extent_colour_r;
+                c[idx*4+1] = void_extent_colour_g;
+                c[idx*4+2] = void_extent_colour_b;
+                c[idx*4+3] = void_extent_colour_a;
+            }
+        } else {
+            interpolate(decoder, profile, c, nullptr);
+        }
+
+        for (int idx = 0; idx < num_texels; ++idx) {
+            output[idx*4+0] = fp16::from_bits(srgb_to_linear_fp16[c[idx*4+0] >> 8]);
+            output[idx*4+1] = fp16::from_bits(srgb_to_linear_fp16[c[idx*4+1] >> 8]);
+            output[idx*4+2] = fp16::from_bits(srgb_to_linear_fp16[c[idx*4+2] >> 8]);
+            // Alpha is the unorm8 in the top 8 bits, like write_decoded_unorm8()
+            uint16_t a = (c[idx*4+3] >> 8) * 257;
+            output[idx*4+3] = a == 65535 ? fp16::one() : fp16::from_uint16_div_64k(a);
+        }
+        return;
+    }
+
+    if (is_void_extent) {
+        for (int idx = 0; idx < num_texels; ++idx) {
+            output[idx*4+0] = fp16::from_uint16_div_64k(void_extent_colour_r);
+            output[idx*4+1] = fp16::from_uint16_div_64k(void_extent_colour_g);
+            output[idx*4+2] = fp16::from_uint16_div_64k(void_extent_colour_b);
+            output[idx*4+3] = fp16::from_uint16_div_64k(void_extent_colour_a);
+        }
+        return;
+    }
+
+    uint16_t c[216*4];
+    interpolate(decoder, profile, c, nullptr);
+
+    for (int i = 0; i < num_texels * 4; ++i)
+        output[i] = c[i] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[i]);
+}
+
+void Block::write_decoded_hdr(const Decoder &decoder, fp16 *output)
+{
+    int num_texels = decoder.block_w * decoder.block_h * decoder.block_d;
+
+    if (is_void_extent) {
+        for (int idx = 0; idx < num_texels; ++idx) {
+            if (void_extent_d) {
+                // HDR void extents store fp16 values directly
+                output[idx*4+0] = fp16::from_bits(void_extent_colour_r);
+                output[idx*4+1] = fp16::from_bits(void_extent_colour_g);
+                output[idx*4+2] = fp16::from_bits(void_extent_colour_b);
+                output[idx*4+3] = fp16::from_bits(void_extent_colour_a);
+            } else {
+                output[idx*4+0] = fp16::from_uint16_div_64k(void_extent_colour_r);
+                output[idx*4+1] = fp16::from_uint16_div_64k(void_extent_colour_g);
+                output[idx*4+2] = fp16::from_uint16_div_64k(void_extent_colour_b);
+                output[idx*4+3] = fp16::from_uint16_div_64k(void_extent_colour_a);
+            }
+        }
+        return;
+    }
+
+    uint16_t c[216*4];
+    bool is_lns[216*4];
+    interpolate(decoder, decode_profile::hdr, c, is_lns);
+
+    // Convert the whole block as HDR, then patch up any LDR channels
+    uint16_t f[216*4];
+    lns_to_fp16(c, f, num_texels * 4);
+
+    for (int i = 0; i < num_texels * 4; ++i) {
+        if (is_lns[i])
+            output[i] = fp16::from_bits(f[i]);
+        else
+            output[i] = c[i] == 65535 ? fp16::one() : fp16::from_uint16_div_64k(c[i]);
+    }
+}
+
+void Block::write_decoded_unorm8(const Decoder &decoder, decode_profile profile, uint8_t *output)
+{
+    int num_texels = decoder.block_w * decoder.block_h * decoder.block_d;
+
+    if (profile == decode_profile::hdr) {
+        // Clamp HDR values into the unorm8 range
+        fp16 f[216*4];
+        write_decoded_hdr(decoder, f);
+        for (int i = 0; i < num_texels * 4; ++i)
+            output[i] = f[i].to_unorm8_saturate();
+        return;
+    }
+
+    uint16_t c[216*4];
+    if (is_void_extent) {
+        for (int idx = 0; idx < num_texels; ++idx) {
+            c[idx*4+0] = void_extent_colour_r;
+            c[idx*4+1] = void_extent_colour_g;
+            c[idx*4+2] = void_extent_colour_b;
+            c[idx*4+3] = void_extent_colour_a;
+        }
+    } else {
+        interpolate(decoder, profile, c, nullptr);
+    }
+
+    if (profile == decode_profile::ldr_srgb) {
+        // The top 8 bits are the sRGB-encoded value
+        for (int i = 0; i < num_texels * 4; ++i)
+            output[i] = c[i] >> 8;
+    } else {
+        // Equivalent to converting to fp16 (as write_decoded() does) and then
+        // to unorm8, but without the intermediate step
+        for (int i = 0; i < num_texels * 4; ++i)
+            output[i] = c[i] == 65535 ? 0xff : fp16::unorm8_from_uint16_div_64k(c[i]);
+    }
+}
+
 void Block::calculate_from_weights()
 {
     wt_trits = 0;
@@ -1856,7 +2947,8 @@ decode_error Block::calculate_colour_endpoints_size()
 
 uint32_t Block::encode_block_mode()
 {
-    // TODO: 3D
+    if (wt_d > 1)
+        return encode_block_mode_3d();
 
     int r0 = wt_range & 0b1;
     int r21 = (wt_range >> 1) & 0b11;
@@ -1928,7 +3020,79 @@ uint32_t Block::encode_block_mode()
     return 0;
 }
 
-OutputBitVector Block::encode_sequence_trits(const Encoder &encoder, uint8_t *data, int count, int bits)
+uint32_t Block::encode_block_mode_3d()
+{
+    int r0 = wt_range & 0b1;
+    int r21 = (wt_range >> 1) & 0b11;
+
+    if (dual_plane == 0 && high_prec == 0) {
+        if (wt_w == 6 && wt_h < 6 && wt_d < 6) {
+            int b = wt_h - 2;
+            int a = wt_d - 2;
+            return (b << 9) | (0b00 << 7) | (a << 5) | (r0 << 4) | (r21 << 2);
+        }
+        if (wt_w < 6 && wt_h == 6 && wt_d < 6) {
+            int a = wt_w - 2;
+            int b = wt_d - 2;
+            return (b << 9) | (0b01 << 7) | (a << 5) | (r0 << 4) | (r21 << 2);
+        }
+        if (wt_w < 6 && wt_h < 6 && wt_d == 6) {
+            int a = wt_w - 2;
+            int b = wt_h - 2;
+            return (b << 9) | (0b10 << 7) | (a << 5) | (r0 << 4) | (r21 << 2);
+        }
+    }
+
+    uint32_t dh = (dual_plane << 1) | high_prec;
+
+    if (wt_w == 6 && wt_h == 2 && wt_d == 2)
+        return (dh << 9) | (0b1100 << 5) | (r0 << 4) | (r21 << 2);
+    if (wt_w == 2 && wt_h == 6 && wt_d == 2)
+        return (dh << 9) | (0b1101 << 5) | (r0 << 4) | (r21 << 2);
+    if (wt_w == 2 && wt_h == 2 && wt_d == 6)
+        return (dh << 9) | (0b1110 << 5) | (r0 << 4) | (r21 << 2);
+
+    int a = wt_w - 2;
+    int b = wt_h - 2;
+    int c = wt_d - 2;
+    ASSERT(a >= 0 && a < 4);
+    ASSERT(b >= 0 && b < 4);
+    ASSERT(c >= 0 && c < 4);
+    return (dh << 9) | (b << 7) | (a << 5) | (r0 << 4) | (c << 2) | r21;
+}
+
+/**
+ * Encode a void-extent block from void_extent_d, the extent coordinates and
+ * the colour. Set all the coordinates to all-ones (0x1fff in 2D, 0x1ff in
+ * 3D) for a block with no extent.
+ */
+OutputBitVector Block::encode_void_extent(const Encoder &encoder)
+{
+    OutputBitVector out;
+    out.append(0b111111100, 9);
+    out.append(void_extent_d, 1);
+    if (encoder.block_d > 1) {
+        out.append(void_extent_min_s, 9);
+        out.append(void_extent_max_s, 9);
+        out.append(void_extent_min_t, 9);
+        out.append(void_extent_max_t, 9);
+        out.append(void_extent_min_p, 9);
+        out.append(void_extent_max_p, 9);
+    } else {
+        out.append(0b11, 2); // reserved
+        out.append(void_extent_min_s, 13);
+        out.append(void_extent_max_s, 13);
+        out.append(void_extent_min_t, 13);
+        out.append(void_extent_max_t, 13);
+    }
+    out.append(void_extent_colour_r, 16);
+    out.append(void_extent_colour_g, 16);
+    out.append(void_extent_colour_b, 16);
+    out.append(void_extent_colour_a, 16);
+    return out;
+}
+
+OutputBitVector Block::encode_sequence_trits(uint8_t *data, int count, int bits)
 {
     OutputBitVector out;
 
@@ -1952,7 +3116,7 @@ OutputBitVector Block::encode_sequence_trits(const Encoder &encoder, uint8_t *da
         int t4 = data[i+4] >> bits;
         ASSERT(t0 < 3 && t1 < 3 && t2 < 3 && t3 < 3 && t4 < 3);
 
-        uint8_t T = encoder.trit_lookup[t0 + t1*3 + t2*(3*3) + t3*(3*3*3) + t4*(3*3*3*3)];
+        uint8_t T = trit_encode_table[t0 + t1*3 + t2*(3*3) + t3*(3*3*3) + t4*(3*3*3*3)];
 
         uint64_t block = 0;
         block |= m0;
@@ -1972,7 +3136,7 @@ OutputBitVector Block::encode_sequence_trits(const Encoder &encoder, uint8_t *da
     return out;
 }
 
-OutputBitVector Block::encode_sequence_quints(const Encoder &encoder, uint8_t *data, int count, int bits)
+OutputBitVector Block::encode_sequence_quints(uint8_t *data, int count, int bits)
 {
     OutputBitVector out;
 
@@ -1992,7 +3156,7 @@ OutputBitVector Block::encode_sequence_quints(const Encoder &encoder, uint8_t *d
         int q2 = data[i+2] >> bits;
         ASSERT(q0 < 5 && q1 < 5 && q2 < 5);
 
-        uint8_t Q = encoder.quint_lookup[q0 + q1*5 + q2*(5*5)];
+        uint8_t Q = quint_encode_table[q0 + q1*5 + q2*(5*5)];
 
         uint32_t block = 0;
         block |= m0;
@@ -2025,6 +3189,9 @@ OutputBitVector Block::encode_sequence_bits(uint8_t *data, int count, int bits)
 
 OutputBitVector Block::encode(const Encoder &encoder)
 {
+    if (is_void_extent)
+        return encode_void_extent(encoder);
+
     OutputBitVector out;
     out.append(encode_block_mode(), 11);
     out.append(num_parts - 1, 2);
@@ -2056,9 +3223,9 @@ OutputBitVector Block::encode(const Encoder &encoder)
     if (!bogus_colour_endpoints) {
         OutputBitVector endpoints_encoded;
         if (ce_trits)
-            endpoints_encoded = encode_sequence_trits(encoder, colour_endpoints_quant, num_cem_values, ce_bits);
+            endpoints_encoded = encode_sequence_trits(colour_endpoints_quant, num_cem_values, ce_bits);
         else if (ce_quints)
-            endpoints_encoded = encode_sequence_quints(encoder, colour_endpoints_quant, num_cem_values, ce_bits);
+            endpoints_encoded = encode_sequence_quints(colour_endpoints_quant, num_cem_values, ce_bits);
         else
             endpoints_encoded = encode_sequence_bits(colour_endpoints_quant, num_cem_values, ce_bits);
 
@@ -2091,9 +3258,9 @@ OutputBitVector Block::encode(const Encoder &encoder)
     if (!bogus_weights) {
         OutputBitVector weights_encoded;
         if (wt_trits)
-            weights_encoded = encode_sequence_trits(encoder, weights_quant, num_weights, wt_bits);
+            weights_encoded = encode_sequence_trits(weights_quant, num_weights, wt_bits);
         else if (wt_quints)
-            weights_encoded = encode_sequence_quints(encoder, weights_quant, num_weights, wt_bits);
+            weights_encoded = encode_sequence_quints(weights_quant, num_weights, wt_bits);
         else
             weights_encoded = encode_sequence_bits(weights_quant, num_weights, wt_bits);
 
@@ -2103,6 +3270,70 @@ OutputBitVector Block::encode(const Encoder &encoder)
     return out;
 }
 
+
+const QuantisationTables &QuantisationTables::get()
+{
+    static const QuantisationTables tables;
+    return tables;
+}
+
+QuantisationTables::QuantisationTables()
+{
+    memset(weights, 0, sizeof(weights));
+    memset(weights_unquant, 0, sizeof(weights_unquant));
+    memset(endpoints_unquant, 0, sizeof(endpoints_unquant));
+
+    // Use the decoder's own unquantisation, a few values at a time
+    Block blk;
+
+    for (int r = 0; r < ARRAY_SIZE(cem_ranges); ++r) {
+        blk.ce_trits = cem_ranges[r].t;
+        blk.ce_quints = cem_ranges[r].q;
+        blk.ce_bits = cem_ranges[r].b;
+        int ce_max = cem_ranges[r].max;
+        for (int base = 0; base <= ce_max; base += 16) {
+            blk.num_cem_values = std::min(16, ce_max + 1 - base);
+            for (int i = 0; i < blk.num_cem_values; ++i)
+                blk.colour_endpoints_quant[i] = base + i;
+            blk.unquantise_colour_endpoints();
+            for (int i = 0; i < blk.num_cem_values; ++i)
+                endpoints_unquant[r][base + i] = blk.colour_endpoints[i];
+        }
+        for (int v = 0; v < 256; ++v) {
+            int best = 0;
+            for (int q = 1; q <= ce_max; ++q)
+                if (abs(endpoints_unquant[r][q] - v) < abs(endpoints_unquant[r][best] - v))
+                    best = q;
+            endpoints[r][v].quant = best;
+            endpoints[r][v].unquant = endpoints_unquant[r][best];
+        }
+    }
+
+    for (int high_prec = 0; high_prec < 2; ++high_prec) {
+        for (int wt_range = 2; wt_range < 8; ++wt_range) {
+            blk.high_prec = high_prec;
+            blk.wt_range = wt_range;
+            blk.wt_w = blk.wt_h = blk.wt_d = 1;
+            blk.dual_plane = 0;
+            blk.calculate_from_weights();
+            blk.num_weights = blk.wt_max + 1;
+            for (int i = 0; i <= blk.wt_max; ++i)
+                blk.weights_quant[i] = i;
+            blk.unquantise_weights();
+            for (int i = 0; i <= blk.wt_max; ++i)
+                weights_unquant[high_prec][wt_range][i] = blk.weights[i];
+            for (int w = 0; w <= 64; ++w) {
+                int best = 0;
+                for (int q = 1; q <= blk.wt_max; ++q)
+                    if (abs(blk.weights[q] - w) < abs(blk.weights[best] - w))
+                        best = q;
+                weights[high_prec][wt_range][w].quant = best;
+                weights[high_prec][wt_range][w].unquant = blk.weights[best];
+            }
+        }
+    }
+}
+
 } // namespace oastc
 
 #endif // INCLUDED_OASTC
@@ -0,0 +1,864 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "oastc.h"
+#include "compress.h"
+
+#include "decode_image.h"
+#include "image_io.h"
+#include "optionparser.h"
+#include "test_generator.h"
+
+using oastc::Block;
+using oastc::Decoder;
+using oastc::InputBitVector;
+using oastc::decode_error;
+using oastc::decode_profile;
+using oastc::fp16;
+
+enum OptionId
+{
+    UNKNOWN,
+    HELP,
+
+    INPUT,
+    BLOCK_SIZE,
+    BLOCKS,
+    RUNS,
+    HDR,
+
+    THROUGHPUT,
+    THREADS,
+    JSON,
+    BASELINE,
+    TOLERANCE,
+
+    HEATMAP,
+};
+
+static const option::Descriptor usage[] =
+{
+    { UNKNOWN,    0, "",  "",       Arg::Unknown,  "Options:" },
+    { HELP,       0, "",  "help",   Arg::None,     "  --help  \tPrint usage and exit" },
+    { INPUT,      0, "i", "input",  Arg::Required, "  -i --input FILENAME  \tBenchmark the blocks of this .astc file instead of random blocks (may be repeated)" },
+    { BLOCK_SIZE, 0, "b", "block",  Arg::Required, "  -b --block WxH[xD]  \tOnly benchmark random blocks of this size (default: every block size)" },
+    { BLOCKS,     0, "n", "blocks", Arg::Numeric,  "  -n --blocks N  \tNumber of random blocks per block size (default: 4096)" },
+    { RUNS,       0, "r", "runs",   Arg::Numeric,  "  -r --runs N  \tNumber of timed runs, for the mean and standard deviation (default: 20)" },
+    { HDR,        0, "",  "hdr",    Arg::None,     "  --hdr  \tDecode using the HDR profile (default: LDR)" },
+    { UNKNOWN,    0, "",  "",       Arg::Unknown,  "\nWhole-image throughput options:" },
+    { THROUGHPUT, 0, "",  "throughput", Arg::None, "  --throughput  \tTime decoding whole images instead of stages. Every -i file is decoded; .png and .tga "
+        "files are first encoded at each --block size (default: 4x4,6x6,8x8,12x12), which may be a comma-separated list. "
+        "--runs defaults to 5" },
+    { THREADS,    0, "j", "threads", Arg::Required, "  -j --threads N[,N...]  \tThread counts to decode with (default: 1 and the number of CPUs)" },
+    { JSON,       0, "",  "json",   Arg::Required, "  --json FILENAME  \tWrite the results as JSON" },
+    { BASELINE,   0, "",  "baseline", Arg::Required, "  --baseline FILENAME  \tCompare against results written earlier by --json for the same images, and fail if any are slower" },
+    { TOLERANCE,  0, "",  "tolerance", Arg::Numeric, "  --tolerance PERCENT  \tHow much slower than the baseline counts as a regression (default: 10)" },
+    { UNKNOWN,    0, "",  "",       Arg::Unknown,  "\nBlock mode heat map options:" },
+    { HEATMAP,    0, "",  "heatmap", Arg::Required, "  --heatmap FILENAME  \tTime Decoder::decode_unorm8() for every legal block mode and partition count of each block size "
+        "(or just --block), on blocks from the test generator, and write ns/block as CSV. --blocks (default: 256) limits the blocks "
+        "timed per block mode and partition count, --runs defaults to 5, and the first --threads value sets the number of threads "
+        "generating blocks (timing is single-threaded)" },
+    { 0,0,0,0,0,0 }
+};
+
+static const int block_sizes[][3] = {
+    { 4, 4, 1 }, { 5, 4, 1 }, { 5, 5, 1 }, { 6, 5, 1 }, { 6, 6, 1 }, { 8, 5, 1 }, { 8, 6, 1 },
+    { 8, 8, 1 }, { 10, 5, 1 }, { 10, 6, 1 }, { 10, 8, 1 }, { 10, 10, 1 }, { 12, 10, 1 }, { 12, 12, 1 },
+    { 3, 3, 3 }, { 4, 3, 3 }, { 4, 4, 3 }, { 4, 4, 4 }, { 5, 4, 4 },
+    { 5, 5, 4 }, { 5, 5, 5 }, { 6, 5, 5 }, { 6, 6, 5 }, { 6, 6, 6 },
+};
+
+// The stages of Block::decode(), in order, followed by the two alternative
+// ways of writing out the texels
+static const char *const stage_names[] = {
+    "decode_block_mode",
+    "decode_cem",
+    "unpack_colour_endpoints",
+    "unquantise_colour_endpoints",
+    "decode_colour_endpoints",
+    "unpack_weights",
+    "unquantise_weights",
+    "compute_infill_weights",
+    "write_decoded",
+    "write_decoded_unorm8",
+};
+static const int num_decode_stages = 8;
+
+/**
+ * Stop the compiler optimising away work whose results are never read
+ */
+static inline void escape(const void *p)
+{
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+/**
+ * Do the first num_stages stages of Block::decode() on a block that is known
+ * to decode successfully, then write_decoded() if write is 1 or
+ * write_decoded_unorm8() if write is 2. This is Block::decode() without the
+ * error checks, which the corpus doesn't need.
+ */
+static void decode_stages(const Decoder &dec, decode_profile profile, const uint8_t *data, int num_stages, int write)
+{
+    Block blk;
+    InputBitVector in;
+    memcpy(&in.data, data, 16);
+
+    blk.is_error = false;
+    blk.bogus_colour_endpoints = false;
+    blk.bogus_weights = false;
+    blk.is_void_extent = false;
+    blk.wt_d = 1;
+
+    for (int stage = 0; stage < num_stages && !blk.is_void_extent; ++stage) {
+        switch (stage) {
+        case 0:
+            if (dec.block_d > 1)
+                blk.decode_block_mode_3d(in);
+            else
+                blk.decode_block_mode(in);
+            blk.calculate_from_weights();
+            blk.num_parts = in.get_bits(11, 2) + 1;
+            break;
+        case 1:
+            blk.decode_cem(in);
+            blk.num_cem_values = ((blk.cem_base_class + 1) * blk.num_parts + blk.extra_cem_bits) * 2;
+            blk.calculate_remaining_bits();
+            blk.calculate_colour_endpoints_size();
+            break;
+        case 2:
+            blk.unpack_colour_endpoints(in);
+            break;
+        case 3:
+            blk.unquantise_colour_endpoints();
+            break;
+        case 4:
+            blk.decode_colour_endpoints();
+            break;
+        case 5:
+            blk.colour_component_selector = blk.dual_plane
+                ? in.get_bits(128 - blk.weight_bits - blk.num_extra_cem_bits - 2, 2) : 0;
+            blk.unpack_weights(in);
+            break;
+        case 6:
+            blk.unquantise_weights();
+            break;
+        case 7:
+            blk.compute_infill_weights(dec.block_w, dec.block_h, dec.block_d);
+            break;
+        }
+    }
+
+    if (write == 1) {
+        fp16 texels[216*4];
+        blk.write_decoded(dec, profile, texels);
+        escape(texels);
+    } else if (write == 2) {
+        uint8_t texels[216*4];
+        blk.write_decoded_unorm8(dec, profile, texels);
+        escape(texels);
+    }
+    escape(&blk);
+}
+
+static std::string footprint_name(int block_w, int block_h, int block_d)
+{
+    return std::to_string(block_w) + "x" + std::to_string(block_h)
+         + (block_d > 1 ? "x" + std::to_string(block_d) : "");
+}
+
+struct corpus
+{
+    std::string name;
+    int block_w, block_h, block_d;
+    std::vector<uint8_t> blocks;
+};
+
+/**
+ * Random blocks that decode without error, so every block mode, partition
+ * count and endpoint mode is represented about as often as it is in the
+ * space of legal encodings. The same seed always gives the same blocks.
+ */
+static corpus random_corpus(int block_w, int block_h, int block_d, decode_profile profile, int num_blocks)
+{
+    corpus c;
+    c.name = footprint_name(block_w, block_h, block_d) + " random";
+    c.block_w = block_w;
+    c.block_h = block_h;
+    c.block_d = block_d;
+
+    Decoder dec(block_w, block_h, block_d, profile);
+    std::mt19937 rng(block_w * 256 + block_h * 16 + block_d);
+    while ((int)c.blocks.size() < num_blocks * 16) {
+        uint8_t data[16];
+        for (auto &b : data)
+            b = rng();
+        Block blk;
+        InputBitVector in;
+        memcpy(&in.data, data, 16);
+        if (blk.decode(dec, in, profile) == decode_error::ok)
+            c.blocks.insert(c.blocks.end(), data, data + 16);
+    }
+    return c;
+}
+
+/**
+ * The blocks of an .astc file that decode without error
+ */
+static bool file_corpus(const char *filename, decode_profile profile, corpus &c)
+{
+    astc_image img;
+    if (!read_astc(filename, img))
+        return false;
+
+    c.name = filename;
+    c.block_w = img.block_w;
+    c.block_h = img.block_h;
+    c.block_d = img.block_d;
+
+    Decoder dec(img.block_w, img.block_h, img.block_d, profile);
+    for (size_t i = 0; i < img.blocks.size(); i += 16) {
+        Block blk;
+        InputBitVector in;
+        memcpy(&in.data, &img.blocks[i], 16);
+        if (blk.decode(dec, in, profile) == decode_error::ok)
+            c.blocks.insert(c.blocks.end(), &img.blocks[i], &img.blocks[i] + 16);
+    }
+    if (c.blocks.empty()) {
+        fprintf(stderr, "No valid blocks in \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+template<typename F>
+static double ns_per_block(const corpus &c, F fn)
+{
+    size_t num_blocks = c.blocks.size() / 16;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_blocks; ++i)
+        fn(&c.blocks[i * 16]);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+}
+
+/**
+ * Time every stage over the whole corpus, as the difference between running
+ * the decoder up to and including that stage and up to the one before, so
+ * the timer's own overhead (which is bigger than some stages) cancels out
+ */
+static void bench_corpus(const corpus &c, decode_profile profile, int num_runs)
+{
+    Decoder dec(c.block_w, c.block_h, c.block_d, profile);
+    dec.build_partition_table();
+
+    // [stage][run]; timings[0] is just the setup, and the last is the whole
+    // of Decoder::decode_unorm8() for comparison
+    const int num_timings = num_decode_stages + 4;
+    std::vector<double> timings[num_timings];
+
+    // The first run is a warm-up and isn't recorded
+    for (int run = 0; run <= num_runs; ++run) {
+        double t[num_timings];
+        for (int n = 0; n <= num_decode_stages; ++n)
+            t[n] = ns_per_block(c, [&](const uint8_t *b) { decode_stages(dec, profile, b, n, 0); });
+        t[num_decode_stages + 1] = ns_per_block(c, [&](const uint8_t *b) { decode_stages(dec, profile, b, num_decode_stages, 1); });
+        t[num_decode_stages + 2] = ns_per_block(c, [&](const uint8_t *b) { decode_stages(dec, profile, b, num_decode_stages, 2); });
+        t[num_decode_stages + 3] = ns_per_block(c, [&](const uint8_t *b) {
+            uint8_t texels[216*4];
+            dec.decode_unorm8(b, texels, profile);
+            escape(texels);
+        });
+        if (run == 0)
+            continue;
+
+        timings[0].push_back(t[0]);
+        for (int n = 1; n <= num_decode_stages; ++n)
+            timings[n].push_back(t[n] - t[n - 1]);
+        timings[num_decode_stages + 1].push_back(t[num_decode_stages + 1] - t[num_decode_stages]);
+        timings[num_decode_stages + 2].push_back(t[num_decode_stages + 2] - t[num_decode_stages]);
+        timings[num_decode_stages + 3].push_back(t[num_decode_stages + 3]);
+    }
+
+    printf("%s (%d blocks, %d runs)\n", c.name.c_str(), (int)(c.blocks.size() / 16), num_runs);
+    printf("  %-30s %10s %8s %12s\n", "stage", "ns/block", "stddev", "Mblocks/s");
+    for (int i = 0; i < num_timings; ++i) {
+        double mean = 0, var = 0;
+        for (double v : timings[i])
+            mean += v;
+        mean /= num_runs;
+        for (double v : timings[i])
+            var += (v - mean) * (v - mean);
+        double stddev = num_runs > 1 ? sqrt(var / (num_runs - 1)) : 0.0;
+
+        const char *name = i == 0 ? "(setup)"
+                         : i <= num_decode_stages + 2 ? stage_names[i - 1]
+                         : "Decoder::decode_unorm8 total";
+        if (mean > 0)
+            printf("  %-30s %10.2f %8.2f %12.2f\n", name, mean, stddev, 1000.0 / mean);
+        else
+            printf("  %-30s %10.2f %8.2f %12s\n", name, mean, stddev, "-");
+    }
+    printf("\n");
+}
+
+/**
+ * The generated blocks with one 11-bit block mode and partition count
+ */
+struct heatmap_cell
+{
+    int block_mode;
+    int num_parts;
+    Block header; // from decode_header() of the first block
+    size_t num_generated;
+    corpus c;
+};
+
+/**
+ * Time decoding blocks from the test generator for each block mode and
+ * partition count of one block size, and append a CSV row for each
+ */
+static void bench_heatmap(FILE *f, int block_w, int block_h, int block_d, decode_profile profile,
+        int max_blocks, int num_runs, int num_threads)
+{
+    oastc::Encoder encoder(block_w, block_h, block_d);
+    Decoder dec(block_w, block_h, block_d, profile);
+    dec.build_partition_table();
+
+    // Dual-plane modes are generated once per colour component selector,
+    // which isn't part of the block mode, so several shards can fill the
+    // same cells
+    typedef oastc::TestGenerator::block_mode block_mode;
+    std::vector<block_mode> modes = oastc::TestGenerator::block_modes(encoder);
+    std::vector<std::vector<oastc::OutputBitVector>> shard_blocks(modes.size());
+    oastc::parallel_for_chunks((int)modes.size(), 1, num_threads, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            oastc::TestGenerator gen;
+            gen.seed(1);
+            gen.allow_hdr(profile == decode_profile::hdr);
+            gen.show_progress(false);
+            gen.generate_with_block_mode(encoder, modes[i]);
+            shard_blocks[i] = gen.output_blocks();
+        }
+    });
+
+    std::map<std::pair<int, int>, std::vector<const oastc::OutputBitVector *>> generated;
+    for (auto &blocks : shard_blocks) {
+        for (auto &out : blocks) {
+            InputBitVector in;
+            memcpy(&in.data, out.data, 16);
+            generated[std::make_pair(in.get_bits(0, 11), in.get_bits(11, 2) + 1)].push_back(&out);
+        }
+    }
+
+    std::vector<heatmap_cell> cells;
+    for (auto &g : generated) {
+        heatmap_cell cell;
+        cell.block_mode = g.first.first;
+        cell.num_parts = g.first.second;
+        cell.num_generated = g.second.size();
+        cell.c.name = footprint_name(block_w, block_h, block_d);
+        cell.c.block_w = block_w;
+        cell.c.block_h = block_h;
+        cell.c.block_d = block_d;
+
+        // An even spread of the generated blocks, so every endpoint mode is
+        // still represented
+        size_t n = std::min(g.second.size(), (size_t)max_blocks);
+        for (size_t i = 0; i < n; ++i) {
+            const uint8_t *data = (const uint8_t *)g.second[i * g.second.size() / n]->data;
+            cell.c.blocks.insert(cell.c.blocks.end(), data, data + 16);
+        }
+
+        InputBitVector in;
+        memcpy(&in.data, cell.c.blocks.data(), 16);
+        cell.header.is_error = false;
+        cell.header.bogus_colour_endpoints = false;
+        cell.header.bogus_weights = false;
+        cell.header.is_void_extent = false;
+        if (cell.header.decode_header(dec, in, profile) != decode_error::ok)
+            continue;
+        cells.push_back(std::move(cell));
+    }
+
+    for (const heatmap_cell &cell : cells) {
+        // The samples are small enough for one interrupt to dominate a run,
+        // so take the fastest run rather than the mean
+        double best = INFINITY;
+        for (int run = 0; run <= num_runs; ++run) {
+            double t = ns_per_block(cell.c, [&](const uint8_t *b) {
+                uint8_t texels[216*4];
+                dec.decode_unorm8(b, texels, profile);
+                escape(texels);
+            });
+            if (run > 0)
+                best = std::min(best, t);
+        }
+
+        const Block &h = cell.header;
+        fprintf(f, "%s,0x%03x,%d,%d,%s,%d,%d,%d,%d,%.2f\n", cell.c.name.c_str(), cell.block_mode, cell.num_parts,
+                h.dual_plane, footprint_name(h.wt_w, h.wt_h, h.wt_d).c_str(), h.wt_max + 1, h.weight_bits,
+                (int)cell.num_generated, (int)(cell.c.blocks.size() / 16), best);
+    }
+
+    fprintf(stderr, "%s: %d block modes and partition counts\n",
+            footprint_name(block_w, block_h, block_d).c_str(), (int)cells.size());
+}
+
+/**
+ * Parse a comma-separated list of positive integers
+ */
+static bool parse_int_list(const char *arg, std::vector<int> &values)
+{
+    values.clear();
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1)
+            return false;
+        values.push_back(v);
+        p = end;
+        if (*p == ',')
+            ++p;
+        else if (*p)
+            return false;
+    }
+    return !values.empty();
+}
+
+struct throughput_result
+{
+    std::string footprint;
+    int threads;
+    int images;
+    uint64_t texels;
+    double seconds; // sum of each image's median decode time
+    double mtexels_per_s;
+};
+
+/**
+ * Write the results as JSON, with one result per line so that
+ * read_baseline() doesn't need a real JSON parser
+ */
+static bool write_json(const char *filename, int num_runs, const std::vector<throughput_result> &results)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+    fprintf(f, "{\n  \"version\": 1,\n  \"runs\": %d,\n  \"results\": [\n", num_runs);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const throughput_result &r = results[i];
+        fprintf(f, "    { \"footprint\": \"%s\", \"threads\": %d, \"images\": %d, \"texels\": %llu, "
+                "\"seconds\": %.6f, \"mtexels_per_s\": %.3f }%s\n",
+                r.footprint.c_str(), r.threads, r.images, (unsigned long long)r.texels,
+                r.seconds, r.mtexels_per_s, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read the results for each footprint and thread count from a file written
+ * by write_json()
+ */
+static bool read_baseline(const char *filename, std::map<std::pair<std::string, int>, throughput_result> &baseline)
+{
+    std::ifstream input(filename);
+    if (!input) {
+        fprintf(stderr, "Failed to open \"%s\" for input\n", filename);
+        return false;
+    }
+    std::string line;
+    while (std::getline(input, line)) {
+        char footprint[32];
+        throughput_result r;
+        unsigned long long texels;
+        const char *p = strstr(line.c_str(), "\"footprint\"");
+        const char *q = strstr(line.c_str(), "\"mtexels_per_s\"");
+        if (!p || !q)
+            continue;
+        if (sscanf(p, "\"footprint\": \"%31[^\"]\", \"threads\": %d, \"images\": %d, \"texels\": %llu",
+                    footprint, &r.threads, &r.images, &texels) != 4
+                || sscanf(q, "\"mtexels_per_s\": %lf", &r.mtexels_per_s) != 1) {
+            fprintf(stderr, "Invalid result in \"%s\": %s\n", filename, line.c_str());
+            return false;
+        }
+        r.footprint = footprint;
+        r.texels = texels;
+        r.seconds = 0;
+        baseline[std::make_pair(r.footprint, r.threads)] = r;
+    }
+    if (baseline.empty()) {
+        fprintf(stderr, "No results in \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check that every result that has a baseline was measured on the same
+ * images, since MTexels/s from a different corpus isn't comparable
+ */
+static bool check_baseline_corpus(const std::vector<throughput_result> &results,
+        const std::map<std::pair<std::string, int>, throughput_result> &baseline, const char *filename)
+{
+    bool ok = true;
+    for (const throughput_result &r : results) {
+        auto it = baseline.find(std::make_pair(r.footprint, r.threads));
+        if (it == baseline.end())
+            continue;
+        if (it->second.images != r.images || it->second.texels != r.texels) {
+            fprintf(stderr, "%s with %d threads decoded %d images (%llu texels), but \"%s\" has %d images (%llu texels)\n",
+                    r.footprint.c_str(), r.threads, r.images, (unsigned long long)r.texels,
+                    filename, it->second.images, (unsigned long long)it->second.texels);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * Load the -i files as .astc images, encoding any .png/.tga images at each
+ * of the given block sizes
+ */
+static bool load_throughput_corpus(option::Option *inputs, const std::vector<std::pair<int, int>> &block_sizes,
+        std::vector<astc_image> &images)
+{
+    for (option::Option *opt = inputs; opt; opt = opt->next()) {
+        const char *filename = opt->arg;
+        if (has_extension(filename, ".astc")) {
+            astc_image img;
+            if (!read_astc(filename, img))
+                return false;
+            images.push_back(std::move(img));
+            continue;
+        }
+
+        int image_w, image_h;
+        std::vector<uint8_t> rgba;
+        if (!read_image(filename, image_w, image_h, rgba))
+            return false;
+
+        for (auto &size : block_sizes) {
+            fprintf(stderr, "Encoding '%s' at %dx%d\n", filename, size.first, size.second);
+            oastc::Compressor comp(size.first, size.second);
+            astc_image img;
+            img.block_w = size.first;
+            img.block_h = size.second;
+            img.block_d = 1;
+            img.image_w = image_w;
+            img.image_h = image_h;
+            img.image_d = 1;
+            img.blocks_x = (image_w + size.first - 1) / size.first;
+            img.blocks_y = (image_h + size.second - 1) / size.second;
+            img.blocks_z = 1;
+            img.blocks.resize((size_t)img.blocks_x * img.blocks_y * 16);
+            comp.compress_image(rgba.data(), image_w, image_h, (size_t)image_w * 4, img.blocks.data(),
+                    std::thread::hardware_concurrency());
+            images.push_back(std::move(img));
+        }
+    }
+    return true;
+}
+
+/**
+ * Time decoding every image with each thread count, and report the total
+ * MTexels/s for each footprint. Each image's time is the median of its runs,
+ * which is less sensitive than the mean to other processes' interference.
+ */
+static void bench_throughput(const std::vector<astc_image> &images, decode_profile profile,
+        const std::vector<int> &thread_counts, int num_runs, std::vector<throughput_result> &results)
+{
+    std::map<std::string, std::vector<const astc_image *>> by_footprint;
+    for (const astc_image &img : images)
+        by_footprint[footprint_name(img.block_w, img.block_h, img.block_d)].push_back(&img);
+
+    for (auto &group : by_footprint) {
+        for (int threads : thread_counts) {
+            throughput_result r;
+            r.footprint = group.first;
+            r.threads = threads;
+            r.images = group.second.size();
+            r.texels = 0;
+            r.seconds = 0;
+
+            for (const astc_image *img : group.second) {
+                Decoder dec(img->block_w, img->block_h, img->block_d, profile);
+                dec.build_partition_table();
+                std::vector<uint8_t> image_out((size_t)img->image_w * img->image_h * img->image_d * 4);
+
+                // The first run is a warm-up and isn't recorded. Small images
+                // are decoded repeatedly in each run, so the timer's
+                // resolution and the thread startup don't dominate
+                std::vector<double> times;
+                for (int run = 0; run <= num_runs; ++run) {
+                    int iterations = 0;
+                    double elapsed;
+                    auto start = std::chrono::steady_clock::now();
+                    do {
+                        decode_image(dec, *img, threads, image_out);
+                        ++iterations;
+                        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    } while (elapsed < 0.01);
+                    if (run > 0)
+                        times.push_back(elapsed / iterations);
+                }
+                std::sort(times.begin(), times.end());
+
+                r.texels += (uint64_t)img->image_w * img->image_h * img->image_d;
+                r.seconds += times[times.size() / 2];
+            }
+
+            r.mtexels_per_s = r.texels / r.seconds / 1e6;
+            results.push_back(r);
+        }
+    }
+}
+
+/**
+ * Print the results, compared against the baseline if there is one. Returns
+ * false if any result is more than tolerance percent slower than its
+ * baseline.
+ */
+static bool report_throughput(const std::vector<throughput_result> &results,
+        const std::map<std::pair<std::string, int>, throughput_result> &baseline, double tolerance)
+{
+    bool ok = true;
+    printf("%-10s %7s %7s %12s %12s %12s %9s\n", "footprint", "threads", "images", "Mtexels", "Mtexels/s", "baseline", "change");
+    for (const throughput_result &r : results) {
+        printf("%-10s %7d %7d %12.2f %12.2f", r.footprint.c_str(), r.threads, r.images, r.texels / 1e6, r.mtexels_per_s);
+        auto it = baseline.find(std::make_pair(r.footprint, r.threads));
+        if (it == baseline.end()) {
+            printf(" %12s\n", baseline.empty() ? "" : "-");
+            continue;
+        }
+        double change = (r.mtexels_per_s / it->second.mtexels_per_s - 1.0) * 100.0;
+        bool regressed = change < -tolerance;
+        printf(" %12.2f %+8.1f%%%s\n", it->second.mtexels_per_s, change, regressed ? "  REGRESSION" : "");
+        ok &= !regressed;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = nullptr;
+    if (argc > 0) {
+        program_name = argv[0];
+        argc--;
+        argv++;
+    }
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max), buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, options.data(), buffer.data());
+
+    if (parse.error()) {
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (parse.nonOptionsCount()) {
+        std::cerr << "Unknown option '" << parse.nonOption(0) << "'\n";
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (options[HELP]) {
+        std::cout << "USAGE: " << program_name << " [options]\n\n";
+        option::printUsage(std::cout, usage);
+        return 0;
+    }
+
+    decode_profile profile = options[HDR] ? decode_profile::hdr : decode_profile::ldr;
+
+    int num_blocks = options[HEATMAP] ? 256 : 4096;
+    if (options[BLOCKS])
+        num_blocks = atoi(options[BLOCKS].arg);
+
+    int num_runs = options[THROUGHPUT] || options[HEATMAP] ? 5 : 20;
+    if (options[RUNS])
+        num_runs = atoi(options[RUNS].arg);
+
+    if (num_blocks < 1 || num_runs < 1) {
+        fprintf(stderr, "Number of blocks and runs must be at least 1\n");
+        return 1;
+    }
+
+    if (options[THROUGHPUT]) {
+        if (!options[INPUT]) {
+            fprintf(stderr, "--throughput needs at least one -i file\n");
+            return 1;
+        }
+
+        std::vector<std::pair<int, int>> encode_sizes = { { 4, 4 }, { 6, 6 }, { 8, 8 }, { 12, 12 } };
+        if (options[BLOCK_SIZE]) {
+            encode_sizes.clear();
+            const char *p = options[BLOCK_SIZE].arg;
+            while (*p) {
+                int w, h, n;
+                if (sscanf(p, "%dx%d%n", &w, &h, &n) != 2 || !is_valid_block_size(w, h)) {
+                    fprintf(stderr, "Invalid block size list \"%s\" - must be 2D ASTC block sizes like 4x4,6x6\n", options[BLOCK_SIZE].arg);
+                    return 1;
+                }
+                encode_sizes.push_back(std::make_pair(w, h));
+                p += n;
+                if (*p == ',')
+                    ++p;
+            }
+        }
+
+        std::vector<int> thread_counts;
+        if (options[THREADS]) {
+            if (!parse_int_list(options[THREADS].arg, thread_counts)) {
+                fprintf(stderr, "Invalid thread counts \"%s\" - must be like 1,4\n", options[THREADS].arg);
+                return 1;
+            }
+        } else {
+            thread_counts.push_back(1);
+            int num_cpus = std::thread::hardware_concurrency();
+            if (num_cpus > 1)
+                thread_counts.push_back(num_cpus);
+        }
+
+        double tolerance = 10.0;
+        if (options[TOLERANCE])
+            tolerance = atof(options[TOLERANCE].arg);
+
+        std::map<std::pair<std::string, int>, throughput_result> baseline;
+        if (options[BASELINE] && !read_baseline(options[BASELINE].arg, baseline))
+            return 1;
+
+        std::vector<astc_image> images;
+        if (!load_throughput_corpus(options[INPUT], encode_sizes, images))
+            return 1;
+
+        std::vector<throughput_result> results;
+        bench_throughput(images, profile, thread_counts, num_runs, results);
+
+        if (options[BASELINE] && !check_baseline_corpus(results, baseline, options[BASELINE].arg)) {
+            fprintf(stderr, "Not comparing against a baseline from a different set of images\n");
+            return 1;
+        }
+
+        bool ok = report_throughput(results, baseline, tolerance);
+
+        if (options[JSON] && !write_json(options[JSON].arg, num_runs, results))
+            return 1;
+
+        if (!ok) {
+            fprintf(stderr, "Throughput regressed by more than %.1f%% compared to \"%s\"\n", tolerance, options[BASELINE].arg);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (options[HEATMAP]) {
+        const char *output_fn = options[HEATMAP].arg;
+
+        int only_w = 0, only_h = 0, only_d = 1;
+        if (options[BLOCK_SIZE]) {
+            const char *arg = options[BLOCK_SIZE].arg;
+            if (sscanf(arg, "%dx%dx%d", &only_w, &only_h, &only_d) < 2) {
+                fprintf(stderr, "Invalid block size \"%s\" - must be like 6x6 or 4x4x4\n", arg);
+                return 1;
+            }
+        }
+
+        int num_threads = std::thread::hardware_concurrency();
+        if (options[THREADS])
+            num_threads = std::max(1, atoi(options[THREADS].arg));
+
+        FILE *f = fopen(output_fn, "w");
+        if (!f) {
+            fprintf(stderr, "Failed to open \"%s\" for output\n", output_fn);
+            return 1;
+        }
+        fprintf(f, "footprint,block_mode,partitions,dual_plane,weight_grid,weight_levels,weight_bits,generated_blocks,timed_blocks,ns_per_block\n");
+
+        bool any = false;
+        for (auto &size : block_sizes) {
+            if (only_w && (size[0] != only_w || size[1] != only_h || size[2] != only_d))
+                continue;
+            bench_heatmap(f, size[0], size[1], size[2], profile, num_blocks, num_runs, num_threads);
+            any = true;
+        }
+
+        if (fclose(f) != 0) {
+            fprintf(stderr, "Failed to write \"%s\"\n", output_fn);
+            return 1;
+        }
+        if (!any) {
+            fprintf(stderr, "Invalid block size \"%s\" - not an ASTC block size\n", options[BLOCK_SIZE].arg);
+            return 1;
+        }
+        return 0;
+    }
+
+    std::vector<corpus> corpora;
+    if (options[INPUT]) {
+        for (option::Option *opt = options[INPUT]; opt; opt = opt->next()) {
+            corpus c;
+            if (!file_corpus(opt->arg, profile, c))
+                return 1;
+            corpora.push_back(c);
+        }
+    } else {
+        int only_w = 0, only_h = 0, only_d = 1;
+        if (options[BLOCK_SIZE]) {
+            const char *arg = options[BLOCK_SIZE].arg;
+            if (sscanf(arg, "%dx%dx%d", &only_w, &only_h, &only_d) < 2) {
+                fprintf(stderr, "Invalid block size \"%s\" - must be like 6x6 or 4x4x4\n", arg);
+                return 1;
+            }
+        }
+
+        for (auto &size : block_sizes) {
+            if (only_w && (size[0] != only_w || size[1] != only_h || size[2] != only_d))
+                continue;
+            corpora.push_back(random_corpus(size[0], size[1], size[2], profile, num_blocks));
+        }
+
+        if (corpora.empty()) {
+            fprintf(stderr, "Invalid block size \"%s\" - not an ASTC block size\n", options[BLOCK_SIZE].arg);
+            return 1;
+        }
+    }
+
+    for (const corpus &c : corpora)
+        bench_corpus(c, profile, num_runs);
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <thread>
+
+#include "oastc.h"
+#include "decode_image.h"
+#include "image_compare.h"
+#include "image_io.h"
+#include "optionparser.h"
+
+enum OptionId
+{
+    UNKNOWN,
+    HELP,
+
+    INPUT,
+    REFERENCE,
+    THREADS,
+    SRGB,
+    MAX_ERROR,
+    MAX_MISMATCHES,
+    MIN_PSNR,
+};
+
+static const option::Descriptor usage[] =
+{
+    { UNKNOWN,        0, "",  "",               Arg::Unknown,  "Options:" },
+    { HELP,           0, "",  "help",           Arg::None,     "  --help  \tPrint usage and exit" },
+    { INPUT,          0, "i", "input",          Arg::Required, "  -i --input FILENAME  \tImage to check (supported formats: .astc, which is decoded in memory; .tga, .raw)" },
+    { REFERENCE,      0, "r", "reference",      Arg::Required, "  -r --reference FILENAME  \tImage to compare against (supported formats: .tga, .raw, .png)" },
+    { THREADS,        0, "j", "threads",        Arg::Numeric,  "  -j --threads N  \tNumber of decoding threads (default: number of CPUs)" },
+    { SRGB,           0, "",  "srgb",           Arg::None,     "  --srgb  \tDecode .astc input using the sRGB profile" },
+    { MAX_ERROR,      0, "",  "max-error",      Arg::Numeric,  "  --max-error N  \tFail if any channel differs by more than N" },
+    { MAX_MISMATCHES, 0, "",  "max-mismatches", Arg::Numeric,  "  --max-mismatches N  \tFail if more than N channels differ" },
+    { MIN_PSNR,       0, "",  "min-psnr",       Arg::Required, "  --min-psnr DB  \tFail if the PSNR is below DB" },
+    { 0,0,0,0,0,0 }
+};
+
+/**
+ * An RGBA8 image in memory, or the texels of a mapped .tga/.raw file
+ */
+struct compare_image
+{
+    int width = 0, height = 0;
+    std::vector<uint8_t> rgba;
+    mapped_image mapped;
+    bool is_mapped = false;
+
+    /**
+     * Returns row y (counting from the bottom) as RGBA8, converting it into
+     * 'scratch' if it isn't stored that way
+     */
+    const uint8_t *row_rgba8(int y, std::vector<uint8_t> &scratch) const
+    {
+        if (!is_mapped)
+            return &rgba[(size_t)y * width * 4];
+        if (mapped.bytes_per_pixel == 4 && !mapped.bgr)
+            return mapped.row(y);
+        mapped.row_rgba8(y, scratch.data());
+        return scratch.data();
+    }
+};
+
+static bool load_image(const char *filename, int num_threads, bool srgb, compare_image &img)
+{
+    if (has_extension(filename, ".astc")) {
+        astc_image astc;
+        if (!read_astc(filename, astc))
+            return false;
+        if (astc.image_d > 1) {
+            fprintf(stderr, "\"%s\" is a 3D image, which can only be compared after decoding to .ktx\n", filename);
+            return false;
+        }
+
+        oastc::Decoder dec(astc.block_w, astc.block_h, astc.block_d,
+                srgb ? oastc::decode_profile::ldr_srgb : oastc::decode_profile::ldr);
+        dec.build_partition_table();
+
+        img.width = astc.image_w;
+        img.height = astc.image_h;
+        img.rgba.resize((size_t)img.width * img.height * 4);
+        decode_image(dec, astc, num_threads, img.rgba);
+        return true;
+    }
+
+    if (has_extension(filename, ".png")) {
+        return read_png(filename, img.width, img.height, img.rgba);
+    }
+
+    if (!map_image(filename, img.mapped))
+        return false;
+
+    img.width = img.mapped.width;
+    img.height = img.mapped.height;
+    img.is_mapped = true;
+    return true;
+}
+
+static oastc::image_diff compare_images(const compare_image &a, const compare_image &b)
+{
+    oastc::image_diff diff;
+    size_t row_bytes = (size_t)a.width * 4;
+
+    if (!a.is_mapped && !b.is_mapped)
+        return oastc::compare_unorm8(a.rgba.data(), b.rgba.data(), row_bytes * a.height);
+
+    // Two files with the same layout (e.g. both written by astcenc) are
+    // compared as stored, without converting either
+    if (a.is_mapped && b.is_mapped && a.mapped.same_layout(b.mapped)) {
+        size_t stored_bytes = (size_t)a.width * a.mapped.bytes_per_pixel;
+        for (int y = 0; y < a.height; ++y)
+            diff += oastc::compare_unorm8(a.mapped.row(y), b.mapped.row(y), stored_bytes);
+        return diff;
+    }
+
+    std::vector<uint8_t> scratch_a(row_bytes), scratch_b(row_bytes);
+    for (int y = 0; y < a.height; ++y)
+        diff += oastc::compare_unorm8(a.row_rgba8(y, scratch_a), b.row_rgba8(y, scratch_b), row_bytes);
+    return diff;
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = nullptr;
+    if (argc > 0) {
+        program_name = argv[0];
+        argc--;
+        argv++;
+    }
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max), buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, options.data(), buffer.data());
+
+    if (parse.error()) {
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (parse.nonOptionsCount()) {
+        std::cerr << "Unknown option '" << parse.nonOption(0) << "'\n";
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (options[HELP] || !options[INPUT] || !options[REFERENCE]) {
+        std::cout << "USAGE: " << program_name << " --input FILENAME --reference FILENAME [options]\n\n";
+        option::printUsage(std::cout, usage);
+        return 0;
+    }
+
+    const char *input_fn = options[INPUT].arg;
+    const char *reference_fn = options[REFERENCE].arg;
+
+    if (has_extension(reference_fn, ".astc")) {
+        fprintf(stderr, "Unrecognised reference format for \"%s\" - must be .tga, .raw or .png\n", reference_fn);
+        return 1;
+    }
+
+    int num_threads = std::thread::hardware_concurrency();
+    if (options[THREADS])
+        num_threads = atoi(options[THREADS].arg);
+
+    compare_image input, reference;
+    if (!load_image(input_fn, num_threads, options[SRGB], input) || !load_image(reference_fn, num_threads, false, reference))
+        return 1;
+
+    if (input.width != reference.width || input.height != reference.height) {
+        fprintf(stderr, "Image sizes differ: \"%s\" is %dx%d, \"%s\" is %dx%d\n",
+                input_fn, input.width, input.height, reference_fn, reference.width, reference.height);
+        return 1;
+    }
+
+    oastc::image_diff diff = compare_images(input, reference);
+
+    printf("%s: PSNR %.2f dB, max error %d, %llu of %llu values differ\n",
+            input_fn, diff.psnr(), diff.max_error,
+            (unsigned long long)diff.mismatches, (unsigned long long)diff.num_values);
+
+    bool failed = false;
+    if (options[MAX_ERROR] && diff.max_error > atoi(options[MAX_ERROR].arg)) {
+        fprintf(stderr, "Max error %d exceeds --max-error %s\n", diff.max_error, options[MAX_ERROR].arg);
+        failed = true;
+    }
+    if (options[MAX_MISMATCHES] && diff.mismatches > strtoull(options[MAX_MISMATCHES].arg, nullptr, 10)) {
+        fprintf(stderr, "%llu differing values exceeds --max-mismatches %s\n",
+                (unsigned long long)diff.mismatches, options[MAX_MISMATCHES].arg);
+        failed = true;
+    }
+    if (options[MIN_PSNR] && diff.psnr() < atof(options[MIN_PSNR].arg)) {
+        fprintf(stderr, "PSNR %.2f dB is below --min-psnr %s\n", diff.psnr(), options[MIN_PSNR].arg);
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
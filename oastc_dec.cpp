@@ -21,9 +21,13 @@
  */
 
 #include <fstream>
+#include <thread>
 
 #include "oastc.h"
 
+#include "content_stats.h"
+#include "decode_image.h"
+#include "image_io.h"
 #include "optionparser.h"
 
 enum OptionId
@@ -33,6 +37,12 @@ enum OptionId
 
     INPUT,
     OUTPUT,
+    THREADS,
+    SRGB,
+    HDR,
+    PROFILE,
+    STATS,
+    TRACE,
 };
 
 static const option::Descriptor usage[] =
@@ -40,22 +50,89 @@ static const option::Descriptor usage[] =
     { UNKNOWN,  0, "",  "",          Arg::Unknown,  "Options:" },
     { HELP,     0, "",  "help",      Arg::None,     "  --help  \tPrint usage and exit" },
     { INPUT,    0, "i", "input",     Arg::Required, "  -i --input FILENAME  \tInput filename (supported formats: .astc)" },
-    { OUTPUT,   0, "o", "output",    Arg::Required, "  -o --output FILENAME  \tOutput filename (supported formats: .tga)" },
+    { OUTPUT,   0, "o", "output",    Arg::Required, "  -o --output FILENAME  \tOutput filename (supported formats: .tga, .ktx, .raw, .rgba16f; 3D images must not use .tga)" },
+    { THREADS,  0, "j", "threads",   Arg::Numeric,  "  -j --threads N  \tNumber of decoding threads (default: number of CPUs)" },
+    { SRGB,     0, "",  "srgb",      Arg::None,     "  --srgb  \tDecode using the sRGB profile, and output sRGB-encoded colours" },
+    { HDR,      0, "",  "hdr",       Arg::None,     "  --hdr  \tDecode using the HDR profile. .ktx output is RGBA16F, .rgba16f output is raw fp16 texels, .tga output is clamped to [0, 1]" },
+    { PROFILE,  0, "",  "profile",   Arg::None,     "  --profile  \tPrint the time spent in each stage of decoding, and the number of each decode error (needs a build with OASTC_DECODE_TIMING)" },
+    { STATS,    0, "",  "stats",     Arg::None,     "  --stats  \tInstead of decoding, write JSON statistics about the block modes used by each input file "
+        "(-i may be given more than once) to stdout, or to the --output file if given" },
+    { TRACE,    0, "",  "trace",     Arg::Required, "  --trace FILENAME  \tWrite a timeline of reading, decoding (per row of blocks, or per slab for 3D images) and writing "
+        "on each thread to FILENAME at exit, as Chrome trace JSON" },
     { 0,0,0,0,0,0 }
 };
 
-// .astc file format described at http://malideveloper.arm.com/downloads/Stacy_ASTC_white%20paper.pdf
-struct astc_header
+static int write_stats(option::Option *inputs, const char *output_fn, oastc::decode_profile profile)
 {
-    uint32_t magic;
-    uint8_t blockdim_x;
-    uint8_t blockdim_y;
-    uint8_t blockdim_z;
-    uint8_t xsize[3];
-    uint8_t ysize[3];
-    uint8_t zsize[3];
-};
-static_assert(sizeof(astc_header) == 16, "no unexpected padding in astc_header");
+    // Read everything before writing anything, so a bad input doesn't leave
+    // a truncated JSON file
+    std::vector<astc_image> images;
+    std::vector<content_stats> stats;
+    for (option::Option *opt = inputs; opt; opt = opt->next()) {
+        astc_image img;
+        if (!read_astc(opt->arg, img))
+            return 1;
+
+        oastc::Decoder dec(img.block_w, img.block_h, img.block_d, profile);
+        stats.emplace_back();
+        gather_content_stats(dec, img, stats.back());
+
+        img.blocks.clear();
+        img.blocks.shrink_to_fit();
+        images.push_back(std::move(img));
+    }
+
+    FILE *f = stdout;
+    if (output_fn) {
+        f = fopen(output_fn, "w");
+        if (!f) {
+            fprintf(stderr, "Failed to open \"%s\" for output\n", output_fn);
+            return 1;
+        }
+    }
+
+    fprintf(f, "{\n  \"files\": [\n");
+    int i = 0;
+    for (option::Option *opt = inputs; opt; opt = opt->next(), ++i) {
+        if (i)
+            fprintf(f, ",\n");
+        write_content_stats_json(f, opt->arg, images[i], stats[i]);
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    if (output_fn && fclose(f) != 0) {
+        fprintf(stderr, "Failed to write \"%s\"\n", output_fn);
+        return 1;
+    }
+    return 0;
+}
+
+static void print_decode_timing(const oastc::decode_timing &timing)
+{
+    uint64_t total_ticks = 0;
+    for (int i = 0; i < oastc::num_decode_stages; ++i)
+        total_ticks += timing.ticks[i];
+
+    printf("%-30s %12s %12s %8s\n", "stage", "calls", "ticks/call", "%");
+    for (int i = 0; i < oastc::num_decode_stages; ++i) {
+        uint64_t calls = timing.calls[i];
+        printf("%-30s %12llu %12.1f %7.1f%%\n", oastc::decode_stage_name((oastc::decode_stage)i),
+                (unsigned long long)calls, calls ? (double)timing.ticks[i] / calls : 0.0,
+                total_ticks ? 100.0 * timing.ticks[i] / total_ticks : 0.0);
+    }
+
+    printf("\n%-30s %12s\n", "result", "blocks");
+    for (int i = 0; i < oastc::num_decode_errors; ++i)
+        if (timing.errors[i])
+            printf("%-30s %12llu\n", oastc::decode_error_name((oastc::decode_error)i), (unsigned long long)timing.errors[i]);
+}
+
+static const char *trace_fn = nullptr;
+
+static void write_trace_at_exit()
+{
+    oastc::write_chrome_trace(trace_fn);
+}
 
 int main(int argc, char **argv)
 {
@@ -80,7 +157,7 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (options[HELP] || !options[INPUT] || !options[OUTPUT]) {
+    if (options[HELP] || !options[INPUT] || (!options[OUTPUT] && !options[STATS])) {
         std::cout << "USAGE: " << program_name << " --input FILENAME --output FILENAME [options]\n\n";
         option::printUsage(std::cout, usage);
         return 0;
@@ -89,113 +166,122 @@ int main(int argc, char **argv)
     const char *input_fn = options[INPUT].arg;
     const char *output_fn = options[OUTPUT].arg;
 
-    std::ifstream input(input_fn, std::ios_base::binary | std::ios_base::in);
-    if (!input) {
-        fprintf(stderr, "Failed to open \"%s\" for input\n", input_fn);
+    bool srgb = options[SRGB];
+    bool hdr = options[HDR];
+    if (srgb && hdr) {
+        fprintf(stderr, "--srgb and --hdr cannot be used together\n");
         return 1;
     }
 
-    astc_header header{};
+    oastc::decode_profile profile = oastc::decode_profile::ldr;
+    if (srgb)
+        profile = oastc::decode_profile::ldr_srgb;
+    else if (hdr)
+        profile = oastc::decode_profile::hdr;
 
-    input.read((char *)&header, sizeof(astc_header));
+    if (options[TRACE]) {
+        trace_fn = options[TRACE].arg;
+        oastc::enable_tracing();
+        atexit(write_trace_at_exit);
+    }
+
+    if (options[STATS])
+        return write_stats(options[INPUT], output_fn, profile);
+
+    int num_threads = std::thread::hardware_concurrency();
+    if (options[THREADS])
+        num_threads = atoi(options[THREADS].arg);
 
-    if (header.magic != 0x5ca1ab13) {
-        fprintf(stderr, "Invalid header magic 0x%08x - input must be a valid .astc file\n", header.magic);
+    if (options[PROFILE] && !OASTC_DECODE_TIMING) {
+        fprintf(stderr, "--profile needs oastc_dec to be built with OASTC_DECODE_TIMING (cmake -DOASTC_DECODE_TIMING=ON)\n");
         return 1;
     }
 
-    int block_w = header.blockdim_x;
-    int block_h = header.blockdim_y;
-    int block_d = header.blockdim_z;
+    bool output_ktx = has_extension(output_fn, ".ktx");
+    bool output_raw = has_extension(output_fn, ".raw");
+    bool output_rgba16f = has_extension(output_fn, ".rgba16f");
+    bool output_tga = has_extension(output_fn, ".tga");
+    if (!output_ktx && !output_raw && !output_rgba16f && !output_tga) {
+        fprintf(stderr, "Unrecognised output format for \"%s\" - must be .tga, .ktx, .raw or .rgba16f\n", output_fn);
+        return 1;
+    }
+    if (output_rgba16f && !hdr) {
+        fprintf(stderr, ".rgba16f output requires --hdr\n");
+        return 1;
+    }
 
-    int image_w = (header.xsize[0] + (header.xsize[1] << 8) + (header.xsize[2] << 16));
-    int image_h = (header.ysize[0] + (header.ysize[1] << 8) + (header.ysize[2] << 16));
-    int image_d = (header.zsize[0] + (header.zsize[1] << 8) + (header.zsize[2] << 16));
+    astc_image img;
+    {
+        oastc::TraceSpan span("read");
+        if (!read_astc(input_fn, img))
+            return 1;
+    }
 
     fprintf(stderr, "Decoding '%s' (image size %dx%dx%d, block size %dx%dx%d)\n",
             input_fn,
-            image_w, image_h, image_d,
-            block_w, block_h, block_d);
-
-    std::vector<oastc::fp16> block_out(block_w * block_h * block_d * 4);
-    std::vector<uint8_t> block_out_unorm8(block_w * block_h * block_d * 4);
-    std::vector<uint8_t> image_out(image_w * image_h * image_d * 4);
-    oastc::Decoder dec(block_w, block_h, block_d);
-
-    for (int z = 0; z < (image_d + block_d - 1) / block_d; ++z) {
-        for (int y = 0; y < (image_h + block_h - 1) / block_h; ++y) {
-            for (int x = 0; x < (image_w + block_w - 1) / block_w; ++x) {
-                uint8_t block[16];
-                input.read((char *)block, 16);
-
-                oastc::decode_error err = dec.decode(block, block_out.data());
-                if (err != oastc::decode_error::ok)
-                    printf("Decode error %d\n", err);
-
-                for (int i = 0; i < block_w * block_h * block_d * 4; i += 4) {
-                    block_out_unorm8[i+0] = block_out[i+0].to_unorm8();
-                    block_out_unorm8[i+1] = block_out[i+1].to_unorm8();
-                    block_out_unorm8[i+2] = block_out[i+2].to_unorm8();
-                    block_out_unorm8[i+3] = block_out[i+3].to_unorm8();
-                }
-
-                for (int bz = 0; bz < std::min(block_d, image_d - z*block_d); ++bz) {
-                    for (int by = 0; by < std::min(block_h, image_h - y*block_h); ++by) {
-                        int image_idx = x*block_w + (y*block_h+by) * image_w + (z*block_d+bz) * image_w * image_h;
-                        int block_idx = by * block_w + bz * block_w * block_h;
-                        memcpy(&image_out[image_idx*4], &block_out_unorm8[block_idx*4], std::min(block_w, image_w - x*block_w)*4);
-                    }
-                }
-            }
-        }
-    }
+            img.image_w, img.image_h, img.image_d,
+            img.block_w, img.block_h, img.block_d);
 
-    std::ofstream output(output_fn, std::ios_base::binary | std::ios_base::out);
-    if (!output) {
-        fprintf(stderr, "Failed to open \"%s\" for output\n", output_fn);
+    if (img.image_d > 1 && output_tga) {
+        fprintf(stderr, "3D images cannot be written as .tga\n");
         return 1;
     }
 
-    bool has_alpha = false;
-    for (size_t i = 0; i < image_out.size(); i += 4) {
-        if (image_out[i+3] != 255) {
-            has_alpha = true;
-            break;
-        }
+    oastc::Decoder dec(img.block_w, img.block_h, img.block_d, profile);
+    {
+        oastc::TraceSpan span("build_partition_table");
+        dec.build_partition_table();
     }
 
-    const uint8_t tga_header[18] = {
-        0, 0, 2,
-        0, 0, 0, 0, 0,
-        0, 0, 0, 0,
-        (uint8_t)(image_w & 0xff), (uint8_t)(image_w >> 8),
-        (uint8_t)(image_h & 0xff), (uint8_t)(image_h >> 8),
-        (uint8_t)(has_alpha ? 32 : 24), 0,
-    };
-    output.write((const char *)tga_header, sizeof(tga_header));
-
-    static const size_t output_buffer_px = 4096;
-    std::vector<uint8_t> output_buffer(output_buffer_px * 4);
-
-    for (size_t offset = 0; offset < image_out.size(); offset += output_buffer_px * 4) {
-        uint8_t *p = output_buffer.data();
-        size_t num_px = std::min(output_buffer_px, (image_out.size() - offset) / 4);
-        if (has_alpha) {
-            for (size_t i = 0; i < num_px; ++i) {
-                *p++ = image_out[offset + i*4+2];
-                *p++ = image_out[offset + i*4+1];
-                *p++ = image_out[offset + i*4+0];
-                *p++ = image_out[offset + i*4+3];
+    size_t num_channels = (size_t)img.image_w * img.image_h * img.image_d * 4;
+
+    // HDR output keeps the full fp16 values, unless it's going to an 8-bit format
+    if (hdr && !output_tga) {
+        std::vector<uint16_t> image_out(num_channels);
+        decode_image(dec, img, num_threads, image_out);
+
+        {
+            oastc::TraceSpan span("write");
+            if (output_ktx) {
+                if (!write_ktx_rgba16f(output_fn, img.image_w, img.image_h, img.image_d, image_out))
+                    return 1;
+            } else if (output_raw) {
+                raw_level level = { img.image_w, img.image_h, img.image_d, (const uint8_t *)image_out.data() };
+                if (!write_raw(output_fn, RAW_FORMAT_RGBA16F, { level }))
+                    return 1;
+            } else {
+                if (!write_raw_rgba16f(output_fn, image_out))
+                    return 1;
             }
+        }
+
+        fprintf(stderr, "Wrote '%s'\n", output_fn);
+
+        if (options[PROFILE])
+            print_decode_timing(oastc::get_decode_timing());
+        return 0;
+    }
+
+    std::vector<uint8_t> image_out(num_channels);
+    decode_image(dec, img, num_threads, image_out);
+
+    {
+        oastc::TraceSpan span("write");
+        if (output_ktx) {
+            if (!write_ktx_rgba8(output_fn, img.image_w, img.image_h, img.image_d, srgb, image_out))
+                return 1;
+        } else if (output_raw) {
+            raw_level level = { img.image_w, img.image_h, img.image_d, image_out.data() };
+            if (!write_raw(output_fn, srgb ? RAW_FORMAT_RGBA8_SRGB : RAW_FORMAT_RGBA8_UNORM, { level }))
+                return 1;
         } else {
-            for (size_t i = 0; i < num_px; ++i) {
-                *p++ = image_out[offset + i*4+2];
-                *p++ = image_out[offset + i*4+1];
-                *p++ = image_out[offset + i*4+0];
-            }
+            if (!write_tga(output_fn, img.image_w, img.image_h, image_out))
+                return 1;
         }
-        output.write((const char *)output_buffer.data(), num_px * (has_alpha ? 4 : 3));
     }
 
     fprintf(stderr, "Wrote '%s'\n", output_fn);
+
+    if (options[PROFILE])
+        print_decode_timing(oastc::get_decode_timing());
 }
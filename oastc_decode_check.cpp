@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "oastc.h"
+
+#include "decode_check.h"
+#include "image_io.h"
+#include "optionparser.h"
+#include "test_generator.h"
+
+using oastc::DecodeChecker;
+using oastc::decode_mismatch;
+using oastc::decode_profile;
+
+enum OptionId
+{
+    UNKNOWN,
+    HELP,
+
+    INPUT,
+    TESTGEN,
+    RANDOM,
+    SEED,
+    BLOCK_SIZE,
+    PROFILE,
+};
+
+static const option::Descriptor usage[] =
+{
+    { UNKNOWN,    0, "",  "",        Arg::Unknown,  "Options:" },
+    { HELP,       0, "",  "help",    Arg::None,     "  --help  \tPrint usage and exit" },
+    { INPUT,      0, "i", "input",   Arg::Required, "  -i --input FILENAME  \tCheck every block of this .astc file (may be repeated)" },
+    { TESTGEN,    0, "",  "testgen", Arg::None,     "  --testgen  \tCheck every block that oastc_testgen generates (LDR and HDR) for each block size" },
+    { RANDOM,     0, "n", "random",  Arg::Numeric,  "  -n --random N  \tCheck N random 128-bit blocks per block size (default: 100000 if there is no -i or --testgen)" },
+    { SEED,       0, "",  "seed",    Arg::Numeric,  "  --seed N  \tSeed for the random blocks (default: 1)" },
+    { BLOCK_SIZE, 0, "b", "block",   Arg::Required, "  -b --block WxH[xD]  \tOnly check this block size for --testgen and --random (default: every block size)" },
+    { PROFILE,    0, "",  "profile", Arg::Required, "  --profile NAME  \tOnly check this profile: ldr, srgb or hdr (default: all three)" },
+    { 0,0,0,0,0,0 }
+};
+
+static const int block_sizes[][3] = {
+    { 4, 4, 1 }, { 5, 4, 1 }, { 5, 5, 1 }, { 6, 5, 1 }, { 6, 6, 1 }, { 8, 5, 1 }, { 8, 6, 1 },
+    { 8, 8, 1 }, { 10, 5, 1 }, { 10, 6, 1 }, { 10, 8, 1 }, { 10, 10, 1 }, { 12, 10, 1 }, { 12, 12, 1 },
+    { 3, 3, 3 }, { 4, 3, 3 }, { 4, 4, 3 }, { 4, 4, 4 }, { 5, 4, 4 },
+    { 5, 5, 4 }, { 5, 5, 5 }, { 6, 5, 5 }, { 6, 6, 5 }, { 6, 6, 6 },
+};
+
+static const decode_profile profiles[] = { decode_profile::ldr, decode_profile::ldr_srgb, decode_profile::hdr };
+static const char *const profile_names[] = { "ldr", "srgb", "hdr" };
+
+/**
+ * Checks blocks of one size against the reference decoder in each of the
+ * selected profiles, and remembers the first mismatch
+ */
+class BlockChecker
+{
+public:
+    BlockChecker(int block_w, int block_h, int block_d, const std::vector<int> &profile_idxs)
+    {
+        for (int p : profile_idxs)
+            checkers.emplace_back(p, std::unique_ptr<DecodeChecker>(new DecodeChecker(block_w, block_h, block_d, profiles[p])));
+    }
+
+    /**
+     * Returns false (after printing the mismatch) if any profile disagrees
+     */
+    bool check(const uint8_t *block)
+    {
+        for (auto &c : checkers) {
+            decode_mismatch mismatch;
+            if (!c.second->check(block, mismatch)) {
+                printf("Profile: %s\n", profile_names[c.first]);
+                c.second->print_mismatch(block, mismatch);
+                return false;
+            }
+        }
+        num_checked++;
+        return true;
+    }
+
+    uint64_t num_checked = 0;
+
+private:
+    std::vector<std::pair<int, std::unique_ptr<DecodeChecker>>> checkers;
+};
+
+static bool check_astc_file(const char *filename, const std::vector<int> &profile_idxs)
+{
+    astc_image img;
+    if (!read_astc(filename, img))
+        return false;
+
+    BlockChecker checker(img.block_w, img.block_h, img.block_d, profile_idxs);
+    for (size_t i = 0; i < img.blocks.size(); i += 16) {
+        if (!checker.check(&img.blocks[i])) {
+            printf("(block %llu of \"%s\")\n", (unsigned long long)(i / 16), filename);
+            return false;
+        }
+    }
+
+    fprintf(stderr, "%s: %llu blocks match\n", filename, (unsigned long long)checker.num_checked);
+    return true;
+}
+
+static bool check_testgen(int block_w, int block_h, int block_d, const std::vector<int> &profile_idxs)
+{
+    BlockChecker checker(block_w, block_h, block_d, profile_idxs);
+    oastc::Encoder encoder(block_w, block_h, block_d);
+
+    // The same blocks as oastc_testgen writes: LDR-only endpoint modes, then
+    // all of them
+    for (int hdr = 0; hdr <= 1; ++hdr) {
+        oastc::TestGenerator gen;
+        gen.seed(1);
+        gen.allow_hdr(hdr);
+        gen.show_progress(false);
+        gen.generate_with_block_size(encoder, std::thread::hardware_concurrency());
+
+        for (auto &block : gen.output_blocks())
+            if (!checker.check((const uint8_t *)block.data))
+                return false;
+    }
+
+    fprintf(stderr, "testgen %dx%dx%d: %llu blocks match\n", block_w, block_h, block_d,
+            (unsigned long long)checker.num_checked);
+    return true;
+}
+
+static bool check_random(int block_w, int block_h, int block_d, const std::vector<int> &profile_idxs,
+        int num_blocks, uint32_t seed)
+{
+    BlockChecker checker(block_w, block_h, block_d, profile_idxs);
+    std::mt19937 rng(seed);
+    for (int i = 0; i < num_blocks; ++i) {
+        uint32_t block[4] = { (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng() };
+        if (!checker.check((const uint8_t *)block))
+            return false;
+    }
+
+    fprintf(stderr, "random %dx%dx%d: %llu blocks match\n", block_w, block_h, block_d,
+            (unsigned long long)checker.num_checked);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = nullptr;
+    if (argc > 0) {
+        program_name = argv[0];
+        argc--;
+        argv++;
+    }
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max), buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, options.data(), buffer.data());
+
+    if (parse.error()) {
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (parse.nonOptionsCount()) {
+        std::cerr << "Unknown option '" << parse.nonOption(0) << "'\n";
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (options[HELP]) {
+        std::cout << "USAGE: " << program_name << " [options]\n\n";
+        std::cout << "Check that the decoder's optimised paths match the reference decoder bit for bit.\n"
+                     "Prints the first mismatching block and exits with status 1 if any differ.\n\n";
+        option::printUsage(std::cout, usage);
+        return 0;
+    }
+
+    std::vector<int> profile_idxs;
+    if (options[PROFILE]) {
+        for (int p = 0; p < 3; ++p)
+            if (strcmp(options[PROFILE].arg, profile_names[p]) == 0)
+                profile_idxs.push_back(p);
+        if (profile_idxs.empty()) {
+            fprintf(stderr, "Unrecognised profile \"%s\" - must be ldr, srgb or hdr\n", options[PROFILE].arg);
+            return 1;
+        }
+    } else {
+        profile_idxs = { 0, 1, 2 };
+    }
+
+    int only_w = 0, only_h = 0, only_d = 1;
+    if (options[BLOCK_SIZE]) {
+        int n = sscanf(options[BLOCK_SIZE].arg, "%dx%dx%d", &only_w, &only_h, &only_d);
+        if (n < 2) {
+            fprintf(stderr, "Invalid block size \"%s\" - must be like 6x6 or 4x4x4\n", options[BLOCK_SIZE].arg);
+            return 1;
+        }
+    }
+
+    int num_random = 0;
+    if (options[RANDOM])
+        num_random = atoi(options[RANDOM].arg);
+    else if (!options[INPUT] && !options[TESTGEN])
+        num_random = 100000;
+
+    uint32_t seed = 1;
+    if (options[SEED])
+        seed = atoi(options[SEED].arg);
+
+    for (option::Option *opt = options[INPUT]; opt; opt = opt->next())
+        if (!check_astc_file(opt->arg, profile_idxs))
+            return 1;
+
+    bool any_size = false;
+    for (auto &s : block_sizes) {
+        if (only_w && (s[0] != only_w || s[1] != only_h || s[2] != only_d))
+            continue;
+        any_size = true;
+
+        if (options[TESTGEN] && !check_testgen(s[0], s[1], s[2], profile_idxs))
+            return 1;
+        if (num_random && !check_random(s[0], s[1], s[2], profile_idxs, num_random, seed))
+            return 1;
+    }
+
+    if (!any_size && (options[TESTGEN] || num_random)) {
+        fprintf(stderr, "Invalid block size \"%s\" - not an ASTC block size\n", options[BLOCK_SIZE].arg);
+        return 1;
+    }
+
+    fprintf(stderr, "All blocks match the reference decoder\n");
+    return 0;
+}
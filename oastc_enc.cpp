@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <thread>
+
+#include "oastc.h"
+#include "compress.h"
+
+#include "image_io.h"
+#include "optionparser.h"
+
+enum OptionId
+{
+    UNKNOWN,
+    HELP,
+
+    INPUT,
+    OUTPUT,
+    BLOCK_SIZE,
+    QUALITY,
+    THREADS,
+    INCREMENTAL,
+};
+
+static const option::Descriptor usage[] =
+{
+    { UNKNOWN,    0, "",  "",          Arg::Unknown,  "Options:" },
+    { HELP,       0, "",  "help",      Arg::None,     "  --help  \tPrint usage and exit" },
+    { INPUT,      0, "i", "input",     Arg::Required, "  -i --input FILENAME  \tInput filename (supported formats: .png, .tga)" },
+    { OUTPUT,     0, "o", "output",    Arg::Required, "  -o --output FILENAME  \tOutput filename (supported formats: .astc)" },
+    { BLOCK_SIZE, 0, "b", "block",     Arg::Required, "  -b --block WxH  \tBlock size (default: 6x6)" },
+    { QUALITY,    0, "q", "quality",   Arg::Required, "  -q --quality LEVEL  \tultrafast, fast, medium (default) or thorough" },
+    { THREADS,    0, "j", "threads",   Arg::Numeric,  "  -j --threads N  \tNumber of encoding threads (default: number of CPUs)" },
+    { INCREMENTAL, 0, "", "incremental", Arg::Required, "  --incremental FILENAME  \tStore a hash of each block's texels in FILENAME. If FILENAME and the output file are "
+        "from an earlier run with the same image size and settings, only re-encode the blocks whose texels changed" },
+    { 0,0,0,0,0,0 }
+};
+
+/**
+ * Load the block hashes and .astc file from an earlier --incremental run, if
+ * they exist and were encoded with the same settings as 'current'. Returns
+ * false (after saying why) if every block needs encoding.
+ */
+static bool load_previous_encode(const char *hashes_fn, const char *astc_fn, const block_hashes &current,
+        block_hashes &old_hashes, astc_image &old_astc)
+{
+    if (!std::ifstream(hashes_fn) || !std::ifstream(astc_fn)) {
+        fprintf(stderr, "No previous encode to update; encoding all blocks\n");
+        return false;
+    }
+
+    if (!read_block_hashes(hashes_fn, old_hashes) || !read_astc(astc_fn, old_astc))
+        return false;
+
+    if (old_hashes.block_w != current.block_w || old_hashes.block_h != current.block_h
+            || old_hashes.image_w != current.image_w || old_hashes.image_h != current.image_h
+            || old_hashes.encoder_settings != current.encoder_settings
+            || old_hashes.hashes.size() != current.hashes.size()) {
+        fprintf(stderr, "Image size or settings changed since \"%s\" was written; encoding all blocks\n", hashes_fn);
+        return false;
+    }
+
+    if (old_astc.block_w != current.block_w || old_astc.block_h != current.block_h || old_astc.block_d != 1
+            || old_astc.image_w != current.image_w || old_astc.image_h != current.image_h || old_astc.image_d != 1
+            || oastc::hash_bytes(old_astc.blocks.data(), old_astc.blocks.size()) != old_hashes.astc_hash) {
+        fprintf(stderr, "\"%s\" was not written with \"%s\"; encoding all blocks\n", astc_fn, hashes_fn);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = nullptr;
+    if (argc > 0) {
+        program_name = argv[0];
+        argc--;
+        argv++;
+    }
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max), buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, options.data(), buffer.data());
+
+    if (parse.error()) {
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (parse.nonOptionsCount()) {
+        std::cerr << "Unknown option '" << parse.nonOption(0) << "'\n";
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (options[HELP] || !options[INPUT] || !options[OUTPUT]) {
+        std::cout << "USAGE: " << program_name << " --input FILENAME --output FILENAME [options]\n\n";
+        option::printUsage(std::cout, usage);
+        return 0;
+    }
+
+    const char *input_fn = options[INPUT].arg;
+    const char *output_fn = options[OUTPUT].arg;
+
+    int block_w = 6, block_h = 6;
+    if (options[BLOCK_SIZE]) {
+        if (sscanf(options[BLOCK_SIZE].arg, "%dx%d", &block_w, &block_h) != 2 || !is_valid_block_size(block_w, block_h)) {
+            fprintf(stderr, "Invalid block size \"%s\" - must be a 2D ASTC block size like 6x6\n", options[BLOCK_SIZE].arg);
+            return 1;
+        }
+    }
+
+    oastc::compress_quality quality = oastc::compress_quality::medium;
+    if (options[QUALITY]) {
+        const char *arg = options[QUALITY].arg;
+        if (strcmp(arg, "ultrafast") == 0) {
+            quality = oastc::compress_quality::ultrafast;
+        } else if (strcmp(arg, "fast") == 0) {
+            quality = oastc::compress_quality::fast;
+        } else if (strcmp(arg, "medium") == 0) {
+            quality = oastc::compress_quality::medium;
+        } else if (strcmp(arg, "thorough") == 0) {
+            quality = oastc::compress_quality::thorough;
+        } else {
+            fprintf(stderr, "Unrecognised quality \"%s\" - must be ultrafast, fast, medium or thorough\n", arg);
+            return 1;
+        }
+    }
+
+    int num_threads = std::thread::hardware_concurrency();
+    if (options[THREADS])
+        num_threads = atoi(options[THREADS].arg);
+
+    if (!has_extension(output_fn, ".astc")) {
+        fprintf(stderr, "Unrecognised output format for \"%s\" - must be .astc\n", output_fn);
+        return 1;
+    }
+
+    int image_w, image_h;
+    std::vector<uint8_t> image;
+    if (!read_image(input_fn, image_w, image_h, image))
+        return 1;
+
+    fprintf(stderr, "Encoding '%s' (image size %dx%d, block size %dx%d)\n",
+            input_fn, image_w, image_h, block_w, block_h);
+
+    oastc::Compressor comp(block_w, block_h, quality);
+
+    int blocks_x = (image_w + block_w - 1) / block_w;
+    int blocks_y = (image_h + block_h - 1) / block_h;
+    std::vector<uint8_t> blocks((size_t)blocks_x * blocks_y * 16);
+
+    if (options[INCREMENTAL]) {
+        const char *hashes_fn = options[INCREMENTAL].arg;
+
+        block_hashes hashes;
+        hashes.block_w = block_w;
+        hashes.block_h = block_h;
+        hashes.image_w = image_w;
+        hashes.image_h = image_h;
+        hashes.encoder_settings = (uint32_t)quality;
+        hashes.hashes.resize((size_t)blocks_x * blocks_y);
+        comp.hash_blocks(image.data(), image_w, image_h, (size_t)image_w * 4, hashes.hashes.data(), num_threads);
+
+        block_hashes old_hashes;
+        astc_image old_astc;
+        if (load_previous_encode(hashes_fn, output_fn, hashes, old_hashes, old_astc)) {
+            blocks = std::move(old_astc.blocks);
+            int num_changed = comp.compress_changed_blocks(image.data(), image_w, image_h, (size_t)image_w * 4,
+                    old_hashes.hashes.data(), hashes.hashes.data(), blocks.data(), num_threads);
+            fprintf(stderr, "Re-encoded %d of %d blocks\n", num_changed, blocks_x * blocks_y);
+        } else {
+            comp.compress_image(image.data(), image_w, image_h, (size_t)image_w * 4, blocks.data(), num_threads);
+        }
+
+        if (!write_astc(output_fn, block_w, block_h, 1, image_w, image_h, 1, blocks))
+            return 1;
+
+        // Written after the .astc file, so if that failed part-way through,
+        // the stale hashes won't match it and the next run encodes everything
+        hashes.astc_hash = oastc::hash_bytes(blocks.data(), blocks.size());
+        if (!write_block_hashes(hashes_fn, hashes))
+            return 1;
+    } else {
+        oastc::compress_stats stats;
+        comp.compress_image(image.data(), image_w, image_h, (size_t)image_w * 4, blocks.data(), num_threads, &stats);
+        if (stats.seeded_blocks) {
+            fprintf(stderr, "Seeded %llu of %llu blocks with neighbours' block modes: %llu accepted without a full search, "
+                    "%llu still best after one\n",
+                    (unsigned long long)stats.seeded_blocks, (unsigned long long)stats.blocks,
+                    (unsigned long long)stats.seed_accepted, (unsigned long long)stats.seed_best);
+        }
+
+        if (!write_astc(output_fn, block_w, block_h, 1, image_w, image_h, 1, blocks))
+            return 1;
+    }
+
+    fprintf(stderr, "Wrote '%s'\n", output_fn);
+}
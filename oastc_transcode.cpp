@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "oastc.h"
+#include "transcode.h"
+
+#include "image_io.h"
+#include "optionparser.h"
+
+enum OptionId
+{
+    UNKNOWN,
+    HELP,
+
+    INPUT,
+    OUTPUT,
+    FORMAT,
+    THREADS,
+    SRGB,
+};
+
+static const option::Descriptor usage[] =
+{
+    { UNKNOWN,  0, "",  "",          Arg::Unknown,  "Options:" },
+    { HELP,     0, "",  "help",      Arg::None,     "  --help  \tPrint usage and exit" },
+    { INPUT,    0, "i", "input",     Arg::Required, "  -i --input FILENAME  \tInput filename (supported formats: 2D .astc)" },
+    { OUTPUT,   0, "o", "output",    Arg::Required, "  -o --output FILENAME  \tOutput filename (supported formats: .ktx)" },
+    { FORMAT,   0, "f", "format",    Arg::Required, "  -f --format FORMAT  \tOutput compression format: bc7 (default) or bc1" },
+    { THREADS,  0, "j", "threads",   Arg::Numeric,  "  -j --threads N  \tNumber of transcoding threads (default: number of CPUs)" },
+    { SRGB,     0, "",  "srgb",      Arg::None,     "  --srgb  \tDecode using the sRGB profile, and output an sRGB texture" },
+    { 0,0,0,0,0,0 }
+};
+
+// Number of rows of 4x4 tiles that each thread transcodes at once. The ASTC
+// blocks covering those rows are decoded once into a shared buffer, so larger
+// bands waste less work on ASTC blocks that straddle two bands
+static const int tile_rows_per_band = 8;
+
+/**
+ * Transcode the tiles in rows [tile_y_begin, tile_y_end) into 'output'
+ * (bytes_per_tile bytes per 4x4 tile)
+ */
+static void transcode_band(const oastc::Transcoder &tc, const astc_image &img, bool bc1,
+        int tile_y_begin, int tile_y_end, std::vector<oastc::transcode_texel> &texels, uint8_t *output)
+{
+    int bytes_per_tile = bc1 ? 8 : 16;
+    int tiles_x = (img.image_w + 3) / 4;
+
+    // Decode all the ASTC blocks that overlap this band (with texel rows
+    // past the bottom of the image clamped to the last row)
+    int y_first = tile_y_begin * 4;
+    int y_last = std::min(tile_y_end * 4, img.image_h) - 1;
+    int block_y_begin = y_first / img.block_h;
+    int block_y_end = y_last / img.block_h + 1;
+
+    int stride = img.blocks_x * img.block_w;
+    texels.resize((size_t)stride * (block_y_end - block_y_begin) * img.block_h);
+
+    for (int by = block_y_begin; by < block_y_end; ++by) {
+        for (int bx = 0; bx < img.blocks_x; ++bx) {
+            oastc::transcode_texel block_texels[12*12];
+            const uint8_t *block = &img.blocks[((size_t)by * img.blocks_x + bx) * 16];
+
+            oastc::decode_error err = tc.decode_block(block, block_texels);
+            if (err != oastc::decode_error::ok)
+                printf("Decode error %d\n", (int)err);
+
+            for (int y = 0; y < img.block_h; ++y) {
+                memcpy(&texels[(size_t)((by - block_y_begin) * img.block_h + y) * stride + bx * img.block_w],
+                        &block_texels[y * img.block_w], img.block_w * sizeof(oastc::transcode_texel));
+            }
+        }
+    }
+
+    for (int ty = tile_y_begin; ty < tile_y_end; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            // Partial tiles at the image edges repeat the edge texels
+            oastc::transcode_texel tile[16];
+            for (int y = 0; y < 4; ++y) {
+                int sy = std::min(ty * 4 + y, img.image_h - 1) - block_y_begin * img.block_h;
+                for (int x = 0; x < 4; ++x) {
+                    int sx = std::min(tx * 4 + x, img.image_w - 1);
+                    tile[y * 4 + x] = texels[(size_t)sy * stride + sx];
+                }
+            }
+
+            uint8_t *out = &output[((size_t)ty * tiles_x + tx) * bytes_per_tile];
+            if (bc1)
+                oastc::Transcoder::encode_bc1(tile, out);
+            else
+                oastc::Transcoder::encode_bc7(tile, out);
+        }
+    }
+}
+
+static void transcode_image(const oastc::Transcoder &tc, const astc_image &img, bool bc1,
+        int num_threads, std::vector<uint8_t> &output)
+{
+    int tiles_y = (img.image_h + 3) / 4;
+    int num_bands = (tiles_y + tile_rows_per_band - 1) / tile_rows_per_band;
+
+    std::atomic<int> next_band(0);
+
+    auto worker = [&]() {
+        std::vector<oastc::transcode_texel> texels;
+        int band;
+        while ((band = next_band++) < num_bands) {
+            int begin = band * tile_rows_per_band;
+            int end = std::min(begin + tile_rows_per_band, tiles_y);
+            transcode_band(tc, img, bc1, begin, end, texels, output.data());
+        }
+    };
+
+    num_threads = std::max(1, std::min(num_threads, num_bands));
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = nullptr;
+    if (argc > 0) {
+        program_name = argv[0];
+        argc--;
+        argv++;
+    }
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max), buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, options.data(), buffer.data());
+
+    if (parse.error()) {
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (parse.nonOptionsCount()) {
+        std::cerr << "Unknown option '" << parse.nonOption(0) << "'\n";
+        std::cerr << "Run '" << program_name << " --help' for supported options\n";
+        return 1;
+    }
+
+    if (options[HELP] || !options[INPUT] || !options[OUTPUT]) {
+        std::cout << "USAGE: " << program_name << " --input FILENAME --output FILENAME [options]\n\n";
+        option::printUsage(std::cout, usage);
+        return 0;
+    }
+
+    const char *input_fn = options[INPUT].arg;
+    const char *output_fn = options[OUTPUT].arg;
+
+    bool srgb = options[SRGB];
+
+    bool bc1 = false;
+    if (options[FORMAT]) {
+        const char *format = options[FORMAT].arg;
+        if (strcasecmp(format, "bc1") == 0) {
+            bc1 = true;
+        } else if (strcasecmp(format, "bc7") != 0) {
+            fprintf(stderr, "Unrecognised format \"%s\" - must be bc7 or bc1\n", format);
+            return 1;
+        }
+    }
+
+    int num_threads = std::thread::hardware_concurrency();
+    if (options[THREADS])
+        num_threads = atoi(options[THREADS].arg);
+
+    if (!has_extension(output_fn, ".ktx")) {
+        fprintf(stderr, "Unrecognised output format for \"%s\" - must be .ktx\n", output_fn);
+        return 1;
+    }
+
+    astc_image img;
+    if (!read_astc(input_fn, img))
+        return 1;
+
+    fprintf(stderr, "Transcoding '%s' (image size %dx%dx%d, block size %dx%dx%d) to %s\n",
+            input_fn,
+            img.image_w, img.image_h, img.image_d,
+            img.block_w, img.block_h, img.block_d,
+            bc1 ? "BC1" : "BC7");
+
+    if (img.block_d != 1 || img.image_d != 1) {
+        fprintf(stderr, "Only 2D images can be transcoded\n");
+        return 1;
+    }
+
+    oastc::Transcoder tc(img.block_w, img.block_h,
+            srgb ? oastc::decode_profile::ldr_srgb : oastc::decode_profile::ldr);
+
+    int tiles_x = (img.image_w + 3) / 4;
+    int tiles_y = (img.image_h + 3) / 4;
+    std::vector<uint8_t> output((size_t)tiles_x * tiles_y * (bc1 ? 8 : 16));
+
+    transcode_image(tc, img, bc1, num_threads, output);
+
+    uint32_t internal_format, base_internal_format;
+    if (bc1) {
+        internal_format = srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT_ : GL_COMPRESSED_RGB_S3TC_DXT1_EXT_;
+        base_internal_format = GL_RGB_;
+    } else {
+        internal_format = srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ : GL_COMPRESSED_RGBA_BPTC_UNORM_;
+        base_internal_format = GL_RGBA_;
+    }
+
+    // Compressed formats have glType = glFormat = 0 and glTypeSize = 1
+    if (!write_ktx(output_fn, img.image_w, img.image_h, 1, 0, 1, 0,
+            internal_format, base_internal_format, output.data(), output.size()))
+        return 1;
+
+    fprintf(stderr, "Wrote '%s'\n", output_fn);
+}
@@ -48,4 +48,17 @@ struct Arg : public option::Arg
             printError("Option '", option, "' requires an argument\n");
         return option::ARG_ILLEGAL;
     }
+
+    static option::ArgStatus Numeric(const option::Option& option, bool msg)
+    {
+        char* endptr = 0;
+        if (option.arg != 0)
+            strtol(option.arg, &endptr, 10);
+        if (endptr != 0 && endptr != option.arg && *endptr == 0)
+            return option::ARG_OK;
+
+        if (msg)
+            printError("Option '", option, "' requires a numeric argument\n");
+        return option::ARG_ILLEGAL;
+    }
 };
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_OASTC_PARALLEL
+#define INCLUDED_OASTC_PARALLEL
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace oastc
+{
+
+/**
+ * A range of chunk indexes [begin, end) that its owner takes from the front
+ * of and other threads steal from the back of. Both ends are packed into
+ * one atomic word so every update is a single compare-and-swap.
+ */
+class ChunkQueue
+{
+public:
+    ChunkQueue() : range(0) { }
+
+    void reset(uint32_t begin, uint32_t end)
+    {
+        range.store(pack(begin, end));
+    }
+
+    /**
+     * Take the first chunk. Returns false if the queue is empty.
+     */
+    bool pop_front(uint32_t &chunk)
+    {
+        uint64_t r = range.load();
+        while (begin(r) < end(r)) {
+            if (range.compare_exchange_weak(r, pack(begin(r) + 1, end(r)))) {
+                chunk = begin(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Take the second half of the remaining chunks (at least one).
+     * Returns false if the queue is empty.
+     */
+    bool steal_back(uint32_t &stolen_begin, uint32_t &stolen_end)
+    {
+        uint64_t r = range.load();
+        while (begin(r) < end(r)) {
+            uint32_t mid = end(r) - (end(r) - begin(r) + 1) / 2;
+            if (range.compare_exchange_weak(r, pack(begin(r), mid))) {
+                stolen_begin = mid;
+                stolen_end = end(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t)end << 32) | begin; }
+    static uint32_t begin(uint64_t r) { return (uint32_t)r; }
+    static uint32_t end(uint64_t r) { return (uint32_t)(r >> 32); }
+
+    std::atomic<uint64_t> range;
+
+    // Keep each queue on its own cache line
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+/**
+ * Call fn(begin, end) for consecutive ranges of at most chunk_size items
+ * covering [0, num_items), using num_threads threads (including the calling
+ * thread).
+ *
+ * Each thread starts with an equal contiguous share of the chunks, so
+ * neighbouring chunks (which often touch neighbouring memory) stay on the
+ * same thread. A thread that runs out steals half of the remaining chunks
+ * from another thread, so uneven chunk costs are balanced without a single
+ * shared counter. Which thread runs a chunk is not deterministic, so fn must
+ * write its results to locations determined only by the range.
+ */
+template<typename F>
+static void parallel_for_chunks(int num_items, int chunk_size, int num_threads, F fn)
+{
+    if (num_items <= 0)
+        return;
+
+    int num_chunks = (num_items + chunk_size - 1) / chunk_size;
+    num_threads = std::max(1, std::min(num_threads, num_chunks));
+
+    std::unique_ptr<ChunkQueue[]> queues(new ChunkQueue[num_threads]);
+    for (int i = 0; i < num_threads; ++i)
+        queues[i].reset((uint64_t)num_chunks * i / num_threads, (uint64_t)num_chunks * (i + 1) / num_threads);
+
+    auto worker = [&](int self) {
+        while (true) {
+            uint32_t chunk;
+            while (queues[self].pop_front(chunk)) {
+                int begin = chunk * chunk_size;
+                fn(begin, std::min(begin + chunk_size, num_items));
+            }
+
+            // Steal from the next thread that has any work left. No new work
+            // is ever created, so if every queue is empty we're done
+            bool stole = false;
+            for (int i = 1; i < num_threads && !stole; ++i) {
+                uint32_t stolen_begin, stolen_end;
+                if (queues[(self + i) % num_threads].steal_back(stolen_begin, stolen_end)) {
+                    queues[self].reset(stolen_begin, stolen_end);
+                    stole = true;
+                }
+            }
+            if (!stole)
+                return;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker, i);
+    worker(0);
+    for (auto &t : threads)
+        t.join();
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_PARALLEL
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_PARTITIONS
+#define INCLUDED_OASTC_PARTITIONS
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "oastc.h"
+
+namespace oastc
+{
+
+/**
+ * The distinct partitionings that select_partition() can produce for one
+ * block size, as bitmasks of the texels in each partition.
+ *
+ * Of the 1024 partition indexes for each partition count, many give the
+ * same partitioning once the partitions are relabelled, and many leave some
+ * partitions empty (especially in small blocks). An encoder only needs to
+ * consider one index for each distinct partitioning, so this keeps the first
+ * index that produces each one and drops the degenerate ones.
+ */
+class PartitionLibrary
+{
+public:
+    // Enough bits for the largest (6x6x6) block size
+    static const int max_words = 4;
+
+    struct pattern
+    {
+        int partition_index;
+        int num_parts;
+        uint64_t masks[4][max_words]; // [partition][texel / 64]
+    };
+
+    PartitionLibrary(int block_w, int block_h, int block_d);
+
+    /**
+     * The distinct non-degenerate patterns with num_parts (2..4) partitions,
+     * in order of partition index
+     */
+    const std::vector<pattern> &patterns(int num_parts) const;
+
+    /**
+     * Find the patterns with num_parts partitions that best match the
+     * texels' colours, by clustering the colours into num_parts groups and
+     * counting how many texels each pattern puts in a different group.
+     * Writes up to max_results indexes into patterns(num_parts) to
+     * 'results', best first, and returns how many were written.
+     */
+    int rank(const uint8x4_t *texels, int num_parts, int max_results, int *results) const;
+
+    /**
+     * Returns the partition (0..num_parts-1) of texel 'idx' in pattern p
+     */
+    static int texel_partition(const pattern &p, int idx);
+
+    int block_w, block_h, block_d;
+
+private:
+    int num_texels;
+    int num_words;
+
+    std::vector<pattern> by_parts[3];
+};
+
+/**
+ * Group the texels' colours into k clusters with a few iterations of
+ * k-means, and write each texel's cluster (0..k-1) to 'labels'. The initial
+ * centres are chosen deterministically, by repeatedly picking the colour
+ * furthest from the centres so far.
+ */
+static void cluster_texels(const uint8x4_t *texels, int num_texels, int k, uint8_t *labels)
+{
+    ASSERT(k >= 1 && k <= 4);
+
+    float mean[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < num_texels; ++i)
+        for (int c = 0; c < 4; ++c)
+            mean[c] += texels[i].v[c];
+    for (int c = 0; c < 4; ++c)
+        mean[c] /= num_texels;
+
+    auto dist2 = [](const uint8x4_t &t, const float *centre) {
+        float d = 0;
+        for (int c = 0; c < 4; ++c)
+            d += (t.v[c] - centre[c]) * (t.v[c] - centre[c]);
+        return d;
+    };
+
+    // Start with the colour furthest from the mean, then repeatedly add the
+    // colour furthest from its nearest centre
+    float centres[4][4];
+    float nearest[216];
+    for (int i = 0; i < num_texels; ++i)
+        nearest[i] = dist2(texels[i], mean);
+    int num_centres = 0;
+    while (num_centres < k) {
+        int furthest = 0;
+        for (int i = 1; i < num_texels; ++i)
+            if (nearest[i] > nearest[furthest])
+                furthest = i;
+        // Fewer distinct colours than clusters: leave the rest empty
+        if (num_centres > 0 && nearest[furthest] == 0)
+            break;
+        float *centre = centres[num_centres++];
+        for (int c = 0; c < 4; ++c)
+            centre[c] = texels[furthest].v[c];
+        for (int i = 0; i < num_texels; ++i)
+            nearest[i] = (num_centres == 1) ? dist2(texels[i], centre) : std::min(nearest[i], dist2(texels[i], centre));
+    }
+
+    for (int iter = 0; iter < 4; ++iter) {
+        for (int i = 0; i < num_texels; ++i) {
+            int best = 0;
+            float best_d = dist2(texels[i], centres[0]);
+            for (int j = 1; j < num_centres; ++j) {
+                float d = dist2(texels[i], centres[j]);
+                if (d < best_d) {
+                    best_d = d;
+                    best = j;
+                }
+            }
+            labels[i] = best;
+        }
+
+        float sum[4][4] = {};
+        int count[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < num_texels; ++i) {
+            count[labels[i]]++;
+            for (int c = 0; c < 4; ++c)
+                sum[labels[i]][c] += texels[i].v[c];
+        }
+        for (int j = 0; j < num_centres; ++j)
+            if (count[j])
+                for (int c = 0; c < 4; ++c)
+                    centres[j][c] = sum[j][c] / count[j];
+    }
+}
+
+PartitionLibrary::PartitionLibrary(int block_w, int block_h, int block_d)
+  : block_w(block_w), block_h(block_h), block_d(block_d)
+{
+    num_texels = block_w * block_h * block_d;
+    num_words = (num_texels + 63) / 64;
+    ASSERT(num_words <= max_words);
+    bool small_block = num_texels < 31;
+
+    for (int num_parts = 2; num_parts <= 4; ++num_parts) {
+        std::set<std::vector<uint8_t>> seen;
+        for (int seed = 0; seed < 1024; ++seed) {
+            // Relabel the partitions in order of their first texel, so
+            // patterns that differ only by labelling compare equal
+            std::vector<uint8_t> canonical(num_texels);
+            int relabel[4] = { -1, -1, -1, -1 };
+            int used = 0;
+            int idx = 0;
+            for (int z = 0; z < block_d; ++z) {
+                for (int y = 0; y < block_h; ++y) {
+                    for (int x = 0; x < block_w; ++x) {
+                        int p = select_partition(seed, x, y, z, num_parts, small_block);
+                        if (relabel[p] < 0)
+                            relabel[p] = used++;
+                        canonical[idx++] = relabel[p];
+                    }
+                }
+            }
+
+            if (used < num_parts || !seen.insert(canonical).second)
+                continue;
+
+            // Store the masks with the decoder's labelling, so the encoder
+            // can use them with partition_index directly
+            pattern pat;
+            pat.partition_index = seed;
+            pat.num_parts = num_parts;
+            memset(pat.masks, 0, sizeof(pat.masks));
+            for (int i = 0; i < num_texels; ++i) {
+                int p = 0;
+                while (relabel[p] != canonical[i])
+                    ++p;
+                pat.masks[p][i / 64] |= (uint64_t)1 << (i % 64);
+            }
+            by_parts[num_parts - 2].push_back(pat);
+        }
+    }
+}
+
+const std::vector<PartitionLibrary::pattern> &PartitionLibrary::patterns(int num_parts) const
+{
+    ASSERT(num_parts >= 2 && num_parts <= 4);
+    return by_parts[num_parts - 2];
+}
+
+int PartitionLibrary::texel_partition(const pattern &p, int idx)
+{
+    for (int j = 0; j < p.num_parts - 1; ++j)
+        if (p.masks[j][idx / 64] & ((uint64_t)1 << (idx % 64)))
+            return j;
+    return p.num_parts - 1;
+}
+
+int PartitionLibrary::rank(const uint8x4_t *texels, int num_parts, int max_results, int *results) const
+{
+    uint8_t labels[216];
+    cluster_texels(texels, num_texels, num_parts, labels);
+
+    uint64_t clusters[4][max_words] = {};
+    for (int i = 0; i < num_texels; ++i)
+        clusters[labels[i]][i / 64] |= (uint64_t)1 << (i % 64);
+
+    // Every way of matching the pattern's partitions to the clusters
+    int perms[24][4];
+    int num_perms = 0;
+    int perm[4] = { 0, 1, 2, 3 };
+    do {
+        memcpy(perms[num_perms++], perm, sizeof(perm));
+    } while (std::next_permutation(perm, perm + num_parts));
+
+    const std::vector<pattern> &list = patterns(num_parts);
+    std::vector<std::pair<int, int>> scored(list.size());
+    for (size_t n = 0; n < list.size(); ++n) {
+        int overlap[4][4];
+        for (int p = 0; p < num_parts; ++p) {
+            for (int c = 0; c < num_parts; ++c) {
+                int count = 0;
+                for (int w = 0; w < num_words; ++w)
+                    count += __builtin_popcountll(list[n].masks[p][w] & clusters[c][w]);
+                overlap[p][c] = count;
+            }
+        }
+
+        int best_match = 0;
+        for (int i = 0; i < num_perms; ++i) {
+            int match = 0;
+            for (int p = 0; p < num_parts; ++p)
+                match += overlap[p][perms[i][p]];
+            best_match = std::max(best_match, match);
+        }
+
+        // Sort by mismatches, then by position in the list
+        scored[n] = std::make_pair(num_texels - best_match, (int)n);
+    }
+
+    int num_results = std::min(max_results, (int)scored.size());
+    std::partial_sort(scored.begin(), scored.begin() + num_results, scored.end());
+    for (int i = 0; i < num_results; ++i)
+        results[i] = scored[i].second;
+    return num_results;
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_PARTITIONS
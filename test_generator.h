@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_OASTC_TEST_GENERATOR
+#define INCLUDED_OASTC_TEST_GENERATOR
+
+#include "oastc.h"
+#include "configs.h"
+#include "parallel.h"
+
+#include <random>
+#include <sstream>
+#include <fstream>
+
+namespace oastc
+{
+
+static bool VERBOSE_TEST = false;
+static bool TEST_GENERATE_INVALID_BLOCKS = false;
+
+class TestGenerator
+{
+public:
+    TestGenerator();
+
+    void seed(uint32_t val) { m_seed = val; m_rng.seed(val); }
+    void allow_hdr(bool allow) { m_allow_hdr = allow; }
+    void show_progress(bool show) { m_show_progress = show; }
+
+    /**
+     * Generate blocks for every block mode and endpoint mode combination.
+     * Each block mode is a separate shard with its own random number
+     * generator, seeded from the seed(), the block size and the block mode,
+     * so the output is the same for any num_threads.
+     */
+    void generate_with_block_size(const Encoder &encoder, int num_threads = 1);
+    bool write_output_file(const Encoder &encoder);
+
+    /**
+     * A block mode (and, for dual-plane modes, colour component selector)
+     * that generate_with_block_size() covers
+     */
+    struct block_mode
+    {
+        int dual_plane, colour_component_selector, high_prec, wt_range;
+        int wt_w, wt_h, wt_d;
+    };
+
+    /**
+     * Every legal block_mode for the encoder's block size, in the order
+     * generate_with_block_size() uses them
+     */
+    static std::vector<block_mode> block_modes(const Encoder &encoder);
+
+    /**
+     * Generate blocks for one block mode, with every partition count and
+     * endpoint mode combination. The random number generator is seeded the
+     * same way as the shard for this block mode in generate_with_block_size()
+     */
+    void generate_with_block_mode(const Encoder &encoder, const block_mode &mode);
+
+    /**
+     * The blocks generated since the last write_output_file() or
+     * clear_output_blocks()
+     */
+    const std::vector<OutputBitVector> &output_blocks() const { return m_output_blocks; }
+    void clear_output_blocks() { m_output_blocks.clear(); }
+
+private:
+    uint32_t shard_seed(const Encoder &encoder, const block_mode &mode) const;
+
+    uint32_t m_seed;
+    std::mt19937 m_rng;
+
+    bool m_allow_hdr;
+    bool m_show_progress;
+    int m_count;
+
+    std::vector<OutputBitVector> m_output_blocks;
+
+    void write_encoded_block(const OutputBitVector &data);
+    void generate_with_cems(const Encoder &encoder, Block blk, bool is_multi_cem, int base, int cem0, int cem1, int cem2, int cem3);
+    void generate_with_block_mode(const Encoder &encoder, Block blk, int wt_w, int wt_h, int wt_d);
+};
+
+TestGenerator::TestGenerator()
+    : m_seed(std::mt19937::default_seed), m_allow_hdr(false), m_show_progress(true), m_count(0)
+{
+}
+
+void TestGenerator::write_encoded_block(const OutputBitVector &data)
+{
+    m_output_blocks.push_back(data);
+}
+
+bool TestGenerator::write_output_file(const Encoder &encoder)
+{
+    uint32_t magic = 0x5ca1ab13;
+    uint8_t block_w = encoder.block_w;
+    uint8_t block_h = encoder.block_h;
+    uint8_t block_d = encoder.block_d;
+
+    size_t block_start = 0;
+    int idx = 0;
+
+    while (block_start < m_output_blocks.size()) {
+        std::stringstream filename;
+        filename << (m_allow_hdr ? "testgen_hdr_" : "testgen_") << (int)block_w << "x" << (int)block_h << "x" << (int)block_d << "-" << idx++ << ".astc";
+        std::ofstream out(filename.str(), std::ios::binary);
+        if (!out) {
+            fprintf(stderr, "Failed to open output file '%s'\n", filename.str().c_str());
+            return false;
+        }
+
+        int image_w = block_w * (4096 / block_w);
+        int image_h = block_h * std::min((image_w / block_w) + 1, 4096 / block_h);
+        int image_d = block_d;
+
+        uint8_t header[16];
+        memcpy(&header[0], &magic, 4);
+        header[4] = block_w;
+        header[5] = block_h;
+        header[6] = block_d;
+        header[7] = image_w & 0xff;
+        header[8] = (image_w >> 8) & 0xff;
+        header[9] = (image_w >> 16) & 0xff;
+        header[10] = image_h & 0xff;
+        header[11] = (image_h >> 8) & 0xff;
+        header[12] = (image_h >> 16) & 0xff;
+        header[13] = image_d & 0xff;
+        header[14] = (image_d >> 8) & 0xff;
+        header[15] = (image_d >> 16) & 0xff;
+
+        out.write((const char *)&header, 16);
+
+        size_t num_blocks = (image_w / block_w) * (image_h / block_h) * (image_d / block_d);
+
+        size_t i;
+        for (i = 0; i < num_blocks && i + block_start < m_output_blocks.size(); ++i) {
+            out.write((const char *)m_output_blocks[i + block_start].data, 16);
+        }
+        for (; i < num_blocks; ++i) {
+            // Void extent, black
+            uint8_t dummy[16] = { 0b11111100, 0b11111101, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0b11111111, 0 };
+            out.write((const char *)dummy, 16);
+        }
+
+        block_start += num_blocks;
+    }
+
+    m_output_blocks.clear();
+
+    return true;
+}
+
+void TestGenerator::generate_with_cems(const Encoder &encoder, Block blk, bool is_multi_cem, int base, int cem0, int cem1, int cem2, int cem3)
+{
+    if (blk.dual_plane && blk.num_parts == 4) {
+        blk.is_error = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    if (!m_allow_hdr) {
+        int hdr_only[] = { 0, 0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1 };
+        if (hdr_only[cem0+1] || hdr_only[cem1+1] || hdr_only[cem2+1] || hdr_only[cem3+1])
+            return;
+    }
+
+    blk.is_multi_cem = is_multi_cem;
+    blk.cem_base_class = base;
+    blk.cems[0] = cem0;
+    blk.cems[1] = cem1;
+    blk.cems[2] = cem2;
+    blk.cems[3] = cem3;
+
+    int num_cem_pairs = (cem0 >> 2) + 1;
+    if (blk.num_parts > 1)
+        num_cem_pairs += (cem1 >> 2) + 1;
+    if (blk.num_parts > 2)
+        num_cem_pairs += (cem2 >> 2) + 1;
+    if (blk.num_parts > 3)
+        num_cem_pairs += (cem3 >> 2) + 1;
+
+    blk.num_cem_values = num_cem_pairs * 2;
+
+    // Specified as illegal
+    if (blk.num_cem_values > 18) {
+        blk.is_error = true;
+        blk.bogus_colour_endpoints = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    blk.calculate_remaining_bits();
+
+    // Specified as illegal
+    if (blk.remaining_bits < (13 * blk.num_cem_values + 4) / 5) {
+        blk.is_error = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    decode_error err = blk.calculate_colour_endpoints_size();
+    if (err != decode_error::ok)
+        blk.bogus_colour_endpoints = true;
+
+    if (!TEST_GENERATE_INVALID_BLOCKS)
+        ASSERT(!blk.is_error && !blk.bogus_colour_endpoints && !blk.bogus_weights);
+
+
+    // Now we just need to pick some weights and colours.
+    // We know the vector lengths and ranges, so just do random numbers in those ranges.
+
+    if (!blk.bogus_weights) {
+        memset(blk.weights_quant, 0, sizeof(blk.weights_quant));
+        std::uniform_int_distribution<> weight_dist(0, blk.wt_max);
+
+        ASSERT(blk.num_weights <= ARRAY_SIZE(blk.weights_quant));
+        for (int i = 0; i < blk.num_weights; ++i)
+            blk.weights_quant[i] = weight_dist(m_rng);
+
+        blk.unquantise_weights();
+    }
+
+    if (!blk.bogus_colour_endpoints) {
+        memset(blk.colour_endpoints_quant, 0, sizeof(blk.colour_endpoints_quant));
+        std::uniform_int_distribution<> ce_dist(0, blk.ce_max);
+
+        ASSERT(blk.num_cem_values <= ARRAY_SIZE(blk.colour_endpoints_quant));
+        for (int i = 0; i < blk.num_cem_values; ++i)
+            blk.colour_endpoints_quant[i] = ce_dist(m_rng);
+
+        blk.unquantise_colour_endpoints();
+    }
+
+    if (blk.num_parts > 1) {
+        // TODO: loop over some different partition indexes (probably not all of them)
+        std::uniform_int_distribution<> part_dist(0, 1023);
+        blk.partition_index = part_dist(m_rng);
+    } else {
+        blk.partition_index = -1;
+    }
+
+    if (VERBOSE_TEST) {
+        printf("Test case:\n");
+        blk.print();
+        printf("\n");
+    }
+
+    OutputBitVector encoded = blk.encode(encoder);
+
+    write_encoded_block(encoded);
+
+    // Verify our encoder and decoder by checking that the decoded output
+    // matches the data we tried to encode
+
+    InputBitVector block;
+    memcpy(block.data, encoded.data, sizeof(block.data));
+    Block decoded;
+
+    Decoder decoder(encoder.block_w, encoder.block_h, encoder.block_d);
+    err = decoded.decode_header(decoder, block, decoder.profile);
+    if (err == decode_error::ok) {
+        // Only the stages whose results are checked below (the rest of
+        // decoding is tested against the reference by oastc_decode_check)
+        decoded.unpack_colour_endpoints(block);
+        decoded.unquantise_colour_endpoints();
+        decoded.unpack_weights(block);
+        decoded.unquantise_weights();
+    }
+    if (blk.is_error) {
+        ASSERT(err != decode_error::ok);
+
+        if (VERBOSE_TEST) {
+            printf("Decoded: error (as expected)\n");
+        }
+    } else {
+        ASSERT(err == decode_error::ok);
+
+        if (VERBOSE_TEST) {
+            printf("Decoded:\n");
+            decoded.print();
+            printf("\n");
+        }
+
+        ASSERT(blk.high_prec == decoded.high_prec);
+        ASSERT(blk.dual_plane == decoded.dual_plane);
+        if (blk.dual_plane)
+            ASSERT(blk.colour_component_selector == decoded.colour_component_selector);
+        ASSERT(blk.wt_range == decoded.wt_range);
+        ASSERT(blk.wt_w == decoded.wt_w);
+        ASSERT(blk.wt_h == decoded.wt_h);
+        ASSERT(blk.wt_d == decoded.wt_d);
+        ASSERT(blk.num_parts == decoded.num_parts);
+        if (blk.num_parts > 1)
+            ASSERT(blk.partition_index == decoded.partition_index);
+        ASSERT(blk.is_void_extent == decoded.is_void_extent);
+        if (blk.is_void_extent) {
+            // TODO: test
+        }
+        ASSERT(blk.is_multi_cem == decoded.is_multi_cem);
+        ASSERT(blk.cem_base_class == decoded.cem_base_class);
+        ASSERT(blk.cems[0] == decoded.cems[0]);
+        ASSERT(blk.cems[1] == decoded.cems[1]);
+        ASSERT(blk.cems[2] == decoded.cems[2]);
+        ASSERT(blk.cems[3] == decoded.cems[3]);
+
+        ASSERT(blk.num_weights == decoded.num_weights);
+
+        for (int i = 0; i < blk.num_weights; ++i)
+            ASSERT(blk.weights[i] == decoded.weights[i]);
+
+        for (int i = 0; i < blk.num_cem_values; ++i)
+            ASSERT(blk.colour_endpoints[i] == decoded.colour_endpoints[i]);
+
+        ASSERT(blk.wt_w <= encoder.block_w);
+        ASSERT(blk.wt_h <= encoder.block_h);
+        ASSERT(blk.wt_d <= encoder.block_d);
+        ASSERT(decoded.wt_w <= encoder.block_w);
+        ASSERT(decoded.wt_h <= encoder.block_h);
+        ASSERT(decoded.wt_d <= encoder.block_d);
+    }
+
+    ++m_count;
+}
+
+void TestGenerator::generate_with_block_mode(const Encoder &encoder, Block blk, int wt_w, int wt_h, int wt_d)
+{
+    // Specified as illegal
+    if (wt_w > encoder.block_w || wt_h > encoder.block_h || wt_d > encoder.block_d) {
+        blk.is_error = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    // Specified as illegal
+    if (wt_w * wt_h * wt_d * (blk.dual_plane ? 2 : 1) > 64) {
+        blk.is_error = true;
+        blk.bogus_weights = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    blk.wt_w = wt_w;
+    blk.wt_h = wt_h;
+    blk.wt_d = wt_d;
+
+    blk.calculate_from_weights();
+
+    // Specified as illegal
+    if (blk.weight_bits < 24) {
+        blk.is_error = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    // Illegal, and we need to be careful not to write too many bits
+    // since we'll corrupt the block mode fields
+    if (blk.weight_bits > 96) {
+        blk.is_error = true;
+        blk.bogus_weights = true;
+        if (!TEST_GENERATE_INVALID_BLOCKS)
+            return;
+    }
+
+    for (int p = 1; p <= 4; ++p) {
+        blk.num_parts = p;
+
+        if (blk.dual_plane && p == 4 && !TEST_GENERATE_INVALID_BLOCKS)
+            continue;
+
+        for (int cem = 0; cem < 16; ++cem)
+            generate_with_cems(encoder, blk, false, cem >> 2, cem, p > 1 ? cem : -1, p > 2 ? cem : -1, p > 3 ? cem : -1);
+
+        if (blk.num_parts > 1) {
+            for (int cem_base_class = 0; cem_base_class < 3; ++cem_base_class) {
+
+                for (int c3 = 0; c3 < (p > 3 ? 8 : 1); ++c3)
+                for (int c2 = 0; c2 < (p > 2 ? 8 : 1); ++c2)
+                for (int c1 = 0; c1 < (p > 1 ? 8 : 1); ++c1)
+                for (int c0 = 0; c0 < 8; ++c0)
+                    generate_with_cems(encoder, blk, true, cem_base_class,
+                            cem_base_class * 4 + c0,
+                            p > 1 ? cem_base_class * 4 + c1 : -1,
+                            p > 2 ? cem_base_class * 4 + c2 : -1,
+                            p > 3 ? cem_base_class * 4 + c3 : -1);
+            }
+        }
+    }
+}
+
+uint32_t TestGenerator::shard_seed(const Encoder &encoder, const block_mode &mode) const
+{
+    // splitmix64 over each field, so nearby block modes get unrelated seeds
+    uint64_t h = m_seed;
+    int fields[] = {
+        encoder.block_w, encoder.block_h, encoder.block_d,
+        mode.dual_plane, mode.colour_component_selector, mode.high_prec, mode.wt_range,
+        mode.wt_w, mode.wt_h, mode.wt_d,
+    };
+    for (int f : fields) {
+        h += 0x9e3779b97f4a7c15ull + (uint64_t)f;
+        uint64_t z = h;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        h = z ^ (z >> 31);
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+std::vector<TestGenerator::block_mode> TestGenerator::block_modes(const Encoder &encoder)
+{
+    std::vector<block_mode> modes;
+    for (int dual_plane = 0; dual_plane <= 1; ++dual_plane) {
+        int max_ccs = (dual_plane ? 4 : 1);
+        for (int ccs = 0; ccs < max_ccs; ++ccs) {
+            for (int high_prec = 0; high_prec <= 1; ++high_prec) {
+                for (int wt_range = 2; wt_range < 8; ++wt_range) {
+
+                    for_each_block_mode_grid(encoder.block_d > 1, dual_plane, high_prec,
+                            [&](int wt_w, int wt_h, int wt_d) {
+                                modes.push_back({ dual_plane, ccs, high_prec, wt_range, wt_w, wt_h, wt_d });
+                            });
+                }
+            }
+        }
+    }
+    return modes;
+}
+
+void TestGenerator::generate_with_block_mode(const Encoder &encoder, const block_mode &mode)
+{
+    m_rng.seed(shard_seed(encoder, mode));
+
+    Block blk;
+    blk.is_error = false;
+    blk.bogus_colour_endpoints = false;
+    blk.bogus_weights = false;
+    blk.is_void_extent = false;
+    blk.dual_plane = mode.dual_plane;
+    blk.colour_component_selector = mode.colour_component_selector;
+    blk.high_prec = mode.high_prec;
+    blk.wt_range = mode.wt_range;
+    generate_with_block_mode(encoder, blk, mode.wt_w, mode.wt_h, mode.wt_d);
+}
+
+void TestGenerator::generate_with_block_size(const Encoder &encoder, int num_threads)
+{
+    // TODO: void extents
+    // TODO: test illegal combinations
+
+    std::vector<block_mode> modes = block_modes(encoder);
+
+    // Each shard verifies its own blocks, then they're concatenated in
+    // block mode order
+    std::vector<std::vector<OutputBitVector>> shard_blocks(modes.size());
+    std::vector<int> shard_counts(modes.size());
+    parallel_for_chunks((int)modes.size(), 1, num_threads, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            TestGenerator shard;
+            shard.m_seed = m_seed;
+            shard.m_allow_hdr = m_allow_hdr;
+            shard.generate_with_block_mode(encoder, modes[i]);
+
+            shard_blocks[i] = std::move(shard.m_output_blocks);
+            shard_counts[i] = shard.m_count;
+        }
+    });
+
+    int count = 0;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        m_output_blocks.insert(m_output_blocks.end(), shard_blocks[i].begin(), shard_blocks[i].end());
+        count += shard_counts[i];
+    }
+    m_count += count;
+
+    if (m_show_progress)
+        fprintf(stderr, "  %d blocks from %d block modes\n", count, (int)modes.size());
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_TEST_GENERATOR
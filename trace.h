@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef INCLUDED_OASTC_TRACE
+#define INCLUDED_OASTC_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace oastc
+{
+
+// A timeline of what each thread was doing, written as Chrome trace JSON
+// (viewable in chrome://tracing or Perfetto). Tracing is off unless
+// enable_tracing() is called; when off, a TraceSpan costs one relaxed load.
+// When on, each thread appends to its own fixed-size ring buffer with no
+// locking, keeping the most recent events, so it is cheap enough to leave
+// enabled for whole batch runs.
+
+struct TraceEvent
+{
+    const char *name; // must be a string literal (or otherwise outlive the trace)
+    int64_t arg; // e.g. the row being decoded, or -1 for none
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+class TraceBuffer
+{
+public:
+    TraceBuffer(int tid, size_t capacity) : tid(tid), capacity(capacity), events(new TraceEvent[capacity]), count(0) { }
+
+    /**
+     * Append an event, overwriting the oldest one if the buffer is full.
+     * Only called by the thread that owns the buffer.
+     */
+    void push(const TraceEvent &event)
+    {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        events[n % capacity] = event;
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    /**
+     * Call fn(event) for each event still in the buffer, oldest first. The
+     * owning thread must not be pushing events concurrently.
+     */
+    template<typename F>
+    void for_each(F fn) const
+    {
+        uint64_t n = count.load(std::memory_order_acquire);
+        for (uint64_t i = (n > capacity ? n - capacity : 0); i < n; ++i)
+            fn(events[i % capacity]);
+    }
+
+    uint64_t num_dropped() const
+    {
+        uint64_t n = count.load(std::memory_order_acquire);
+        return n > capacity ? n - capacity : 0;
+    }
+
+    const int tid;
+
+private:
+    const size_t capacity;
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<uint64_t> count;
+};
+
+class Tracer
+{
+public:
+    static Tracer &get()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    static uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool enabled() const
+    {
+        return is_enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable(size_t events_per_thread)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = events_per_thread;
+        start_ns = now_ns();
+        is_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * Record an event in the calling thread's buffer
+     */
+    void record(const TraceEvent &event)
+    {
+        thread_local std::shared_ptr<TraceBuffer> buffer;
+        if (!buffer)
+            buffer = add_thread();
+        buffer->push(event);
+    }
+
+    /**
+     * Write every thread's events as Chrome trace JSON. Threads must not be
+     * recording events concurrently (e.g. call this after joining the
+     * worker threads, or at exit). Returns false on failure.
+     */
+    bool write_chrome_trace(const char *filename);
+
+private:
+    Tracer() : is_enabled(false), capacity(0), start_ns(0) { }
+
+    std::shared_ptr<TraceBuffer> add_thread()
+    {
+        // Buffers are shared with the registry, so their events survive
+        // after the thread exits
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.push_back(std::make_shared<TraceBuffer>((int)buffers.size() + 1, capacity));
+        return buffers.back();
+    }
+
+    std::atomic<bool> is_enabled;
+    std::mutex mutex;
+    size_t capacity;
+    uint64_t start_ns;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+bool Tracer::write_chrome_trace(const char *filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open \"%s\" for output\n", filename);
+        return false;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (auto &buffer : buffers) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first ? "" : ",\n", buffer->tid, buffer->tid);
+        first = false;
+
+        if (buffer->num_dropped()) {
+            fprintf(stderr, "Trace buffer for thread %d overflowed; dropped its oldest %llu events\n",
+                    buffer->tid, (unsigned long long)buffer->num_dropped());
+        }
+
+        buffer->for_each([&](const TraceEvent &e) {
+            // Chrome trace timestamps are in microseconds
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    e.name, buffer->tid, (e.begin_ns - start_ns) / 1000.0, (e.end_ns - e.begin_ns) / 1000.0);
+            if (e.arg >= 0)
+                fprintf(f, ",\"args\":{\"index\":%lld}", (long long)e.arg);
+            fprintf(f, "}");
+        });
+    }
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Start recording events, keeping the last events_per_thread of each thread
+ */
+static inline void enable_tracing(size_t events_per_thread = 1 << 16)
+{
+    Tracer::get().enable(events_per_thread);
+}
+
+static inline bool write_chrome_trace(const char *filename)
+{
+    return Tracer::get().write_chrome_trace(filename);
+}
+
+/**
+ * Records the time from construction to destruction as an event on the
+ * current thread, if tracing is enabled
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name, int64_t arg = -1) : name(name), arg(arg), begin_ns(0)
+    {
+        if (Tracer::get().enabled())
+            begin_ns = Tracer::now_ns();
+    }
+
+    ~TraceSpan()
+    {
+        if (begin_ns)
+            Tracer::get().record({ name, arg, begin_ns, Tracer::now_ns() });
+    }
+
+private:
+    const char *name;
+    int64_t arg;
+    uint64_t begin_ns;
+};
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_TRACE
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2015 Philip Taylor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_OASTC_TRANSCODE
+#define INCLUDED_OASTC_TRANSCODE
+
+#include "oastc.h"
+#include "compress.h"
+
+namespace oastc
+{
+
+/**
+ * A decoded ASTC texel, plus the ASTC endpoints and weight it was
+ * interpolated from. These let the BC encoders start from a good guess
+ * instead of searching for endpoints from scratch.
+ */
+struct transcode_texel
+{
+    uint8x4_t rgba;
+
+    // Only valid if 'hinted' is set. Void-extent, dual-plane and error
+    // blocks don't have a single weight per texel, so they're not hinted
+    bool hinted;
+    uint8_t weight; // 0..64
+    uint8x4_t e0, e1;
+};
+
+/**
+ * Converts 2D LDR ASTC blocks to BC7 or BC1.
+ *
+ * ASTC blocks are first decoded with decode_block() into a buffer of
+ * transcode_texels; each 4x4 tile of that buffer can then be encoded with
+ * encode_bc7() or encode_bc1(). Tiles that come from a single partition of
+ * a single ASTC block are encoded from the ASTC endpoints, so they usually
+ * only need a small search; other tiles fall back to a principal-axis fit.
+ */
+class Transcoder
+{
+public:
+    Transcoder(int block_w, int block_h, decode_profile profile = decode_profile::ldr);
+
+    /**
+     * Decode a 16-byte ASTC block into block_w*block_h texels. Blocks
+     * that fail to decode are filled with the error colour (unhinted).
+     */
+    decode_error decode_block(const uint8_t *in, transcode_texel *output) const;
+
+    /**
+     * Encode 16 texels (in x-major order) as a BC7 block, using mode 6
+     */
+    static void encode_bc7(const transcode_texel *tile, uint8_t *output);
+
+    /**
+     * Encode 16 texels as a 4-colour BC1 block. Alpha is ignored
+     */
+    static void encode_bc1(const transcode_texel *tile, uint8_t *output);
+
+    Decoder decoder;
+};
+
+Transcoder::Transcoder(int block_w, int block_h, decode_profile profile)
+  : decoder(block_w, block_h, 1, profile)
+{
+    ASSERT(profile != decode_profile::hdr);
+    decoder.build_partition_table();
+}
+
+decode_error Transcoder::decode_block(const uint8_t *in, transcode_texel *output) const
+{
+    int num_texels = decoder.block_w * decoder.block_h;
+
+    Block blk;
+    InputBitVector in_vec;
+    memcpy(&in_vec.data, in, 16);
+    decode_error err = blk.decode(decoder, in_vec, decoder.profile);
+    if (err != decode_error::ok) {
+        for (int i = 0; i < num_texels; ++i) {
+            output[i].rgba = uint8x4_t(0xff, 0x00, 0xff, 0xff);
+            output[i].hinted = false;
+        }
+        return err;
+    }
+
+    uint8_t rgba[216*4];
+    blk.write_decoded_unorm8(decoder, decoder.profile, rgba);
+
+    bool hinted = !blk.is_void_extent && !blk.is_error && !blk.dual_plane;
+
+    for (int i = 0; i < num_texels; ++i) {
+        transcode_texel &t = output[i];
+        memcpy(t.rgba.v, &rgba[i*4], 4);
+        t.hinted = hinted;
+        if (hinted) {
+            int partition = decoder.texel_partition(blk.partition_index, blk.num_parts, i);
+            t.weight = blk.infill_weights[0][i];
+            t.e0 = blk.endpoints_decoded[0][partition];
+            t.e1 = blk.endpoints_decoded[1][partition];
+        }
+    }
+
+    return decode_error::ok;
+}
+
+/**
+ * Returns true if every texel in the tile is hinted and interpolated
+ * between the same pair of endpoints
+ */
+static bool tile_has_common_endpoints(const transcode_texel *tile)
+{
+    for (int i = 0; i < 16; ++i) {
+        if (!tile[i].hinted)
+            return false;
+        if (memcmp(tile[i].e0.v, tile[0].e0.v, 4) || memcmp(tile[i].e1.v, tile[0].e1.v, 4))
+            return false;
+    }
+    return true;
+}
+
+static const uint8_t bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/**
+ * Find the palette entry with the lowest error, trying entry 'hint' first.
+ * err(i, limit) may stop adding up channels once the error reaches limit,
+ * so a good hint lets most other entries be rejected after a channel or
+ * two. The result is the same as a plain search from entry 0, including
+ * ties going to the earlier entry.
+ */
+template<typename F>
+static int search_palette(int hint, int num_entries, F err, int &best_err)
+{
+    int best = hint;
+    best_err = err(hint, 1 << 30);
+    for (int i = 0; i < num_entries; ++i) {
+        if (i == hint)
+            continue;
+        int limit = i < best ? best_err + 1 : best_err;
+        int e = err(i, limit);
+        if (e < limit) {
+            best_err = e;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * A quantised BC7 mode 6 block: 7-bit RGBA endpoints with a p-bit each,
+ * and 4-bit indices
+ */
+struct bc7_mode6
+{
+    uint8_t endpoint[2][4]; // 7 bits
+    uint8_t pbit[2];
+    uint8_t index[16];
+    int error;
+
+    void quantise_endpoint(int e, const int *target)
+    {
+        // Pick whichever p-bit gets all four channels closest
+        int best_err = -1;
+        for (int p = 0; p < 2; ++p) {
+            uint8_t q[4];
+            int err = 0;
+            for (int c = 0; c < 4; ++c) {
+                int v = std::max(0, std::min(127, (target[c] - p + 1) >> 1));
+                int d = ((v << 1) | p) - target[c];
+                q[c] = v;
+                err += d * d;
+            }
+            if (best_err < 0 || err < best_err) {
+                best_err = err;
+                memcpy(endpoint[e], q, 4);
+                pbit[e] = p;
+            }
+        }
+    }
+
+    void unquantised_endpoint(int e, int *out) const
+    {
+        for (int c = 0; c < 4; ++c)
+            out[c] = (endpoint[e][c] << 1) | pbit[e];
+    }
+
+    /**
+     * Choose the best index for every texel, and compute the total error.
+     * If use_hints is set (only when the endpoints came from the texels' own
+     * ASTC endpoints), each texel's search starts from the index nearest its
+     * ASTC weight, which is usually the best one
+     */
+    void assign_indices(const transcode_texel *tile, bool use_hints)
+    {
+        int e0[4], e1[4];
+        unquantised_endpoint(0, e0);
+        unquantised_endpoint(1, e1);
+
+        int palette[16][4];
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                palette[i][c] = (e0[c] * (64 - bc7_weights4[i]) + e1[c] * bc7_weights4[i] + 32) >> 6;
+
+        error = 0;
+        for (int t = 0; t < 16; ++t) {
+            auto texel_err = [&](int i, int limit) {
+                int err = 0;
+                for (int c = 0; c < 4 && err < limit; ++c) {
+                    int d = palette[i][c] - tile[t].rgba.v[c];
+                    err += d * d;
+                }
+                return err;
+            };
+
+            // bc7_weights4[i] is round(i * 64 / 15)
+            int hint = use_hints ? (tile[t].weight * 15 + 32) / 64 : 0;
+            int best_err;
+            int best = search_palette(hint, 16, texel_err, best_err);
+            index[t] = best;
+            error += best_err;
+        }
+    }
+
+    void encode(uint8_t *output) const
+    {
+        // The anchor texel's index must have its top bit clear, which we
+        // can arrange by swapping the endpoints
+        bool swap = index[0] >= 8;
+        int a = swap ? 1 : 0;
+        int b = swap ? 0 : 1;
+
+        OutputBitVector out;
+        out.append(1 << 6, 7);
+        for (int c = 0; c < 4; ++c) {
+            out.append(endpoint[a][c], 7);
+            out.append(endpoint[b][c], 7);
+        }
+        out.append(pbit[a], 1);
+        out.append(pbit[b], 1);
+        for (int t = 0; t < 16; ++t) {
+            int idx = swap ? 15 - index[t] : index[t];
+            out.append(idx, t == 0 ? 3 : 4);
+        }
+        ASSERT(out.offset == 128);
+        memcpy(output, out.data, 16);
+    }
+};
+
+static bc7_mode6 bc7_mode6_from_endpoints(const transcode_texel *tile, const int *e0, const int *e1,
+        bool use_hints = false)
+{
+    bc7_mode6 m;
+    m.quantise_endpoint(0, e0);
+    m.quantise_endpoint(1, e1);
+    m.assign_indices(tile, use_hints);
+    return m;
+}
+
+static void tile_colours(const transcode_texel *tile, uint8x4_t *colours)
+{
+    for (int i = 0; i < 16; ++i)
+        colours[i] = tile[i].rgba;
+}
+
+void Transcoder::encode_bc7(const transcode_texel *tile, uint8_t *output)
+{
+    uint8x4_t colours[16];
+    tile_colours(tile, colours);
+
+    int e0[4], e1[4];
+    bc7_mode6 best;
+
+    if (tile_has_common_endpoints(tile)) {
+        // The whole tile lies on the line between the ASTC endpoints,
+        // which mode 6 can represent almost exactly, with indices close to
+        // the ASTC weights
+        for (int c = 0; c < 4; ++c) {
+            e0[c] = tile[0].e0.v[c];
+            e1[c] = tile[0].e1.v[c];
+        }
+        best = bc7_mode6_from_endpoints(tile, e0, e1, true);
+    } else {
+        fit_principal_axis(colours, 16, 0xf, e0, e1);
+        best = bc7_mode6_from_endpoints(tile, e0, e1);
+    }
+
+    // Refine the endpoints for the chosen indices, a couple of times
+    for (int iter = 0; iter < 2 && best.error > 0; ++iter) {
+        int weights[16];
+        for (int t = 0; t < 16; ++t)
+            weights[t] = bc7_weights4[best.index[t]];
+        if (!refit_endpoints(colours, weights, 16, e0, e1))
+            break;
+        bc7_mode6 m = bc7_mode6_from_endpoints(tile, e0, e1);
+        if (m.error >= best.error)
+            break;
+        best = m;
+    }
+
+    best.encode(output);
+}
+
+static int bc1_quantise_565(const int *c)
+{
+    int r = (c[0] * 31 + 127) / 255;
+    int g = (c[1] * 63 + 127) / 255;
+    int b = (c[2] * 31 + 127) / 255;
+    return (r << 11) | (g << 5) | b;
+}
+
+static void bc1_unquantise_565(int v, int *c)
+{
+    int r = (v >> 11) & 0x1f;
+    int g = (v >> 5) & 0x3f;
+    int b = v & 0x1f;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * A 4-colour BC1 block
+ */
+struct bc1_block
+{
+    int colour[2]; // RGB565
+    uint8_t index[16];
+    int error;
+
+    /**
+     * Choose the best index for every texel, and compute the total error,
+     * starting from the ASTC weights if use_hints is set (as for BC7)
+     */
+    void assign_indices(const transcode_texel *tile, bool use_hints)
+    {
+        // The palette entry for each weight (0, 1/3, 2/3, 1)
+        static const uint8_t by_weight[4] = { 0, 2, 3, 1 };
+
+        int palette[4][3];
+        bc1_unquantise_565(colour[0], palette[0]);
+        bc1_unquantise_565(colour[1], palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        error = 0;
+        for (int t = 0; t < 16; ++t) {
+            auto texel_err = [&](int i, int limit) {
+                int err = 0;
+                for (int c = 0; c < 3 && err < limit; ++c) {
+                    int d = palette[i][c] - tile[t].rgba.v[c];
+                    err += d * d;
+                }
+                return err;
+            };
+
+            int hint = use_hints ? by_weight[(tile[t].weight * 3 + 32) / 64] : 0;
+            int best_err;
+            int best = search_palette(hint, 4, texel_err, best_err);
+            index[t] = best;
+            error += best_err;
+        }
+    }
+
+    void encode(uint8_t *output) const
+    {
+        // 4-colour mode needs colour0 > colour1. If they're equal, we're in
+        // 3-colour mode, but index 0 still means colour0
+        int c0 = colour[0], c1 = colour[1];
+        static const uint8_t swapped[4] = { 1, 0, 3, 2 };
+        bool swap = c0 < c1;
+        uint32_t indices = 0;
+        for (int t = 0; t < 16; ++t) {
+            int idx = (c0 == c1) ? 0 : swap ? swapped[index[t]] : index[t];
+            indices |= idx << (t * 2);
+        }
+        if (swap)
+            std::swap(c0, c1);
+
+        output[0] = c0 & 0xff;
+        output[1] = c0 >> 8;
+        output[2] = c1 & 0xff;
+        output[3] = c1 >> 8;
+        memcpy(&output[4], &indices, 4);
+    }
+};
+
+static bc1_block bc1_from_endpoints(const transcode_texel *tile, const int *e0, const int *e1,
+        bool use_hints = false)
+{
+    bc1_block b;
+    b.colour[0] = bc1_quantise_565(e0);
+    b.colour[1] = bc1_quantise_565(e1);
+    b.assign_indices(tile, use_hints);
+    return b;
+}
+
+void Transcoder::encode_bc1(const transcode_texel *tile, uint8_t *output)
+{
+    static const uint8_t bc1_weights[4] = { 0, 64, 21, 43 };
+
+    uint8x4_t colours[16];
+    tile_colours(tile, colours);
+
+    int e0[4], e1[4];
+    bc1_block best;
+
+    if (tile_has_common_endpoints(tile)) {
+        for (int c = 0; c < 4; ++c) {
+            e0[c] = tile[0].e0.v[c];
+            e1[c] = tile[0].e1.v[c];
+        }
+        best = bc1_from_endpoints(tile, e0, e1, true);
+    } else {
+        fit_principal_axis(colours, 16, 0x7, e0, e1);
+        best = bc1_from_endpoints(tile, e0, e1);
+    }
+
+    for (int iter = 0; iter < 2 && best.error > 0; ++iter) {
+        int weights[16];
+        for (int t = 0; t < 16; ++t)
+            weights[t] = bc1_weights[best.index[t]];
+        if (!refit_endpoints(colours, weights, 16, e0, e1))
+            break;
+        bc1_block b = bc1_from_endpoints(tile, e0, e1);
+        if (b.error >= best.error)
+            break;
+        best = b;
+    }
+
+    best.encode(output);
+}
+
+} // namespace oastc
+
+#endif // INCLUDED_OASTC_TRANSCODE
@@ -21,8 +21,22 @@
  */
 
 #include "oastc.h"
+#include "block_error.h"
+#include "compress.h"
+#include "configs.h"
+#include "content_stats.h"
+#include "decode_check.h"
+#include "image_compare.h"
+#include "image_io.h"
+#include "partitions.h"
+#include "trace.h"
+#include "transcode.h"
 
+#include <atomic>
 #include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
 
 using namespace oastc;
 
@@ -131,6 +145,34 @@ static void test_trits()
     TEST_ASSERT_EQ(decoded[4], 0x24);
 }
 
+static void test_trit_quint_encode_tables()
+{
+    // Each entry must unpack to its own index, and be the lowest bit
+    // pattern that does
+    int trit_lowest[243], quint_lowest[125];
+    std::fill(trit_lowest, trit_lowest + 243, -1);
+    std::fill(quint_lowest, quint_lowest + 125, -1);
+    for (int p = 0; p < 256; ++p) {
+        uint8_t t[5];
+        unpack_trit_block(0, (uint32_t)p, t);
+        int c = t[0] + t[1]*3 + t[2]*(3*3) + t[3]*(3*3*3) + t[4]*(3*3*3*3);
+        if (trit_lowest[c] < 0)
+            trit_lowest[c] = p;
+
+        if (p < 128) {
+            uint8_t q[3];
+            unpack_quint_block(0, p, q);
+            int d = q[0] + q[1]*5 + q[2]*(5*5);
+            if (quint_lowest[d] < 0)
+                quint_lowest[d] = p;
+        }
+    }
+    for (int c = 0; c < 243; ++c)
+        TEST_ASSERT_EQ((int)trit_encode_table[c], trit_lowest[c]);
+    for (int c = 0; c < 125; ++c)
+        TEST_ASSERT_EQ((int)quint_encode_table[c], quint_lowest[c]);
+}
+
 static void test_fp16()
 {
     TEST_ASSERT_EQ(fp16::zero().u, 0x0000);
@@ -147,14 +189,1344 @@ static void test_fp16_unorm()
     }
 }
 
+static void test_block_mode_3d()
+{
+    for (int dual_plane = 0; dual_plane <= 1; ++dual_plane) {
+        for (int high_prec = 0; high_prec <= 1; ++high_prec) {
+            for (int wt_range = 2; wt_range < 8; ++wt_range) {
+                for (int d = 2; d <= 6; ++d) {
+                    for (int h = 2; h <= 6; ++h) {
+                        for (int w = 2; w <= 6; ++w) {
+                            int num_sixes = (w == 6) + (h == 6) + (d == 6);
+                            if (num_sixes > 1)
+                                continue;
+                            // Grids with a 6 are only encodable with D=H=0, unless the other dimensions are 2
+                            if (num_sixes == 1 && (dual_plane || high_prec) && w*h*d != 24)
+                                continue;
+
+                            Block blk;
+                            blk.dual_plane = dual_plane;
+                            blk.high_prec = high_prec;
+                            blk.wt_range = wt_range;
+                            blk.wt_w = w;
+                            blk.wt_h = h;
+                            blk.wt_d = d;
+
+                            InputBitVector in;
+                            memset(in.data, 0, sizeof(in.data));
+                            in.data[0] = blk.encode_block_mode();
+
+                            Block decoded;
+                            TEST_ASSERT_EQ((int)decoded.decode_block_mode_3d(in), (int)decode_error::ok);
+                            TEST_ASSERT_EQ(decoded.dual_plane, dual_plane);
+                            TEST_ASSERT_EQ(decoded.high_prec, high_prec);
+                            TEST_ASSERT_EQ(decoded.wt_range, wt_range);
+                            TEST_ASSERT_EQ(decoded.wt_w, w);
+                            TEST_ASSERT_EQ(decoded.wt_h, h);
+                            TEST_ASSERT_EQ(decoded.wt_d, d);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void test_infill_3d()
+{
+    Block blk;
+    blk.dual_plane = 0;
+    blk.wt_w = blk.wt_h = blk.wt_d = 2;
+    memset(blk.weights, 0, sizeof(blk.weights));
+    uint8_t weights[8] = { 0, 8, 16, 24, 32, 40, 48, 64 };
+    memcpy(blk.weights, weights, sizeof(weights));
+
+    blk.compute_infill_weights(3, 3, 3);
+
+    // Corners reproduce the corner weights exactly
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][0], 0);
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][2], 8);
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][6], 16);
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][26], 64);
+
+    // Centre lies on the main diagonal of the cell
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][13], 32);
+
+    // Midpoint of an edge
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][1], 4);
+    TEST_ASSERT_EQ((int)blk.infill_weights[0][9], 16);
+}
+
+static void test_decode_unorm8()
+{
+    // decode_unorm8() must match decode() followed by fp16::to_unorm8()
+    Decoder dec(6, 5, 1);
+    std::mt19937 rng(1);
+    for (int i = 0; i < 10000; ++i) {
+        uint32_t block[4] = { (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng() };
+        fp16 out_fp16[6*5*4];
+        uint8_t out_unorm8[6*5*4];
+        dec.decode((const uint8_t *)block, out_fp16);
+        dec.decode_unorm8((const uint8_t *)block, out_unorm8);
+        for (int j = 0; j < 6*5*4; ++j)
+            TEST_ASSERT_EQ((int)out_fp16[j].to_unorm8(), (int)out_unorm8[j]);
+    }
+}
+
+static void test_srgb()
+{
+    TEST_ASSERT_EQ(srgb_to_linear_fp16[0], 0x0000);
+    TEST_ASSERT_EQ(srgb_to_linear_fp16[255], fp16::one().u);
+    for (int i = 1; i < 256; ++i) {
+        if (srgb_to_linear_fp16[i] <= srgb_to_linear_fp16[i-1])
+            TEST_FAIL("srgb_to_linear_fp16 is not monotonic at ") << i << "\n";
+    }
+
+    // Void extent with colour (0x1234, 0x80ff, 0xff00, 0xffff)
+    uint8_t block[16] = { 0xfc, 0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                          0x34, 0x12, 0xff, 0x80, 0x00, 0xff, 0xff, 0xff };
+    Decoder dec(4, 4, 1, decode_profile::ldr_srgb);
+    uint8_t out_unorm8[4*4*4];
+    fp16 out_fp16[4*4*4];
+    TEST_ASSERT_EQ((int)dec.decode_unorm8(block, out_unorm8), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)dec.decode(block, out_fp16), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)out_unorm8[0], 0x12);
+    TEST_ASSERT_EQ((int)out_unorm8[1], 0x80);
+    TEST_ASSERT_EQ((int)out_unorm8[2], 0xff);
+    TEST_ASSERT_EQ((int)out_unorm8[3], 0xff);
+    TEST_ASSERT_EQ(out_fp16[0].u, srgb_to_linear_fp16[0x12]);
+    TEST_ASSERT_EQ(out_fp16[1].u, srgb_to_linear_fp16[0x80]);
+    TEST_ASSERT_EQ(out_fp16[2].u, fp16::one().u);
+    TEST_ASSERT_EQ(out_fp16[3].u, fp16::one().u);
+
+    // The per-call profile overrides the decoder's default
+    TEST_ASSERT_EQ((int)dec.decode_unorm8(block, out_unorm8, decode_profile::ldr), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)out_unorm8[0], fp16::unorm8_from_uint16_div_64k(0x1234));
+
+    // Interpolated blocks: colour goes through the sRGB table, and alpha
+    // must be the same unorm8 value in both outputs, for opaque and
+    // translucent blocks
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image(16 * 8 * 4);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            uint8_t *t = &image[(y * 16 + x) * 4];
+            t[0] = x * 16 + (rng() & 7);
+            t[1] = y * 32;
+            t[2] = rng();
+            t[3] = x < 8 ? 255 : x * 16 + y;
+        }
+    }
+    std::vector<uint8_t> blocks(4 * 2 * 16);
+    Compressor comp(4, 4, compress_quality::fast);
+    comp.compress_image(image.data(), 16, 8, 16 * 4, blocks.data());
+    int opaque = 0;
+    for (size_t i = 0; i < blocks.size(); i += 16) {
+        TEST_ASSERT_EQ((int)dec.decode_unorm8(&blocks[i], out_unorm8), (int)decode_error::ok);
+        TEST_ASSERT_EQ((int)dec.decode(&blocks[i], out_fp16), (int)decode_error::ok);
+        for (int t = 0; t < 16; ++t) {
+            for (int c = 0; c < 3; ++c)
+                TEST_ASSERT_EQ(out_fp16[t*4+c].u, srgb_to_linear_fp16[out_unorm8[t*4+c]]);
+            TEST_ASSERT_EQ((int)out_fp16[t*4+3].to_unorm8(), (int)out_unorm8[t*4+3]);
+            if (out_unorm8[t*4+3] == 255) {
+                TEST_ASSERT_EQ(out_fp16[t*4+3].u, fp16::one().u);
+                opaque++;
+            }
+        }
+    }
+    if (opaque == 0 || opaque == 16 * 8)
+        TEST_FAIL("Expected both opaque and translucent texels\n");
+}
+
+static void test_lns_to_fp16()
+{
+    // The vectorised conversion must match the scalar tail for every input
+    std::vector<uint16_t> in(65536), out_simd(65536), out_scalar(65536);
+    for (int i = 0; i < 65536; ++i)
+        in[i] = i;
+    lns_to_fp16(in.data(), out_simd.data(), 65536);
+    for (int i = 0; i < 65536; ++i)
+        lns_to_fp16(&in[i], &out_scalar[i], 1);
+    for (int i = 0; i < 65536; ++i)
+        TEST_ASSERT_EQ(out_simd[i], out_scalar[i]);
+
+    TEST_ASSERT_EQ(out_scalar[0x0000], 0x0000);
+    TEST_ASSERT_EQ(out_scalar[0x7800], fp16::one().u);
+    TEST_ASSERT_EQ(out_scalar[0xffff], 0x7bff);
+}
+
+static void test_hdr()
+{
+    // CEM 2 (HDR luminance, large range) with v0=0, v1=128
+    Block blk;
+    blk.num_parts = 1;
+    blk.cems[0] = 2;
+    blk.colour_endpoints[0] = 0;
+    blk.colour_endpoints[1] = 128;
+    blk.decode_colour_endpoints();
+    TEST_ASSERT_EQ(blk.hdr_rgb[0], true);
+    TEST_ASSERT_EQ(blk.hdr_alpha[0], true); // constant alpha of 1.0, stored as LNS
+    uint16_t lns[4] = {
+        blk.endpoints_hdr[0][0].v[0], blk.endpoints_hdr[0][0].v[3],
+        blk.endpoints_hdr[1][0].v[0], blk.endpoints_hdr[1][0].v[3],
+    };
+    uint16_t f[4];
+    lns_to_fp16(lns, f, 4);
+    TEST_ASSERT_EQ(f[0], 0x0000);
+    TEST_ASSERT_EQ(f[1], fp16::one().u);
+    TEST_ASSERT_EQ(f[2], 0x4000); // 2.0
+    TEST_ASSERT_EQ(f[3], fp16::one().u);
+
+    // HDR void extent with colour (1.5, 0.5, 100.0, 1.0)
+    uint8_t block[16] = { 0xfc, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                          0x00, 0x3e, 0x00, 0x38, 0x40, 0x56, 0x00, 0x3c };
+    Decoder dec(4, 4, 1, decode_profile::hdr);
+    fp16 out_fp16[4*4*4];
+    uint8_t out_unorm8[4*4*4];
+    TEST_ASSERT_EQ((int)dec.decode(block, out_fp16), (int)decode_error::ok);
+    TEST_ASSERT_EQ(out_fp16[0].u, 0x3e00);
+    TEST_ASSERT_EQ(out_fp16[1].u, 0x3800);
+    TEST_ASSERT_EQ(out_fp16[2].u, 0x5640);
+    TEST_ASSERT_EQ(out_fp16[3].u, fp16::one().u);
+    TEST_ASSERT_EQ(out_fp16[4*4*4-4].u, 0x3e00);
+
+    // 8-bit output saturates values above 1.0
+    TEST_ASSERT_EQ((int)dec.decode_unorm8(block, out_unorm8), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)out_unorm8[0], 0xff);
+    TEST_ASSERT_EQ((int)out_unorm8[2], 0xff);
+
+    // HDR content is an error in the LDR profile
+    if (dec.decode(block, out_fp16, decode_profile::ldr) == decode_error::ok)
+        TEST_FAIL("HDR void extent decoded without error in LDR profile\n");
+}
+
+static void make_transcode_tile(transcode_texel *tile, uint8x4_t e0, uint8x4_t e1, const uint8_t *weights)
+{
+    for (int i = 0; i < 16; ++i) {
+        transcode_texel &t = tile[i];
+        t.hinted = true;
+        t.e0 = e0;
+        t.e1 = e1;
+        t.weight = weights[i];
+        for (int c = 0; c < 4; ++c)
+            t.rgba.v[c] = (e0.v[c] * (64 - t.weight) + e1.v[c] * t.weight + 32) >> 6;
+    }
+}
+
+static void test_transcode_bc7()
+{
+    static const uint8_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    transcode_texel tile[16];
+    make_transcode_tile(tile, uint8x4_t(10, 20, 30, 255), uint8x4_t(200, 180, 161, 128), weights);
+
+    uint8_t block[16];
+    Transcoder::encode_bc7(tile, block);
+
+    // Decode the mode 6 block
+    InputBitVector in;
+    memcpy(in.data, block, 16);
+    TEST_ASSERT_EQ(in.get_bits(0, 7), 0x40u);
+    int e[2][4];
+    for (int c = 0; c < 4; ++c) {
+        e[0][c] = in.get_bits(7 + c*14, 7) << 1 | in.get_bits(63, 1);
+        e[1][c] = in.get_bits(14 + c*14, 7) << 1 | in.get_bits(64, 1);
+    }
+    for (int t = 0; t < 16; ++t) {
+        int idx = t == 0 ? in.get_bits(65, 3) : in.get_bits(64 + t*4, 4);
+        for (int c = 0; c < 4; ++c) {
+            int v = (e[0][c] * (64 - weights[idx]) + e[1][c] * weights[idx] + 32) >> 6;
+            if (abs(v - tile[t].rgba.v[c]) > 1)
+                TEST_FAIL("BC7 texel ") << t << " channel " << c << " is " << v << ", expected " << (int)tile[t].rgba.v[c] << "\n";
+        }
+    }
+}
+
+static void test_transcode_bc1()
+{
+    // Endpoints that are exactly representable in RGB565
+    static const uint8_t weights[16] = { 0, 0, 21, 21, 43, 43, 64, 64, 0, 21, 43, 64, 64, 43, 21, 0 };
+    transcode_texel tile[16];
+    make_transcode_tile(tile, uint8x4_t(0, 0, 0, 255), uint8x4_t(255, 255, 255, 255), weights);
+
+    uint8_t block[8];
+    Transcoder::encode_bc1(tile, block);
+
+    int c0 = block[0] | block[1] << 8;
+    int c1 = block[2] | block[3] << 8;
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+    TEST_ASSERT_EQ(c0, 0xffff);
+    TEST_ASSERT_EQ(c1, 0x0000);
+    static const int expected_index[4] = { 1, 3, 2, 0 }; // for weights 0, 21, 43, 64
+    for (int t = 0; t < 16; ++t)
+        TEST_ASSERT_EQ((indices >> (t*2)) & 3, (uint32_t)expected_index[(weights[t] + 10) / 21]);
+}
+
+static void test_transcode_hints()
+{
+    // Starting the search from the ASTC weights must find exactly the same
+    // indices as starting from entry 0, even where rounding gives the error
+    // more than one local minimum
+    std::mt19937 rng(1);
+    int bc7_diffs = 0, bc1_diffs = 0;
+    for (int n = 0; n < 20000; ++n) {
+        uint8x4_t e0(rng() % 256, rng() % 256, rng() % 256, rng() % 256), e1(rng() % 256, rng() % 256, rng() % 256, rng() % 256);
+        if (n % 4 == 0)
+            for (int c = 0; c < 3; ++c)
+                e1.v[c] = std::min(255, e0.v[c] + (int)(rng() % 8));
+        uint8_t weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = rng() % 65;
+        transcode_texel tile[16];
+        make_transcode_tile(tile, e0, e1, weights);
+
+        int ie0[4], ie1[4];
+        for (int c = 0; c < 4; ++c) {
+            ie0[c] = e0.v[c];
+            ie1[c] = e1.v[c];
+        }
+
+        bc7_mode6 bc7_full = bc7_mode6_from_endpoints(tile, ie0, ie1, false);
+        bc7_mode6 bc7_hinted = bc7_mode6_from_endpoints(tile, ie0, ie1, true);
+        if (bc7_full.error != bc7_hinted.error || memcmp(bc7_full.index, bc7_hinted.index, 16) != 0)
+            bc7_diffs++;
+
+        bc1_block bc1_full = bc1_from_endpoints(tile, ie0, ie1, false);
+        bc1_block bc1_hinted = bc1_from_endpoints(tile, ie0, ie1, true);
+        if (bc1_full.error != bc1_hinted.error || memcmp(bc1_full.index, bc1_hinted.index, 16) != 0)
+            bc1_diffs++;
+    }
+    TEST_ASSERT_EQ(bc7_diffs, 0);
+    TEST_ASSERT_EQ(bc1_diffs, 0);
+}
+
+static void test_block_mode_grids()
+{
+    // Every grid that for_each_block_mode_grid() produces must survive a
+    // round trip through encode_block_mode()/decode_block_mode(). In 2D no
+    // grid may be produced twice
+    for (int is_3d = 0; is_3d <= 1; ++is_3d) {
+        for (int dual_plane = 0; dual_plane <= 1; ++dual_plane) {
+            for (int high_prec = 0; high_prec <= 1; ++high_prec) {
+                for (int wt_range = 2; wt_range < 8; ++wt_range) {
+                    std::set<int> seen;
+                    for_each_block_mode_grid(is_3d, dual_plane, high_prec, [&](int w, int h, int d) {
+                        if (!is_3d)
+                            TEST_ASSERT_EQ((int)seen.insert(w + h * 16).second, 1);
+
+                        Block blk;
+                        blk.dual_plane = dual_plane;
+                        blk.high_prec = high_prec;
+                        blk.wt_range = wt_range;
+                        blk.wt_w = w;
+                        blk.wt_h = h;
+                        blk.wt_d = d;
+
+                        InputBitVector in;
+                        memset(in.data, 0, sizeof(in.data));
+                        in.data[0] = blk.encode_block_mode();
+
+                        Block decoded;
+                        decode_error err = is_3d ? decoded.decode_block_mode_3d(in) : decoded.decode_block_mode(in);
+                        TEST_ASSERT_EQ((int)err, (int)decode_error::ok);
+                        TEST_ASSERT_EQ(decoded.dual_plane, dual_plane);
+                        TEST_ASSERT_EQ(decoded.high_prec, high_prec);
+                        TEST_ASSERT_EQ(decoded.wt_range, wt_range);
+                        TEST_ASSERT_EQ(decoded.wt_w, w);
+                        TEST_ASSERT_EQ(decoded.wt_h, h);
+                        if (is_3d)
+                            TEST_ASSERT_EQ(decoded.wt_d, d);
+                    });
+                }
+            }
+        }
+    }
+}
+
+static void test_config_table()
+{
+    // Every config in the table must encode to a block that decodes
+    // without error, with the same bit budget
+    static const int sizes[][3] = { { 4, 4, 1 }, { 8, 5, 1 }, { 12, 12, 1 }, { 3, 3, 3 }, { 6, 6, 6 } };
+    std::mt19937 rng(1);
+    for (auto &size : sizes) {
+        ConfigTable table(size[0], size[1], size[2]);
+        Encoder encoder(size[0], size[1], size[2]);
+        Decoder decoder(size[0], size[1], size[2]);
+        if (table.configs().empty())
+            TEST_FAIL("No configs for " << size[0] << "x" << size[1] << "x" << size[2] << "\n");
+
+        for (const encoding_config &config : table.configs()) {
+            Block blk;
+            config.setup_block(blk, config.cem_class * 4 + rng() % 4);
+            if (config.num_parts > 1)
+                blk.partition_index = rng() % 1024;
+            if (config.dual_plane)
+                blk.colour_component_selector = rng() % 4;
+            for (int i = 0; i < blk.num_weights; ++i)
+                blk.weights_quant[i] = rng() % (blk.wt_max + 1);
+            for (int i = 0; i < blk.num_cem_values; ++i)
+                blk.colour_endpoints_quant[i] = rng() % (blk.ce_max + 1);
+
+            OutputBitVector encoded = blk.encode(encoder);
+            InputBitVector in;
+            memcpy(in.data, encoded.data, sizeof(in.data));
+            Block decoded;
+            TEST_ASSERT_EQ((int)decoded.decode(decoder, in, decode_profile::hdr), (int)decode_error::ok);
+            TEST_ASSERT_EQ(decoded.num_parts, (int)config.num_parts);
+            TEST_ASSERT_EQ(decoded.num_weights, (int)config.num_weights);
+            TEST_ASSERT_EQ(decoded.weight_bits, (int)config.weight_bits);
+            TEST_ASSERT_EQ(decoded.remaining_bits, (int)config.remaining_bits);
+            TEST_ASSERT_EQ(decoded.colour_endpoint_bits, (int)config.colour_endpoint_bits);
+            TEST_ASSERT_EQ(decoded.ce_max, (int)cem_ranges[config.ce_range].max);
+        }
+    }
+}
+
+static void test_quantisation_tables()
+{
+    // Every quantised value must map back to itself (or a value with the
+    // same reconstruction), and every lookup must find the nearest value
+    const QuantisationTables &tables = QuantisationTables::get();
+
+    for (int r = 0; r < ARRAY_SIZE(cem_ranges); ++r) {
+        int ce_max = cem_ranges[r].max;
+        for (int q = 0; q <= ce_max; ++q) {
+            int u = tables.endpoints_unquant[r][q];
+            TEST_ASSERT_EQ((int)tables.endpoints[r][u].unquant, u);
+        }
+        for (int v = 0; v < 256; ++v) {
+            const QuantisationTables::entry &e = tables.endpoints[r][v];
+            TEST_ASSERT_EQ((int)e.unquant, (int)tables.endpoints_unquant[r][e.quant]);
+            for (int q = 0; q <= ce_max; ++q)
+                if (abs(tables.endpoints_unquant[r][q] - v) < abs(e.unquant - v))
+                    TEST_FAIL("Endpoint range " << r << " value " << v << ": " << q << " is nearer than " << (int)e.quant << "\n");
+        }
+    }
+
+    for (int high_prec = 0; high_prec < 2; ++high_prec) {
+        for (int wt_range = 2; wt_range < 8; ++wt_range) {
+            Block blk;
+            blk.high_prec = high_prec;
+            blk.wt_range = wt_range;
+            blk.wt_w = blk.wt_h = blk.wt_d = 1;
+            blk.dual_plane = 0;
+            blk.calculate_from_weights();
+            for (int q = 0; q <= blk.wt_max; ++q) {
+                int u = tables.weights_unquant[high_prec][wt_range][q];
+                TEST_ASSERT_EQ((int)tables.weights[high_prec][wt_range][u].quant, q);
+            }
+            for (int w = 0; w <= 64; ++w) {
+                const QuantisationTables::entry &e = tables.weights[high_prec][wt_range][w];
+                TEST_ASSERT_EQ((int)e.unquant, (int)tables.weights_unquant[high_prec][wt_range][e.quant]);
+                for (int q = 0; q <= blk.wt_max; ++q)
+                    if (abs(tables.weights_unquant[high_prec][wt_range][q] - w) < abs(e.unquant - w))
+                        TEST_FAIL("Weight range " << high_prec << "," << wt_range << " value " << w << ": " << q
+                                << " is nearer than " << (int)e.quant << "\n");
+            }
+        }
+    }
+}
+
+static void test_block_error()
+{
+    static const simd_level levels[] = { simd_level::scalar, simd_level::sse2, simd_level::avx2 };
+
+    // Every pair of endpoint values and every weight must decode the same
+    // as Block::write_decoded(), so a block of the expected colours has no
+    // error. Odd-sized blocks exercise the scalar tails of the SIMD kernels
+    std::vector<uint8x4_t> expected(65);
+    std::vector<int> weights(65);
+    for (int w = 0; w <= 64; ++w)
+        weights[w] = w;
+    for (int a = 0; a < 256; ++a) {
+        for (int b = 0; b < 256; ++b) {
+            uint8x4_t e0, e1;
+            int ends[4][2] = { { a, b }, { b, a }, { a, 255 - b }, { 255 - a, b } };
+            for (int c = 0; c < 4; ++c) {
+                e0.v[c] = ends[c][0];
+                e1.v[c] = ends[c][1];
+            }
+            for (int w = 0; w <= 64; ++w) {
+                for (int c = 0; c < 4; ++c) {
+                    int v = (e0.v[c] * 257 * (64 - w) + e1.v[c] * 257 * w + 32) >> 6;
+                    fp16 f = v == 65535 ? fp16::one() : fp16::from_uint16_div_64k(v);
+                    expected[w].v[c] = f.to_unorm8();
+                }
+            }
+            for (simd_level level : levels) {
+                if (!simd_level_supported(level))
+                    continue;
+                int error = block_error_kernel(level)(expected.data(), 65, nullptr, &e0, &e1, weights.data());
+                if (error != 0)
+                    TEST_FAIL("Level " << (int)level << " endpoints " << a << "," << b << ": error " << error << "\n");
+            }
+        }
+    }
+
+    // With partitions and arbitrary source texels, every kernel must agree
+    std::mt19937 rng(1);
+    for (int n = 0; n < 1000; ++n) {
+        int num_texels = 1 + rng() % 144;
+        uint8x4_t texels[144], e0[4], e1[4];
+        uint8_t parts[144];
+        int w[144];
+        for (int i = 0; i < num_texels; ++i) {
+            for (int c = 0; c < 4; ++c)
+                texels[i].v[c] = rng();
+            parts[i] = rng() % 4;
+            w[i] = rng() % 65;
+        }
+        for (int p = 0; p < 4; ++p) {
+            for (int c = 0; c < 4; ++c) {
+                e0[p].v[c] = rng();
+                e1[p].v[c] = rng();
+            }
+        }
+        int reference = block_error_scalar(texels, num_texels, parts, e0, e1, w);
+        for (simd_level level : levels) {
+            if (!simd_level_supported(level))
+                continue;
+            TEST_ASSERT_EQ(block_error_kernel(level)(texels, num_texels, parts, e0, e1, w), reference);
+            TEST_ASSERT_EQ(block_error_kernel(level)(texels, num_texels, nullptr, e0, e1, w),
+                    block_error_scalar(texels, num_texels, nullptr, e0, e1, w));
+        }
+    }
+}
+
+static void test_compress()
+{
+    static const int sizes[][2] = { { 4, 4 }, { 6, 6 }, { 8, 5 }, { 12, 12 } };
+    static const compress_quality qualities[] = { compress_quality::ultrafast, compress_quality::medium };
+    std::mt19937 rng(1);
+    for (auto &size : sizes) {
+        int bw = size[0], bh = size[1];
+        Decoder dec(bw, bh, 1);
+        for (compress_quality quality : qualities) {
+            Compressor comp(bw, bh, quality);
+
+            // A constant block, a greyscale gradient, an RGBA gradient and
+            // random noise. The first three should be very close; the noise
+            // only needs to produce a valid block
+            for (int kind = 0; kind < 4; ++kind) {
+                uint8_t texels[12*12*4];
+                for (int y = 0; y < bh; ++y) {
+                    for (int x = 0; x < bw; ++x) {
+                        uint8_t *t = &texels[(y * bw + x) * 4];
+                        int g = (x + y) * 255 / (bw + bh - 2);
+                        switch (kind) {
+                        case 0: t[0] = 10; t[1] = 100; t[2] = 200; t[3] = 255; break;
+                        case 1: t[0] = t[1] = t[2] = g; t[3] = 255; break;
+                        case 2: t[0] = g; t[1] = 255 - g; t[2] = g / 2; t[3] = 64 + g / 2; break;
+                        default: for (int c = 0; c < 4; ++c) t[c] = rng(); break;
+                        }
+                    }
+                }
+
+                uint8_t block[16];
+                comp.compress_block(texels, block);
+
+                uint8_t decoded[12*12*4];
+                TEST_ASSERT_EQ((int)dec.decode_unorm8(block, decoded), (int)decode_error::ok);
+                if (kind == 3)
+                    continue;
+                int error = 0;
+                for (int i = 0; i < bw * bh * 4; ++i)
+                    error += (decoded[i] - texels[i]) * (decoded[i] - texels[i]);
+                // RMS error of at most 4, or 24 for ultrafast, whose fixed
+                // block modes have very coarse quantisation at larger sizes
+                int max_rms = quality == compress_quality::ultrafast ? 24 : 4;
+                if (error > max_rms * max_rms * bw * bh * 4)
+                    TEST_FAIL("Block " << bw << "x" << bh << " quality " << (int)quality << " kind " << kind
+                            << ": squared error " << error << "\n");
+            }
+        }
+    }
+}
+
+static void test_partition_library()
+{
+    static const int sizes[][3] = { { 4, 4, 1 }, { 6, 5, 1 }, { 12, 12, 1 }, { 3, 3, 3 }, { 6, 6, 6 } };
+    for (auto &size : sizes) {
+        PartitionLibrary lib(size[0], size[1], size[2]);
+        Decoder dec(size[0], size[1], size[2]);
+        int num_texels = size[0] * size[1] * size[2];
+        for (int num_parts = 2; num_parts <= 4; ++num_parts) {
+            std::set<std::vector<uint8_t>> seen;
+            for (const PartitionLibrary::pattern &pat : lib.patterns(num_parts)) {
+                // Must match the decoder, use every partition, and be
+                // different from every other pattern after relabelling
+                std::vector<uint8_t> canonical(num_texels);
+                int relabel[4] = { -1, -1, -1, -1 };
+                int used = 0;
+                for (int i = 0; i < num_texels; ++i) {
+                    int p = PartitionLibrary::texel_partition(pat, i);
+                    TEST_ASSERT_EQ(p, dec.texel_partition(pat.partition_index, num_parts, i));
+                    if (relabel[p] < 0)
+                        relabel[p] = used++;
+                    canonical[i] = relabel[p];
+                }
+                TEST_ASSERT_EQ(used, num_parts);
+                TEST_ASSERT_EQ((int)seen.insert(canonical).second, 1);
+            }
+            if (lib.patterns(num_parts).empty())
+                TEST_FAIL("No " << num_parts << "-partition patterns for " << size[0] << "x" << size[1] << "x" << size[2] << "\n");
+        }
+    }
+}
+
+static void test_partition_rank()
+{
+    // A block of flat colours laid out exactly like a pattern should rank
+    // that pattern first, and compress almost exactly when the quality
+    // level tries that many partitions
+    static const uint8_t colours[4][4] = {
+        { 200, 30, 30, 255 }, { 30, 200, 30, 255 }, { 30, 30, 200, 255 }, { 200, 200, 30, 255 }
+    };
+    static const int sizes[][2] = { { 4, 4 }, { 8, 6 }, { 12, 12 } };
+    for (auto &size : sizes) {
+        int bw = size[0], bh = size[1];
+        PartitionLibrary lib(bw, bh, 1);
+        Decoder dec(bw, bh, 1);
+        Compressor comp(bw, bh, compress_quality::thorough);
+        for (int num_parts = 2; num_parts <= 4; ++num_parts) {
+            const std::vector<PartitionLibrary::pattern> &patterns = lib.patterns(num_parts);
+            for (int n = 0; n < (int)patterns.size(); n += 37) {
+                uint8_t texels[12*12*4];
+                for (int i = 0; i < bw * bh; ++i)
+                    memcpy(&texels[i * 4], colours[PartitionLibrary::texel_partition(patterns[n], i)], 4);
+
+                int ranked[4];
+                TEST_ASSERT_EQ(lib.rank((const uint8x4_t *)texels, num_parts, 4, ranked), 4);
+                TEST_ASSERT_EQ(ranked[0], n);
+
+                if (num_parts > 3)
+                    continue;
+                uint8_t block[16], decoded[12*12*4];
+                comp.compress_block(texels, block);
+                TEST_ASSERT_EQ((int)dec.decode_unorm8(block, decoded), (int)decode_error::ok);
+                int error = 0;
+                for (int i = 0; i < bw * bh * 4; ++i)
+                    error += (decoded[i] - texels[i]) * (decoded[i] - texels[i]);
+                if (error > 4 * 4 * bw * bh * 4)
+                    TEST_FAIL("Block " << bw << "x" << bh << " pattern " << patterns[n].partition_index
+                            << " (" << num_parts << " partitions): squared error " << error << "\n");
+            }
+        }
+    }
+}
+
+static void test_void_extent()
+{
+    // Void-extent blocks must survive a round trip through the encoder
+    for (int block_d = 1; block_d <= 4; block_d += 3) {
+        Encoder encoder(4, 4, block_d);
+        Decoder decoder(4, 4, block_d);
+        int coord_max = block_d > 1 ? 0x1ff : 0x1fff;
+        for (int with_extent = 0; with_extent <= 1; ++with_extent) {
+            Block blk;
+            blk.is_void_extent = true;
+            blk.void_extent_d = 0;
+            blk.void_extent_min_s = with_extent ? 1 : coord_max;
+            blk.void_extent_max_s = with_extent ? coord_max - 1 : coord_max;
+            blk.void_extent_min_t = with_extent ? 2 : coord_max;
+            blk.void_extent_max_t = with_extent ? 3 : coord_max;
+            blk.void_extent_min_p = with_extent ? 4 : coord_max;
+            blk.void_extent_max_p = with_extent ? 5 : coord_max;
+            blk.void_extent_colour_r = 0x1234;
+            blk.void_extent_colour_g = 0x5678;
+            blk.void_extent_colour_b = 0x9abc;
+            blk.void_extent_colour_a = 0xdef0;
+
+            OutputBitVector encoded = blk.encode(encoder);
+            InputBitVector in;
+            memcpy(in.data, encoded.data, sizeof(in.data));
+            Block decoded;
+            TEST_ASSERT_EQ((int)decoded.decode(decoder, in), (int)decode_error::ok);
+            TEST_ASSERT_EQ(decoded.is_void_extent, true);
+            TEST_ASSERT_EQ(decoded.void_extent_d, 0);
+            TEST_ASSERT_EQ(decoded.void_extent_min_s, blk.void_extent_min_s);
+            TEST_ASSERT_EQ(decoded.void_extent_max_s, blk.void_extent_max_s);
+            TEST_ASSERT_EQ(decoded.void_extent_min_t, blk.void_extent_min_t);
+            TEST_ASSERT_EQ(decoded.void_extent_max_t, blk.void_extent_max_t);
+            if (block_d > 1) {
+                TEST_ASSERT_EQ(decoded.void_extent_min_p, blk.void_extent_min_p);
+                TEST_ASSERT_EQ(decoded.void_extent_max_p, blk.void_extent_max_p);
+            }
+            TEST_ASSERT_EQ(decoded.void_extent_colour_r, blk.void_extent_colour_r);
+            TEST_ASSERT_EQ(decoded.void_extent_colour_g, blk.void_extent_colour_g);
+            TEST_ASSERT_EQ(decoded.void_extent_colour_b, blk.void_extent_colour_b);
+            TEST_ASSERT_EQ(decoded.void_extent_colour_a, blk.void_extent_colour_a);
+        }
+    }
+
+    // Constant blocks must be encoded exactly as void extents at every
+    // quality level
+    static const compress_quality qualities[] = {
+        compress_quality::ultrafast, compress_quality::fast, compress_quality::medium, compress_quality::thorough
+    };
+    Decoder dec(6, 5, 1);
+    for (compress_quality quality : qualities) {
+        Compressor comp(6, 5, quality);
+        for (int v = 0; v < 256; ++v) {
+            uint8_t texels[6*5*4], decoded[6*5*4], block[16];
+            for (int i = 0; i < 6*5; ++i) {
+                texels[i*4+0] = v;
+                texels[i*4+1] = 255 - v;
+                texels[i*4+2] = v / 2;
+                texels[i*4+3] = (v * 7) & 0xff;
+            }
+            comp.compress_block(texels, block);
+            TEST_ASSERT_EQ((int)dec.decode_unorm8(block, decoded), (int)decode_error::ok);
+            TEST_ASSERT_EQ(memcmp(decoded, texels, sizeof(texels)), 0);
+
+            InputBitVector in;
+            memcpy(in.data, block, 16);
+            Block blk;
+            TEST_ASSERT_EQ((int)blk.decode(dec, in), (int)decode_error::ok);
+            TEST_ASSERT_EQ(blk.is_void_extent, true);
+            TEST_ASSERT_EQ(blk.void_extent_min_s, 0x1fff);
+        }
+    }
+
+    // In an image, each constant block's extent must lie between the
+    // centres of its first and last texels inside the image
+    const int image_w = 20, image_h = 14;
+    std::vector<uint8_t> image(image_w * image_h * 4, 0x80);
+    Compressor comp(6, 5, compress_quality::fast);
+    const int blocks_x = 4, blocks_y = 3;
+    std::vector<uint8_t> blocks(blocks_x * blocks_y * 16);
+    comp.compress_image(image.data(), image_w, image_h, image_w * 4, blocks.data());
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            InputBitVector in;
+            memcpy(in.data, &blocks[(by * blocks_x + bx) * 16], 16);
+            Block blk;
+            TEST_ASSERT_EQ((int)blk.decode(dec, in), (int)decode_error::ok);
+            TEST_ASSERT_EQ(blk.is_void_extent, true);
+            int x0 = bx * 6, x1 = std::min(x0 + 6, image_w) - 1;
+            int y0 = by * 5, y1 = std::min(y0 + 5, image_h) - 1;
+            if (blk.void_extent_min_s * 2 * image_w < (2 * x0 + 1) * 8192
+                    || blk.void_extent_max_s * 2 * image_w > (2 * x1 + 1) * 8192
+                    || blk.void_extent_min_t * 2 * image_h < (2 * y0 + 1) * 8192
+                    || blk.void_extent_max_t * 2 * image_h > (2 * y1 + 1) * 8192)
+                TEST_FAIL("Block " << bx << "," << by << " has extent s " << blk.void_extent_min_s << ".."
+                        << blk.void_extent_max_s << " t " << blk.void_extent_min_t << ".." << blk.void_extent_max_t << "\n");
+        }
+    }
+}
+
+static void test_compress_image()
+{
+    // compress_image() must match compress_block() on each block, with the
+    // texels past the edges clamped, and must respect the row pitch
+    const int image_w = 13, image_h = 7, row_pitch = 64;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image(row_pitch * image_h);
+    for (auto &v : image)
+        v = rng();
+
+    Compressor comp(6, 5, compress_quality::ultrafast);
+    const int blocks_x = 3, blocks_y = 2;
+    std::vector<uint8_t> blocks(blocks_x * blocks_y * 16);
+    comp.compress_image(image.data(), image_w, image_h, row_pitch, blocks.data());
+
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            uint8_t texels[6*5*4];
+            for (int y = 0; y < 5; ++y) {
+                for (int x = 0; x < 6; ++x) {
+                    int sx = std::min(bx * 6 + x, image_w - 1);
+                    int sy = std::min(by * 5 + y, image_h - 1);
+                    memcpy(&texels[(y * 6 + x) * 4], &image[sy * row_pitch + sx * 4], 4);
+                }
+            }
+            uint8_t block[16];
+            comp.compress_block(texels, block, bx * 6, by * 5, image_w, image_h);
+            if (memcmp(block, &blocks[(by * blocks_x + bx) * 16], 16) != 0)
+                TEST_FAIL("Block " << bx << "," << by << " differs\n");
+        }
+    }
+}
+
+static void test_compress_changed_blocks()
+{
+    // Recompressing only the changed blocks must give the same blocks as
+    // compressing the new image from scratch
+    const int image_w = 23, image_h = 17;
+    std::mt19937 rng(2);
+    std::vector<uint8_t> image(image_w * image_h * 4);
+    for (auto &v : image)
+        v = rng() & 0xf0;
+
+    Compressor comp(6, 5, compress_quality::medium);
+    const int blocks_x = 4, blocks_y = 4;
+    std::vector<uint8_t> blocks(blocks_x * blocks_y * 16);
+    comp.compress_image(image.data(), image_w, image_h, image_w * 4, blocks.data());
+    std::vector<uint64_t> old_hashes(blocks_x * blocks_y);
+    comp.hash_blocks(image.data(), image_w, image_h, image_w * 4, old_hashes.data());
+
+    // Change one texel inside block (1,1), and the bottom-right texel of the
+    // image, which is also copied into the padding of block (3,3)
+    image[(7 * image_w + 8) * 4 + 2] ^= 1;
+    image[(image_h * image_w - 1) * 4] ^= 0x80;
+
+    std::vector<uint64_t> new_hashes(blocks_x * blocks_y);
+    comp.hash_blocks(image.data(), image_w, image_h, image_w * 4, new_hashes.data(), 3);
+    int num_changed = comp.compress_changed_blocks(image.data(), image_w, image_h, image_w * 4,
+            old_hashes.data(), new_hashes.data(), blocks.data(), 3);
+    if (num_changed < 2)
+        TEST_FAIL("Only " << num_changed << " blocks recompressed\n");
+    for (int i = 0; i < blocks_x * blocks_y; ++i)
+        TEST_ASSERT_EQ(old_hashes[i] != new_hashes[i], i == 1 * blocks_x + 1 || i == 3 * blocks_x + 3);
+
+    std::vector<uint8_t> expected(blocks.size());
+    comp.compress_image(image.data(), image_w, image_h, image_w * 4, expected.data());
+    if (blocks != expected)
+        TEST_FAIL("compress_changed_blocks() output differs from compress_image()\n");
+
+    // Every single-bit change to a block's texels must change its hash
+    uint8_t texels[6*5*4];
+    for (auto &v : texels)
+        v = rng();
+    uint64_t hash = hash_bytes(texels, sizeof(texels));
+    for (int bit = 0; bit < (int)sizeof(texels) * 8; ++bit) {
+        texels[bit / 8] ^= 1 << (bit % 8);
+        if (hash_bytes(texels, sizeof(texels)) == hash)
+            TEST_FAIL("Hash unchanged by flipping bit " << bit << "\n");
+        texels[bit / 8] ^= 1 << (bit % 8);
+    }
+}
+
+static void test_parallel_for_chunks()
+{
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+        for (int chunk_size : { 1, 3, 64 }) {
+            for (int num_items : { 0, 1, 100, 1000 }) {
+                std::vector<std::atomic<int>> counts(num_items);
+                for (auto &c : counts)
+                    c = 0;
+                parallel_for_chunks(num_items, chunk_size, num_threads, [&](int begin, int end) {
+                    if (end - begin > chunk_size)
+                        TEST_FAIL("Chunk " << begin << ".." << end << " is larger than " << chunk_size << "\n");
+                    for (int i = begin; i < end; ++i)
+                        ++counts[i];
+                });
+                for (int i = 0; i < num_items; ++i)
+                    TEST_ASSERT_EQ((int)counts[i], 1);
+            }
+        }
+    }
+}
+
+static void test_compress_threads()
+{
+    // The output must not depend on the number of threads
+    const int image_w = 200, image_h = 150;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image(image_w * image_h * 4);
+    for (auto &v : image)
+        v = rng();
+
+    for (compress_quality quality : { compress_quality::fast, compress_quality::medium }) {
+        Compressor comp(6, 6, quality);
+        std::vector<uint8_t> blocks_1(34 * 25 * 16), blocks_n(34 * 25 * 16);
+        comp.compress_image(image.data(), image_w, image_h, image_w * 4, blocks_1.data(), 1);
+        comp.compress_image(image.data(), image_w, image_h, image_w * 4, blocks_n.data(), 7);
+        TEST_ASSERT_EQ(memcmp(blocks_1.data(), blocks_n.data(), blocks_1.size()), 0);
+    }
+}
+
+static void test_compress_seeded()
+{
+    // A smooth gradient, where neighbouring blocks want the same block modes
+    const int image_w = 60, image_h = 42;
+    std::vector<uint8_t> image(image_w * image_h * 4);
+    for (int y = 0; y < image_h; ++y) {
+        for (int x = 0; x < image_w; ++x) {
+            uint8_t *p = &image[(y * image_w + x) * 4];
+            int t = x * 2 + y * 3;
+            p[0] = t;
+            p[1] = 255 - t;
+            p[2] = t / 2;
+            p[3] = 255;
+        }
+    }
+
+    Compressor comp(6, 6, compress_quality::medium);
+    std::vector<uint8_t> blocks(10 * 7 * 16);
+    compress_stats stats;
+    comp.compress_image(image.data(), image_w, image_h, image_w * 4, blocks.data(), 1, &stats);
+    TEST_ASSERT_EQ(stats.blocks, 70u);
+
+    // Every block but the first of each seed group has a neighbour
+    TEST_ASSERT_EQ(stats.seeded_blocks, 68u);
+    if (stats.seed_accepted < stats.seeded_blocks / 2)
+        TEST_FAIL("Only " << stats.seed_accepted << " of " << stats.seeded_blocks << " seeds accepted (" << stats.seed_best << " best)\n");
+
+    // Seeding mustn't make it much worse than compressing each block alone
+    uint8_t texels[6*6*4];
+    for (int by = 0; by < 7; ++by) {
+        for (int bx = 0; bx < 10; ++bx) {
+            for (int y = 0; y < 6; ++y)
+                memcpy(&texels[y * 6 * 4], &image[((by * 6 + y) * image_w + bx * 6) * 4], 6 * 4);
+            uint8_t alone[16];
+            comp.compress_block(texels, alone, bx * 6, by * 6, image_w, image_h);
+
+            int errors[2] = { 0, 0 };
+            const uint8_t *encoded[2] = { alone, &blocks[(by * 10 + bx) * 16] };
+            for (int i = 0; i < 2; ++i) {
+                uint8_t decoded[6*6*4];
+                Decoder dec(6, 6, 1, decode_profile::ldr);
+                dec.decode_unorm8(encoded[i], decoded);
+                for (int j = 0; j < 6*6*4; ++j)
+                    errors[i] += (decoded[j] - texels[j]) * (decoded[j] - texels[j]);
+            }
+            if (errors[1] > std::max(errors[0] * 2, 16 * 36))
+                TEST_FAIL("Block " << bx << "," << by << " error " << errors[1] << " seeded vs " << errors[0] << " alone\n");
+        }
+    }
+}
+
+static void test_decode_timing()
+{
+    // Every block decoded by any thread must be counted, including the
+    // threads that have exited, and nothing is counted when disabled
+    reset_decode_timing();
+
+    Decoder dec(6, 6, 1);
+    uint8_t void_extent[16] = { 0xfc, 0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint8_t reserved[16] = {};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            uint8_t out[6*6*4];
+            for (int i = 0; i < 100; ++i) {
+                dec.decode_unorm8(void_extent, out);
+                dec.decode_unorm8(reserved, out);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    decode_timing timing = get_decode_timing();
+    int expected = OASTC_DECODE_TIMING ? 400 : 0;
+    TEST_ASSERT_EQ(timing.errors[(int)decode_error::ok], (uint64_t)expected);
+    TEST_ASSERT_EQ(timing.errors[(int)decode_error::reserved_block_mode_2], (uint64_t)expected);
+    TEST_ASSERT_EQ(timing.calls[(int)decode_stage::block_mode], (uint64_t)expected);
+    TEST_ASSERT_EQ(timing.calls[(int)decode_stage::write_decoded], (uint64_t)expected);
+    TEST_ASSERT_EQ(timing.calls[(int)decode_stage::cem], (uint64_t)0);
+
+    reset_decode_timing();
+    TEST_ASSERT_EQ(get_decode_timing().errors[(int)decode_error::ok], (uint64_t)0);
+}
+
+static void test_content_stats()
+{
+    // A solid left half (all void-extent) and a noisy right half, with one
+    // of the noisy blocks duplicated and one replaced by an invalid block
+    const int image_w = 24, image_h = 12;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image(image_w * image_h * 4);
+    for (int y = 0; y < image_h; ++y)
+        for (int x = 0; x < image_w; ++x)
+            for (int c = 0; c < 4; ++c)
+                image[(y * image_w + x) * 4 + c] = x < 12 ? 0x40 : (uint8_t)rng();
+
+    astc_image img = { 6, 6, 1, image_w, image_h, 1, 4, 2, 1, std::vector<uint8_t>(8 * 16) };
+    Compressor comp(6, 6, compress_quality::fast);
+    comp.compress_image(image.data(), image_w, image_h, image_w * 4, img.blocks.data());
+    memcpy(&img.blocks[6 * 16], &img.blocks[3 * 16], 16);
+    memset(&img.blocks[7 * 16], 0, 16);
+
+    Decoder dec(6, 6, 1);
+    content_stats stats;
+    gather_content_stats(dec, img, stats);
+
+    TEST_ASSERT_EQ(stats.blocks, (uint64_t)8);
+    TEST_ASSERT_EQ(stats.errors[(int)decode_error::ok], (uint64_t)7);
+    TEST_ASSERT_EQ(stats.errors[(int)decode_error::reserved_block_mode_2], (uint64_t)1);
+    TEST_ASSERT_EQ(stats.void_extent_ldr, (uint64_t)4);
+    TEST_ASSERT_EQ(stats.void_extent_hdr, (uint64_t)0);
+    TEST_ASSERT_EQ(stats.duplicate_blocks, (uint64_t)1);
+
+    uint64_t counted[5] = {};
+    const std::map<int, uint64_t> *int_hists[] = { &stats.partitions, &stats.weight_levels, &stats.endpoint_levels };
+    for (int h = 0; h < 3; ++h)
+        for (auto &kv : *int_hists[h])
+            counted[h] += kv.second;
+    for (auto &kv : stats.cems)
+        counted[3] += kv.second;
+    for (auto &kv : stats.weight_grids)
+        counted[4] += kv.second;
+    for (int h = 0; h < 5; ++h)
+        TEST_ASSERT_EQ(counted[h], (uint64_t)3);
+}
+
+static void test_trace_buffer()
+{
+    // A full buffer keeps the newest events, oldest first
+    TraceBuffer buffer(1, 16);
+    for (int i = 0; i < 20; ++i)
+        buffer.push({ "test", i, (uint64_t)i, (uint64_t)i + 1 });
+
+    TEST_ASSERT_EQ(buffer.num_dropped(), (uint64_t)4);
+    int64_t expected = 4;
+    buffer.for_each([&](const TraceEvent &e) {
+        TEST_ASSERT_EQ(e.arg, expected);
+        expected++;
+    });
+    TEST_ASSERT_EQ(expected, (int64_t)20);
+}
+
+static void test_decode_check()
+{
+    // The optimised decode paths must match the reference decoder on
+    // random blocks (mostly invalid) and on blocks from the compressor
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image(24 * 20 * 4);
+    for (int i = 0; i < (int)image.size(); ++i)
+        image[i] = (i / 4 % 24) * 10 + (rng() & 15);
+    std::vector<uint8_t> blocks(4 * 4 * 16);
+    Compressor comp(6, 5, compress_quality::fast);
+    comp.compress_image(image.data(), 24, 20, 24 * 4, blocks.data());
+
+    for (decode_profile profile : { decode_profile::ldr, decode_profile::ldr_srgb, decode_profile::hdr }) {
+        DecodeChecker checker_2d(6, 5, 1, profile);
+        DecodeChecker checker_3d(4, 4, 4, profile);
+        decode_mismatch mismatch;
+        for (int i = 0; i < 2000; ++i) {
+            uint32_t block[4] = { (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng() };
+            if (!checker_2d.check((const uint8_t *)block, mismatch) || !checker_3d.check((const uint8_t *)block, mismatch)) {
+                TEST_FAIL("Random block differs from the reference decoder in ") << mismatch.path << "\n";
+                break;
+            }
+        }
+        for (size_t i = 0; i < blocks.size(); i += 16) {
+            if (!checker_2d.check(&blocks[i], mismatch))
+                TEST_FAIL("Compressed block differs from the reference decoder in ") << mismatch.path << "\n";
+        }
+    }
+
+    // The unorm8-vs-fp16 check must cover sRGB alpha: an opaque texel
+    // decoded to fp16 0x3bfc (0xff80/65536, rather than 1.0) is flagged
+    for (int y = 0; y < 5; ++y)
+        for (int x = 0; x < 6; ++x)
+            image[(y * 24 + x) * 4 + 3] = 255;
+    uint8_t opaque_block[16];
+    comp.compress_image(image.data(), 6, 5, 24 * 4, opaque_block);
+
+    DecodeChecker srgb_checker(6, 5, 1, decode_profile::ldr_srgb);
+    const Decoder &srgb_dec = srgb_checker.reference_decoder();
+    fp16 ref_fp16[6*5*4];
+    uint8_t ref_unorm8[6*5*4];
+    TEST_ASSERT_EQ((int)srgb_dec.decode(opaque_block, ref_fp16), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)srgb_dec.decode_unorm8(opaque_block, ref_unorm8), (int)decode_error::ok);
+    TEST_ASSERT_EQ((int)ref_unorm8[3], 255);
+    decode_mismatch mismatch;
+    TEST_ASSERT_EQ(srgb_checker.check_unorm8_matches_fp16(decode_error::ok, ref_fp16, ref_unorm8, mismatch), true);
+    ref_fp16[3] = fp16::from_bits(0x3bfc);
+    TEST_ASSERT_EQ(srgb_checker.check_unorm8_matches_fp16(decode_error::ok, ref_fp16, ref_unorm8, mismatch), false);
+    TEST_ASSERT_EQ(mismatch.texel, 0);
+    TEST_ASSERT_EQ(mismatch.channel, 3);
+}
+
+static void test_compare_unorm8()
+{
+    static const simd_level levels[] = { simd_level::scalar, simd_level::sse2, simd_level::avx2 };
+    std::mt19937 rng(1);
+
+    // Odd lengths exercise the scalar tails, and the long all-255 run
+    // exercises flushing the vector sums before they overflow
+    std::vector<size_t> lengths = { 0, 1, 15, 16, 17, 31, 33, 100, 1000 };
+    lengths.push_back(4096 * 32 * 3 + 7);
+    for (size_t n : lengths) {
+        for (int pattern = 0; pattern < 3; ++pattern) {
+            std::vector<uint8_t> a(n), b(n);
+            for (size_t i = 0; i < n; ++i) {
+                a[i] = rng();
+                if (pattern == 0)
+                    b[i] = a[i];
+                else if (pattern == 1)
+                    b[i] = rng() % 4 ? a[i] : rng();
+                else
+                    a[i] = 0, b[i] = 255;
+            }
+
+            image_diff reference = compare_unorm8_scalar(a.data(), b.data(), n);
+            TEST_ASSERT_EQ(reference.num_values, n);
+            if (pattern == 0)
+                TEST_ASSERT_EQ(reference.mismatches, 0u);
+            if (pattern == 2)
+                TEST_ASSERT_EQ(reference.sum_sq_error, (uint64_t)n * 255 * 255);
+
+            for (simd_level level : levels) {
+                if (!simd_level_supported(level))
+                    continue;
+                image_diff diff = compare_unorm8_kernel(level)(a.data(), b.data(), n);
+                TEST_ASSERT_EQ(diff.num_values, reference.num_values);
+                TEST_ASSERT_EQ(diff.mismatches, reference.mismatches);
+                TEST_ASSERT_EQ(diff.sum_sq_error, reference.sum_sq_error);
+                TEST_ASSERT_EQ(diff.max_error, reference.max_error);
+            }
+        }
+    }
+
+    image_diff same = compare_unorm8_scalar(nullptr, nullptr, 0);
+    TEST_ASSERT_EQ(std::isinf(same.psnr()), true);
+}
+
+/**
+ * A file name for a test to write to and delete
+ */
+static std::string temp_filename(const char *name)
+{
+    return std::string("/tmp/oastc_unit_tests_") + std::to_string(getpid()) + "_" + name;
+}
+
+static void test_tga_round_trip()
+{
+    // Not symmetric in either direction, so a flip would be noticed
+    const int w = 5, h = 3;
+    for (bool alpha : { false, true }) {
+        std::vector<uint8_t> image(w * h * 4);
+        for (int i = 0; i < w * h; ++i) {
+            image[i*4+0] = i * 10;
+            image[i*4+1] = 200 - i;
+            image[i*4+2] = i * i;
+            image[i*4+3] = alpha ? i * 3 : 255;
+        }
+
+        std::string fn = temp_filename("round_trip.tga");
+        int read_w = 0, read_h = 0;
+        std::vector<uint8_t> read;
+        TEST_ASSERT_EQ(write_tga(fn.c_str(), w, h, image), true);
+        TEST_ASSERT_EQ(read_tga(fn.c_str(), read_w, read_h, read), true);
+        std::remove(fn.c_str());
+        TEST_ASSERT_EQ(read_w, w);
+        TEST_ASSERT_EQ(read_h, h);
+        if (read != image)
+            TEST_FAIL(".tga round trip changed the image (alpha " << alpha << ")\n");
+    }
+
+    // A file with the top-left origin flag stores the last row first
+    uint8_t top_down[18 + 2 * 3] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 2, 0, 24, 0x20,
+        3, 2, 1, // BGR of the top row
+        6, 5, 4 };
+    std::string fn = temp_filename("top_down.tga");
+    {
+        std::ofstream out(fn, std::ios_base::binary);
+        out.write((const char *)top_down, sizeof(top_down));
+    }
+    int read_w = 0, read_h = 0;
+    std::vector<uint8_t> read;
+    TEST_ASSERT_EQ(read_tga(fn.c_str(), read_w, read_h, read), true);
+    std::remove(fn.c_str());
+    std::vector<uint8_t> expected = { 4, 5, 6, 255, 1, 2, 3, 255 };
+    if (read != expected)
+        TEST_FAIL("Top-down .tga rows are in the wrong order\n");
+}
+
+static void test_compare_mapped_tga()
+{
+    const int w = 3, h = 4;
+    std::vector<uint8_t> image(w * h * 4);
+    for (int i = 0; i < w * h * 4; ++i)
+        image[i] = i % 4 == 3 ? 255 : i * 7;
+
+    // The same image with the default bottom-left origin (from write_tga)
+    // and with the top-left origin flag, which stores the rows reversed
+    std::string bottom_up_fn = temp_filename("bottom_up.tga");
+    std::string top_down_fn = temp_filename("top_down.tga");
+    TEST_ASSERT_EQ(write_tga(bottom_up_fn.c_str(), w, h, image), true);
+    {
+        uint8_t header[18] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, w, 0, h, 0, 24, 0x20 };
+        std::ofstream out(top_down_fn, std::ios_base::binary);
+        out.write((const char *)header, sizeof(header));
+        for (int y = h - 1; y >= 0; --y) {
+            for (int x = 0; x < w; ++x) {
+                const uint8_t *t = &image[(y * w + x) * 4];
+                uint8_t bgr[3] = { t[2], t[1], t[0] };
+                out.write((const char *)bgr, 3);
+            }
+        }
+    }
+
+    mapped_image bottom_up, top_down;
+    TEST_ASSERT_EQ(map_image(bottom_up_fn.c_str(), bottom_up), true);
+    TEST_ASSERT_EQ(map_image(top_down_fn.c_str(), top_down), true);
+    std::remove(bottom_up_fn.c_str());
+    std::remove(top_down_fn.c_str());
+    TEST_ASSERT_EQ(top_down.top_down, true);
+    TEST_ASSERT_EQ(bottom_up.same_layout(top_down), true);
+
+    image_diff diff_mapped, diff_image;
+    std::vector<uint8_t> row(w * 4);
+    for (int y = 0; y < h; ++y) {
+        diff_mapped += compare_unorm8(bottom_up.row(y), top_down.row(y), w * 3);
+        top_down.row_rgba8(y, row.data());
+        diff_image += compare_unorm8(row.data(), &image[y * w * 4], w * 4);
+    }
+    TEST_ASSERT_EQ(diff_mapped.mismatches, 0u);
+    TEST_ASSERT_EQ(diff_image.mismatches, 0u);
+    TEST_ASSERT_EQ(diff_image.num_values, (uint64_t)w * h * 4);
+}
+
+static void test_read_astc_block_size()
+{
+    // Block sizes the decoders can't handle must be rejected by the reader,
+    // not divided by or used to index fixed-size texel buffers. The first
+    // two are valid
+    static const int sizes[7][3] = { { 6, 6, 6 }, { 12, 12, 1 }, { 0, 0, 0 }, { 4, 4, 0 }, { 16, 16, 1 }, { 7, 7, 1 }, { 8, 8, 8 } };
+    std::string fn = temp_filename("block_size.astc");
+    for (int i = 0; i < 7; ++i) {
+        const int *s = sizes[i];
+        std::vector<uint8_t> blocks(16 * 4);
+        TEST_ASSERT_EQ(write_astc(fn.c_str(), s[0], s[1], s[2], 1, 1, 1, blocks), true);
+        astc_image img;
+        bool valid = i < 2;
+        if (read_astc(fn.c_str(), img) != valid)
+            TEST_FAIL("read_astc() " << (valid ? "rejected" : "accepted") << " block size "
+                    << s[0] << "x" << s[1] << "x" << s[2] << "\n");
+    }
+    std::remove(fn.c_str());
+}
+
+static void test_write_raw_3d()
+{
+    // Rows narrower than raw_row_alignment, so the padding shows up
+    const int w = 3, h = 2, d = 4;
+    std::vector<uint8_t> image(w * h * d * 4);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = i;
+
+    std::string fn = temp_filename("volume.raw");
+    raw_level level = { w, h, d, image.data() };
+    TEST_ASSERT_EQ(write_raw(fn.c_str(), RAW_FORMAT_RGBA8_UNORM, { level }), true);
+    std::vector<char> file;
+    {
+        std::ifstream in(fn, std::ios_base::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::remove(fn.c_str());
+    TEST_ASSERT_EQ(file.size() >= sizeof(raw_header) + sizeof(raw_level_header), true);
+
+    raw_header header;
+    raw_level_header lh;
+    memcpy(&header, file.data(), sizeof(header));
+    memcpy(&lh, file.data() + sizeof(header), sizeof(lh));
+    TEST_ASSERT_EQ(memcmp(header.magic, "OASTCRAW", 8), 0);
+    TEST_ASSERT_EQ(header.version, 1u);
+    TEST_ASSERT_EQ(header.pixel_format, (uint32_t)RAW_FORMAT_RGBA8_UNORM);
+    TEST_ASSERT_EQ(header.bytes_per_pixel, 4u);
+    TEST_ASSERT_EQ(header.width, (uint32_t)w);
+    TEST_ASSERT_EQ(header.height, (uint32_t)h);
+    TEST_ASSERT_EQ(header.depth, (uint32_t)d);
+    TEST_ASSERT_EQ(header.num_levels, 1u);
+    TEST_ASSERT_EQ(lh.width, (uint32_t)w);
+    TEST_ASSERT_EQ(lh.height, (uint32_t)h);
+    TEST_ASSERT_EQ(lh.depth, (uint32_t)d);
+    TEST_ASSERT_EQ(lh.offset % raw_level_alignment, 0u);
+    TEST_ASSERT_EQ(lh.row_pitch, raw_row_alignment);
+    TEST_ASSERT_EQ(lh.size, (uint64_t)lh.row_pitch * h * d);
+    TEST_ASSERT_EQ(file.size(), lh.offset + lh.size);
+
+    // Slice z starts row_pitch * height bytes after slice z-1
+    for (int z = 0; z < d; ++z) {
+        for (int y = 0; y < h; ++y) {
+            const char *row = file.data() + lh.offset + ((size_t)z * h + y) * lh.row_pitch;
+            if (memcmp(row, &image[((z * h + y) * w) * 4], w * 4) != 0)
+                TEST_FAIL(".raw row " << y << " of slice " << z << " is in the wrong place\n");
+        }
+    }
+}
+
+static void test_raw_orientation()
+{
+    // Row 0 is the bottom row everywhere, so the .raw file must start with
+    // it and map_image() must hand it back as row 0, like a .tga of the same
+    // image. The rows differ, so a flip would be noticed
+    const int w = 2, h = 3;
+    std::vector<uint8_t> image(w * h * 4);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = i * 7;
+
+    std::string raw_fn = temp_filename("orientation.raw");
+    std::string tga_fn = temp_filename("orientation.tga");
+    raw_level level = { w, h, 1, image.data() };
+    TEST_ASSERT_EQ(write_raw(raw_fn.c_str(), RAW_FORMAT_RGBA8_UNORM, { level }), true);
+    TEST_ASSERT_EQ(write_tga(tga_fn.c_str(), w, h, image), true);
+
+    mapped_image raw, tga;
+    TEST_ASSERT_EQ(map_image(raw_fn.c_str(), raw), true);
+    TEST_ASSERT_EQ(map_image(tga_fn.c_str(), tga), true);
+    TEST_ASSERT_EQ(raw.width, w);
+    TEST_ASSERT_EQ(tga.width, w);
+    TEST_ASSERT_EQ(memcmp(raw.pixels, image.data(), w * 4), 0);
+    std::vector<uint8_t> raw_row(w * 4), tga_row(w * 4);
+    for (int y = 0; y < h; ++y) {
+        raw.row_rgba8(y, raw_row.data());
+        tga.row_rgba8(y, tga_row.data());
+        if (memcmp(raw_row.data(), &image[y * w * 4], w * 4) != 0)
+            TEST_FAIL("Mapped .raw row " << y << " is not image row " << y << "\n");
+        if (raw_row != tga_row)
+            TEST_FAIL("Mapped .raw and .tga row " << y << " differ\n");
+    }
+    std::remove(raw_fn.c_str());
+    std::remove(tga_fn.c_str());
+}
+
+static void test_write_ktx_too_large()
+{
+    // imageSize is 32 bits, so this must fail before touching the data
+    std::string fn = temp_filename("too_large.ktx");
+    TEST_ASSERT_EQ(write_ktx(fn.c_str(), 32768, 32768, 1, GL_UNSIGNED_BYTE_, 1, GL_RGBA_, GL_RGBA8_, GL_RGBA_,
+            nullptr, (size_t)32768 * 32768 * 4), false);
+    TEST_ASSERT_EQ(std::ifstream(fn).good(), false);
+}
+
 static void test()
 {
     test_get_bits();
     test_get_bits64();
     test_get_bits_rev();
     test_trits();
+    test_trit_quint_encode_tables();
     test_fp16();
     test_fp16_unorm();
+    test_block_mode_3d();
+    test_infill_3d();
+    test_decode_unorm8();
+    test_srgb();
+    test_lns_to_fp16();
+    test_hdr();
+    test_transcode_bc7();
+    test_transcode_bc1();
+    test_transcode_hints();
+    test_block_mode_grids();
+    test_config_table();
+    test_quantisation_tables();
+    test_block_error();
+    test_compress();
+    test_partition_library();
+    test_partition_rank();
+    test_void_extent();
+    test_compress_image();
+    test_compress_changed_blocks();
+    test_parallel_for_chunks();
+    test_compress_threads();
+    test_compress_seeded();
+    test_decode_timing();
+    test_content_stats();
+    test_trace_buffer();
+    test_decode_check();
+    test_compare_unorm8();
+    test_tga_round_trip();
+    test_compare_mapped_tga();
+    test_read_astc_block_size();
+    test_write_raw_3d();
+    test_raw_orientation();
+    test_write_ktx_too_large();
 
     if (test_failures > 0)
         exit(-1);